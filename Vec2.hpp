@@ -3,6 +3,7 @@
 
 #include <cmath>
 
+// the small operators are defined inline so they can be inlined (and vectorized) at the call site
 struct Vec2
 {
     float x{};
@@ -12,20 +13,51 @@ struct Vec2
 
     constexpr Vec2(const Vec2& pos_vector) : x(pos_vector.x), y(pos_vector.y) {};
 
-    Vec2 operator+(const Vec2& other_vector) const;
+    constexpr Vec2& operator=(const Vec2& other_vector) = default;
 
-    Vec2& operator+=(const Vec2& other_vector);
+    constexpr Vec2 operator+(const Vec2& other_vector) const
+    {
+        return Vec2(x + other_vector.x, y + other_vector.y);
+    }
 
-    Vec2 operator-(const Vec2& other_vector) const; //const on outsude doesnt modify "this" object
+    constexpr Vec2& operator+=(const Vec2& other_vector)
+    {
+        x += other_vector.x;
+        y += other_vector.y;
+        return *this;
+    }
 
-    Vec2& operator-=(const Vec2& other_vector);
+    constexpr Vec2 operator-(const Vec2& other_vector) const //const on outsude doesnt modify "this" object
+    {
+        return Vec2(x - other_vector.x, y - other_vector.y);
+    }
 
-    Vec2 operator*(const float scalar) const;
-    friend Vec2 operator*(float scalar, const Vec2& vector);
+    constexpr Vec2& operator-=(const Vec2& other_vector)
+    {
+        x -= other_vector.x;
+        y -= other_vector.y;
+        return *this;
+    }
 
-    Vec2 operator/(const float scalar) const;
+    constexpr Vec2 operator*(const float scalar) const
+    {
+        return Vec2(x * scalar, y * scalar);
+    }
 
-    float dot(const Vec2& other_vector) const;
+    friend constexpr Vec2 operator*(float scalar, const Vec2& vector)
+    {
+        return Vec2(vector.x * scalar, vector.y * scalar);
+    }
+
+    constexpr Vec2 operator/(const float scalar) const
+    {
+        return Vec2(x / scalar, y / scalar);
+    }
+
+    constexpr float dot(const Vec2& other_vector) const
+    {
+        return ((x * other_vector.x) + (y * other_vector.y));
+    }
 
     float magnitude() const;
 
@@ -33,4 +65,4 @@ struct Vec2
 };
     
 
-#endif
\ No newline at end of file
+#endif
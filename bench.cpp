@@ -0,0 +1,458 @@
+// microbenchmarks for the quadtree and solver hot paths
+//
+//   particlesim_bench [--out results.json] [--baseline baseline.json] [--threshold 0.10]
+//                     [--max-count N] [--filter text] [--threads N] [--min-time seconds]
+//
+// every case is repeated until --min-time has passed (at least 3 times) and the median is reported.
+// with --baseline, any case slower than baseline * (1 + threshold) is listed and the exit code is 2
+
+#include "loose_quadtree.hpp"
+#include "nbody.hpp"
+#include "quadtree.hpp"
+#include "scenario.hpp"
+#include "simd_kernels.hpp"
+#include "solver.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // every distribution fills the same box as the window app's default world
+    constexpr float world_size = 800.0f;
+
+    enum class Distribution
+    {
+        Uniform,
+        Pile, // settled rows packed against the bottom border
+        Jets, // dense streams fanning out from one point, like the emitter
+        Mixed // uniform dust with a boulder 40 times its radius every 100 particles
+    };
+
+    const char* distributionName(Distribution distribution)
+    {
+        switch (distribution)
+        {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Pile:    return "pile";
+        case Distribution::Jets:    return "jets";
+        case Distribution::Mixed:   return "mixed";
+        }
+        return "unknown";
+    }
+
+    struct Result
+    {
+        std::string name;
+        uint32_t count = 0;
+        uint32_t reps = 0;
+        double median_ms = 0.0;
+        double min_ms = 0.0;
+        uint64_t items = 0; // pairs or query hits, so a changed answer shows up next to a changed time
+    };
+
+    struct Options
+    {
+        std::string out_path;
+        std::string baseline_path;
+        std::string filter;
+        double threshold = 0.10;
+        double min_time = 0.25;
+        uint32_t max_count = 1000000;
+        unsigned threads = 0;
+    };
+
+    // radius shrinks with the count so every size fills about half of the 800x800 world
+    float radiusFor(uint32_t count)
+    {
+        return 0.5f * std::sqrt(0.5f * world_size * world_size / count);
+    }
+
+    float radiusOf(Distribution distribution, uint32_t i, float radius)
+    {
+        if (distribution != Distribution::Mixed) return radius;
+        return i % 100 == 0 ? 10.0f * radius : 0.25f * radius;
+    }
+
+    // same positions for the same (distribution, count) on every run and machine
+    std::vector<Vec2> makePositions(Distribution distribution, uint32_t count, float radius)
+    {
+        std::mt19937 rng(12345u + count);
+        std::vector<Vec2> positions;
+        positions.reserve(count);
+
+        const float lo = radius;
+        const float hi = world_size - radius;
+
+        switch (distribution)
+        {
+        case Distribution::Uniform:
+        case Distribution::Mixed:
+        {
+            std::uniform_real_distribution<float> coord(lo, hi);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const float x = coord(rng);
+                positions.push_back(Vec2(x, coord(rng)));
+            }
+            break;
+        }
+        case Distribution::Pile:
+        {
+            // slightly compressed hexagonal rows, as a pile looks after settling under gravity
+            const float spacing = 2.0f * radius * 0.98f;
+            const float row_height = spacing * 0.866f;
+            std::uniform_real_distribution<float> jitter(-0.05f * radius, 0.05f * radius);
+            uint32_t row = 0;
+            while (positions.size() < count)
+            {
+                const float y = world_size - radius - row * row_height;
+                for (float x = lo + (row % 2) * 0.5f * spacing; x <= hi && positions.size() < count; x += spacing)
+                {
+                    const float px = x + jitter(rng);
+                    positions.push_back(Vec2(px, y + jitter(rng)));
+                }
+                row++;
+            }
+            break;
+        }
+        case Distribution::Jets:
+        {
+            // a handful of streams from the emitter position, particles bunched along each one
+            constexpr int jet_count = 8;
+            const Vec2 origin(420.0f, 100.0f);
+            std::uniform_int_distribution<int> pick(0, jet_count - 1);
+            std::uniform_real_distribution<float> along(0.0f, 1.0f);
+            std::normal_distribution<float> spread(0.0f, 4.0f * radius);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const float angle = (pick(rng) - (jet_count - 1) * 0.5f) * 0.25f;
+                const Vec2 direction(std::sin(angle), std::cos(angle));
+                const Vec2 p = origin + direction * (along(rng) * 650.0f);
+                const float px = std::clamp(p.x + spread(rng), lo, hi);
+                positions.push_back(Vec2(px, std::clamp(p.y + spread(rng), lo, hi)));
+            }
+            break;
+        }
+        }
+        return positions;
+    }
+
+    void fillSolver(Solver& solver, Distribution distribution, const std::vector<Vec2>& positions, float radius)
+    {
+        for (uint32_t i = 0; i < positions.size(); i++)
+        {
+            solver.addObject(positions[i], radiusOf(distribution, i, radius));
+        }
+    }
+
+    // runs fn until min_time has passed, fn returns the item count of one run
+    Result measure(const std::string& name, uint32_t count, double min_time, const std::function<uint64_t()>& fn)
+    {
+        using clock = std::chrono::steady_clock;
+
+        Result result;
+        result.name = name;
+        result.count = count;
+        result.items = fn(); // warm up caches and grow every buffer to its steady state size
+
+        std::vector<double> times;
+        double elapsed = 0.0;
+        while (times.size() < 3 || (elapsed < min_time && times.size() < 1000))
+        {
+            const auto start = clock::now();
+            fn();
+            const double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            times.push_back(ms);
+            elapsed += ms / 1000.0;
+        }
+
+        std::sort(times.begin(), times.end());
+        result.reps = static_cast<uint32_t>(times.size());
+        result.median_ms = times[times.size() / 2];
+        result.min_ms = times.front();
+        return result;
+    }
+
+    void runCases(Distribution distribution, uint32_t count, const Options& options, std::vector<Result>& results)
+    {
+        const float radius = radiusFor(count);
+        const std::vector<Vec2> positions = makePositions(distribution, count, radius);
+        const std::string suffix = std::string("/") + distributionName(distribution) + "/" + std::to_string(count);
+
+        auto wanted = [&](const std::string& name) {
+            return options.filter.empty() || (name + suffix).find(options.filter) != std::string::npos;
+        };
+        auto run = [&](const std::string& name, const std::function<uint64_t()>& fn) {
+            if (!wanted(name)) return;
+            results.push_back(measure(name + suffix, count, options.min_time, fn));
+            const Result& r = results.back();
+            std::printf("%-44s %10.3f ms  (min %.3f, %u reps, %llu items)\n", r.name.c_str(), r.median_ms, r.min_ms,
+                        r.reps, static_cast<unsigned long long>(r.items));
+            std::fflush(stdout);
+        };
+
+        // the tree on its own, on a store that never moves
+        ParticleStore store;
+        store.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            store.add(positions[i], radiusOf(distribution, i, radius));
+        }
+
+        Quadtree tree;
+        std::vector<uint32_t> hits;
+        std::vector<std::pair<uint32_t, uint32_t>> pairs;
+
+        run("quadtree_build", [&] {
+            tree.build(store, world_size / 2, world_size / 2, world_size / 2, world_size / 2);
+            return static_cast<uint64_t>(tree.getNodes().size());
+        });
+
+        if (wanted("quadtree_build_sorted"))
+        {
+            // the same tree from sorted keys, on the pool
+            ThreadPool pool(options.threads);
+            run("quadtree_build_sorted", [&] {
+                tree.buildSorted(store, world_size / 2, world_size / 2, world_size / 2, world_size / 2, pool);
+                return static_cast<uint64_t>(tree.getNodes().size());
+            });
+        }
+
+        tree.build(store, world_size / 2, world_size / 2, world_size / 2, world_size / 2);
+        run("quadtree_query_range", [&] {
+            // a fixed sample of at most 10k particles so the big counts stay quick
+            const uint32_t stride = std::max(1u, count / 10000);
+            uint64_t total = 0;
+            for (uint32_t i = 0; i < count; i += stride)
+            {
+                hits.clear();
+                tree.queryRange(store, i, hits);
+                total += hits.size();
+            }
+            return total;
+        });
+
+        run("quadtree_pairs", [&] {
+            pairs.clear();
+            tree.getAllCollisionPairs(store, 4.0f, pairs);
+            return static_cast<uint64_t>(pairs.size());
+        });
+
+        // the same three on the loose tree, which keeps big particles out of the small cells
+        LooseQuadtree loose;
+        run("loose_quadtree_build", [&] {
+            loose.build(store);
+            return static_cast<uint64_t>(loose.getNodes().size());
+        });
+
+        loose.build(store);
+        run("loose_quadtree_query_range", [&] {
+            const uint32_t stride = std::max(1u, count / 10000);
+            uint64_t total = 0;
+            for (uint32_t i = 0; i < count; i += stride)
+            {
+                hits.clear();
+                loose.queryRange(store, i, hits);
+                total += hits.size();
+            }
+            return total;
+        });
+
+        run("loose_quadtree_pairs", [&] {
+            pairs.clear();
+            loose.getAllCollisionPairs(store, 4.0f, pairs);
+            return static_cast<uint64_t>(pairs.size());
+        });
+
+        if (wanted("barnes_hut"))
+        {
+            ThreadPool pool(options.threads);
+            BarnesHut barnes_hut;
+            NBodySettings nbody;
+            nbody.strength = 1.0f;
+            run("barnes_hut", [&] {
+                barnes_hut.compute(store, nbody, pool);
+                return static_cast<uint64_t>(barnes_hut.getTree().getNodes().size());
+            });
+        }
+
+        run("integrate", [&] {
+            IntegrateParams params;
+            params.dt = Solver::getFrameDt() / 8;
+            params.gravity_y = 9.81f * 50.0f;
+            params.max_x = world_size;
+            params.max_y = world_size;
+            integrateParticles(store, 0, count, params);
+            return static_cast<uint64_t>(count);
+        });
+
+        // the solver phases, with its own broadphase, neighbour list and thread pool
+        if (!wanted("solver_update_tree") && !wanted("solver_check_collisions")) return;
+
+        auto solver = std::make_unique<Solver>();
+        solver->setPerformanceReport(false);
+        solver->setThreadCount(options.threads);
+        fillSolver(*solver, distribution, positions, radius);
+
+        run("solver_update_tree", [&] {
+            solver->updateTree();
+            return static_cast<uint64_t>(count);
+        });
+
+        solver->updateTree();
+        run("solver_check_collisions", [&] {
+            solver->checkCollisions();
+            return static_cast<uint64_t>(count);
+        });
+    }
+
+    void writeJson(const std::string& path, const std::vector<Result>& results, const Options& options)
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            std::fprintf(stderr, "cannot write %s\n", path.c_str());
+            return;
+        }
+
+        // one case per line, which is also what readBaseline expects
+        file << "{\n";
+        file << "  \"simd\": \"" << simdLevelName(getSimdLevel()) << "\",\n";
+        file << "  \"threads\": " << options.threads << ",\n";
+        file << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            char line[256];
+            std::snprintf(line, sizeof(line),
+                          "    {\"name\": \"%s\", \"count\": %u, \"reps\": %u, \"median_ms\": %.6f, \"min_ms\": %.6f, \"items\": %llu}%s\n",
+                          r.name.c_str(), r.count, r.reps, r.median_ms, r.min_ms, static_cast<unsigned long long>(r.items),
+                          i + 1 < results.size() ? "," : "");
+            file << line;
+        }
+        file << "  ]\n}\n";
+    }
+
+    // reads back the name and median of every case written by writeJson
+    bool readBaseline(const std::string& path, std::map<std::string, double>& medians)
+    {
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            const auto name_key = line.find("\"name\": \"");
+            const auto median_key = line.find("\"median_ms\": ");
+            if (name_key == std::string::npos || median_key == std::string::npos) continue;
+
+            const auto name_begin = name_key + 9;
+            const auto name_end = line.find('"', name_begin);
+            medians[line.substr(name_begin, name_end - name_begin)] = std::atof(line.c_str() + median_key + 13);
+        }
+        return true;
+    }
+
+    // prints every case next to its baseline, returns the number of regressions
+    int compare(const std::vector<Result>& results, const std::map<std::string, double>& baseline, double threshold)
+    {
+        int regressions = 0;
+        std::printf("\n%-44s %12s %12s %9s\n", "case", "baseline ms", "current ms", "change");
+        for (const Result& r : results)
+        {
+            const auto it = baseline.find(r.name);
+            if (it == baseline.end() || it->second <= 0.0)
+            {
+                std::printf("%-44s %12s %12.3f %9s\n", r.name.c_str(), "-", r.median_ms, "new");
+                continue;
+            }
+
+            const double change = r.median_ms / it->second - 1.0;
+            const bool regressed = change > threshold;
+            regressions += regressed;
+            std::printf("%-44s %12.3f %12.3f %+8.1f%%%s\n", r.name.c_str(), it->second, r.median_ms, 100.0 * change,
+                        regressed ? "  REGRESSION" : "");
+        }
+        return regressions;
+    }
+
+    void printUsage()
+    {
+        std::printf("usage: particlesim_bench [--out results.json] [--baseline baseline.json] [--threshold 0.10]\n"
+                    "                         [--max-count N] [--filter text] [--threads N] [--min-time seconds]\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (std::strcmp(argv[i], "--out") == 0 && has_value)              options.out_path = argv[++i];
+        else if (std::strcmp(argv[i], "--baseline") == 0 && has_value)    options.baseline_path = argv[++i];
+        else if (std::strcmp(argv[i], "--threshold") == 0 && has_value)   ok = parseValue(argv[++i], options.threshold);
+        else if (std::strcmp(argv[i], "--max-count") == 0 && has_value)   ok = parseValue(argv[++i], options.max_count);
+        else if (std::strcmp(argv[i], "--filter") == 0 && has_value)      options.filter = argv[++i];
+        else if (std::strcmp(argv[i], "--threads") == 0 && has_value)     ok = parseValue(argv[++i], options.threads);
+        else if (std::strcmp(argv[i], "--min-time") == 0 && has_value)    ok = parseValue(argv[++i], options.min_time);
+        else
+        {
+            printUsage();
+            return 1;
+        }
+
+        if (!ok)
+        {
+            std::fprintf(stderr, "bad value '%s' for %s\n", argv[i], argv[i - 1]);
+            printUsage();
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baseline_path.empty() && !readBaseline(options.baseline_path, baseline))
+    {
+        std::fprintf(stderr, "cannot read baseline %s\n", options.baseline_path.c_str());
+        return 1;
+    }
+
+    std::printf("simd: %s\n", simdLevelName(getSimdLevel()));
+
+    std::vector<Result> results;
+    for (uint32_t count = 1000; count <= options.max_count; count *= 10)
+    {
+        for (Distribution distribution : {Distribution::Uniform, Distribution::Pile, Distribution::Jets, Distribution::Mixed})
+        {
+            runCases(distribution, count, options, results);
+        }
+    }
+
+    if (!options.out_path.empty())
+    {
+        writeJson(options.out_path, results, options);
+    }
+
+    if (!options.baseline_path.empty())
+    {
+        const int regressions = compare(results, baseline, options.threshold);
+        if (regressions > 0)
+        {
+            std::printf("\n%d case(s) regressed by more than %.0f%%\n", regressions, 100.0 * options.threshold);
+            return 2;
+        }
+    }
+
+    return 0;
+}
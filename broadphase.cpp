@@ -0,0 +1,113 @@
+#include "broadphase.hpp"
+#include "grid.hpp"
+#include "chunks.hpp"
+#include "loose_quadtree.hpp"
+#include <algorithm>
+#include <cmath>
+
+const char* broadphaseName(BroadphaseType type)
+{
+    switch (type)
+    {
+        case BroadphaseType::Quadtree: return "quadtree";
+        case BroadphaseType::Grid:     return "grid";
+        case BroadphaseType::HashGrid: return "hash grid";
+        case BroadphaseType::LooseQuadtree: return "loose quadtree";
+        case BroadphaseType::Chunked:  return "chunked";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<Broadphase> makeBroadphase(BroadphaseType type, ThreadPool* pool)
+{
+    std::unique_ptr<Broadphase> broadphase;
+    switch (type)
+    {
+        case BroadphaseType::Grid:     broadphase = std::make_unique<GridBroadphase>(); break;
+        case BroadphaseType::HashGrid: broadphase = std::make_unique<HashGridBroadphase>(); break;
+        case BroadphaseType::LooseQuadtree: broadphase = std::make_unique<LooseQuadtreeBroadphase>(); break;
+        case BroadphaseType::Chunked:  broadphase = std::make_unique<ChunkedBroadphase>(); break;
+        case BroadphaseType::Quadtree: broadphase = std::make_unique<QuadtreeBroadphase>(); break;
+    }
+    if (!broadphase) broadphase = std::make_unique<QuadtreeBroadphase>();
+
+    broadphase->setThreadPool(pool);
+    return broadphase;
+}
+
+void keepWithinRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles,
+                      std::size_t first)
+{
+    const float radius2 = radius * radius;
+    std::size_t kept = first;
+    for (std::size_t k = first; k < particles.size(); k++)
+    {
+        const uint32_t p = particles[k];
+        const float dx = store.x[p] - x;
+        const float dy = store.y[p] - y;
+        if (dx * dx + dy * dy < radius2) particles[kept++] = p;
+    }
+    particles.resize(kept);
+}
+
+namespace
+{
+    // smallest power of two square, aligned to half its size, that holds every particle. it only changes
+    // when the cloud leaves it or shrinks to half its size, so the tree can usually be updated in place.
+    // aligned to its full size, no square would hold a cloud around 0
+    void rootFor(const ParticleStore& store, float& x, float& y, float& half)
+    {
+        float min_x = store.x[0], max_x = store.x[0];
+        float min_y = store.y[0], max_y = store.y[0];
+        for (std::size_t i = 1; i < store.size(); i++)
+        {
+            min_x = std::min(min_x, store.x[i]);
+            max_x = std::max(max_x, store.x[i]);
+            min_y = std::min(min_y, store.y[i]);
+            max_y = std::max(max_y, store.y[i]);
+        }
+
+        float size = std::exp2(std::ceil(std::log2(std::max(std::max(max_x - min_x, max_y - min_y), 64.0f))));
+        for (;;)
+        {
+            half = size / 2;
+            const float origin_x = std::floor(min_x / half) * half;
+            const float origin_y = std::floor(min_y / half) * half;
+            if (max_x <= origin_x + size && max_y <= origin_y + size)
+            {
+                x = origin_x + half;
+                y = origin_y + half;
+                return;
+            }
+            size *= 2;
+        }
+    }
+}
+
+
+void QuadtreeBroadphase::build(const ParticleStore& store, float margin)
+{
+    m_margin = margin;
+    if (store.size() == 0)
+    {
+        m_tree.clear();
+        return;
+    }
+
+    float x, y, half;
+    rootFor(store, x, y, half);
+    if (m_incremental) m_tree.update(store, x, y, half, half);
+    else               m_tree.build(store, x, y, half, half);
+}
+
+void QuadtreeBroadphase::findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    m_tree.getAllCollisionPairs(store, m_margin, pairs);
+}
+
+void QuadtreeBroadphase::queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles)
+{
+    const std::size_t first = particles.size();
+    m_tree.queryRange(x, y, radius + 0.5f * m_margin, particles);
+    keepWithinRadius(store, x, y, radius, particles, first);
+}
@@ -0,0 +1,99 @@
+#ifndef BROADPHASE_HPP
+#define BROADPHASE_HPP
+
+#include "particle.hpp"
+#include "quadtree.hpp"
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+enum class BroadphaseType
+{
+    Quadtree,
+    Grid,     // dense uniform grid over the particle bounds
+    HashGrid,     // hashed uniform grid, for sparse or very large worlds
+    LooseQuadtree, // particles stored at the depth matching their size, for mixed radii
+    Chunked        // sparse fixed size chunks with their own quadtree, quiet chunks go to sleep
+};
+
+const char* broadphaseName(BroadphaseType type);
+
+
+// common interface for everything that turns particle positions into candidate collision pairs
+class Broadphase
+{
+public:
+    virtual ~Broadphase() = default;
+
+    virtual BroadphaseType type() const = 0;
+
+    // margin is extra reach added on top of r1 + r2 for the pairs found afterwards
+    virtual void build(const ParticleStore& store, float margin) = 0;
+
+    // appends every pair closer than r1 + r2 + margin exactly once, with first < second
+    virtual void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) = 0;
+
+    // appends every particle whose centre is within radius of (x, y), sleeping ones included. the structure is from
+    // the last build, so this is only exact while no particle has moved more than margin / 2 since, which is what
+    // the neighbour list keeps up between its rebuilds
+    virtual void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) = 0;
+
+    // forget anything carried over between builds, needed when the store's slots were reordered
+    virtual void reset() {}
+
+    // threads a broadphase may build on, nullptr for none. the pool has to outlive the broadphase
+    virtual void setThreadPool(ThreadPool* pool) { (void)pool; }
+
+    // called once per frame. a broadphase that groups particles into regions may put the particles of a region
+    // without motion to sleep (and wake them again) through store.asleep, it then leaves out pairs of two sleepers.
+    // returns true if any flag changed
+    virtual bool updateSleep(ParticleStore& store) { (void)store; return false; }
+
+    // true if updateSleep does the above, the solver tracks sleeping particles itself otherwise
+    virtual bool tracksSleep() const { return false; }
+
+    // the sleeping particle in slot p was woken up from outside, wake whatever it sleeps along with
+    virtual void wake(ParticleStore& store, uint32_t p) { (void)store; (void)p; }
+};
+
+
+class QuadtreeBroadphase : public Broadphase
+{
+private:
+    Quadtree m_tree;
+    float m_margin = 0.0f;
+
+    // keep the tree between builds and only move the particles that changed leaf
+    bool m_incremental = true;
+
+public:
+    const Quadtree& getTree() const { return m_tree; }
+
+    void setIncremental(bool incremental) { m_incremental = incremental; }
+
+    BroadphaseType type() const override { return BroadphaseType::Quadtree; }
+
+    void build(const ParticleStore& store, float margin) override;
+
+    void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) override;
+
+    void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) override;
+
+    void reset() override { m_tree.clear(); }
+
+    // full rebuilds of the tree go through Quadtree::buildSorted on the pool
+    void setThreadPool(ThreadPool* pool) override { m_tree.setThreadPool(pool); }
+};
+
+
+// with the pool passed on through setThreadPool
+std::unique_ptr<Broadphase> makeBroadphase(BroadphaseType type, ThreadPool* pool = nullptr);
+
+// drops the candidates from first on whose centre is radius or further from (x, y), for the queryRadius overrides
+void keepWithinRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles,
+                      std::size_t first);
+
+#endif
@@ -0,0 +1,330 @@
+#include "checkpoint.hpp"
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // x, y, last_x, last_y, ax, ay, radius, color, id, expires
+    constexpr uint32_t array_count = 10;
+    constexpr uint64_t array_alignment = 64;
+
+    static_assert(sizeof(Color) == 4, "colors are stored as 4 bytes");
+
+    struct CheckpointHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+
+        uint64_t particle_count;
+        uint64_t frame_count;
+        int32_t substeps;
+        uint32_t broadphase;
+
+        float boundary_x;
+        float boundary_y;
+        float boundary_radius;
+
+        float emitter_x;
+        float emitter_y;
+        float emitter_radius;
+        float spawn_velocity;
+        float max_angle;
+        float spawn_delay;
+        float emitter_time;
+        float since_spawn;
+        uint32_t max_objects;
+        uint32_t rows;
+        float emitter_lifetime;
+        uint32_t emitter_spawned;
+
+        float world_min_x;
+        float world_min_y;
+        float world_max_x;
+        float world_max_y;
+        uint32_t world_border;
+
+        uint64_t array_offset[array_count]; // from the start of the file
+    };
+
+    static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "the header is written as raw bytes");
+
+    constexpr char checkpoint_magic[8] = {'P', 'S', 'I', 'M', 'C', 'K', 'P', 'T'};
+
+    uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + array_alignment - 1) / array_alignment * array_alignment;
+    }
+
+    // read only view of a whole file, unmapped again on destruction
+    class MappedFile
+    {
+    private:
+        const unsigned char* m_data = nullptr;
+        uint64_t m_size = 0;
+#ifdef _WIN32
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+        HANDLE m_mapping = nullptr;
+#endif
+
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if (m_data) UnmapViewOfFile(m_data);
+            if (m_mapping) CloseHandle(m_mapping);
+            if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+            if (m_data) munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+        }
+
+        bool open(const std::string& path)
+        {
+#ifdef _WIN32
+            m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE) return false;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return false;
+            m_size = static_cast<uint64_t>(size.QuadPart);
+
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!m_mapping) return false;
+
+            m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            return m_data != nullptr;
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0)
+            {
+                close(fd);
+                return false;
+            }
+            m_size = static_cast<uint64_t>(info.st_size);
+
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd); // the mapping keeps the file alive
+            if (data == MAP_FAILED) return false;
+
+            m_data = static_cast<const unsigned char*>(data);
+            // every page is about to be read, start the readahead now
+            madvise(data, m_size, MADV_WILLNEED);
+            return true;
+#endif
+        }
+
+        const unsigned char* data() const { return m_data; }
+
+        uint64_t size() const { return m_size; }
+    };
+
+    template <typename T>
+    void adopt(const unsigned char* source, uint64_t count, std::vector<T>& destination)
+    {
+        destination.resize(count);
+        std::memcpy(destination.data(), source, count * sizeof(T));
+    }
+}
+
+bool saveCheckpoint(const std::string& path, const Solver& solver, const Emitter& emitter, std::string& error)
+{
+    const ParticleStore& store = solver.getObjects();
+    const uint64_t count = store.size();
+
+    // the ids of removed particles aren't saved, the loaded ones are dense again
+    std::vector<uint32_t> ids;
+    store.packedIds(ids);
+
+    // the header keeps the fixed substep count, the one loading starts from. adaptive substeps may be running another
+    // one, and the velocities in last_x and last_y go with it, so they're saved as the fixed count would have them
+    const float velocity_scale = static_cast<float>(solver.getSubsteps()) /
+                                 static_cast<float>(solver.getFixedSubsteps());
+    std::vector<float> last_x = store.last_x;
+    std::vector<float> last_y = store.last_y;
+    if (velocity_scale != 1.0f)
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            last_x[i] = store.x[i] - (store.x[i] - store.last_x[i]) * velocity_scale;
+            last_y[i] = store.y[i] - (store.y[i] - store.last_y[i]) * velocity_scale;
+        }
+    }
+
+    const void* arrays[array_count] = {store.x.data(), store.y.data(), last_x.data(), last_y.data(),
+                                       store.ax.data(), store.ay.data(), store.radius.data(), store.color.data(),
+                                       ids.data(), store.expires.data()};
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.header_size = sizeof(CheckpointHeader);
+    header.particle_count = count;
+    header.frame_count = solver.getFrameCount();
+    header.substeps = solver.getFixedSubsteps();
+    header.broadphase = static_cast<uint32_t>(solver.getBroadphaseType());
+
+    const std::array<float, 3> boundary = solver.getBoundary();
+    header.boundary_x = boundary[0];
+    header.boundary_y = boundary[1];
+    header.boundary_radius = boundary[2];
+
+    header.emitter_x = emitter.position.x;
+    header.emitter_y = emitter.position.y;
+    header.emitter_radius = emitter.radius;
+    header.spawn_velocity = emitter.spawn_velocity;
+    header.max_angle = emitter.max_angle;
+    header.spawn_delay = emitter.spawn_delay;
+    header.emitter_time = emitter.time;
+    header.since_spawn = emitter.since_spawn;
+    header.max_objects = emitter.max_objects;
+    header.rows = emitter.rows;
+    header.emitter_lifetime = emitter.lifetime;
+    header.emitter_spawned = emitter.spawned;
+
+    header.world_min_x = solver.getWorldMin().x;
+    header.world_min_y = solver.getWorldMin().y;
+    header.world_max_x = solver.getWorldMax().x;
+    header.world_max_y = solver.getWorldMax().y;
+    header.world_border = solver.hasWorldBorder() ? 1 : 0;
+
+    uint64_t offset = alignUp(sizeof(CheckpointHeader));
+    for (uint32_t k = 0; k < array_count; k++)
+    {
+        header.array_offset[k] = offset;
+        offset = alignUp(offset + count * 4);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+
+    const char padding[array_alignment] = {};
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t size) {
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        written += size;
+    };
+
+    write(&header, sizeof(header));
+    for (uint32_t k = 0; k < array_count; k++)
+    {
+        write(padding, header.array_offset[k] - written);
+        write(arrays[k], count * 4);
+    }
+    write(padding, offset - written);
+
+    if (!file)
+    {
+        error = "error while writing " + path;
+        return false;
+    }
+    return true;
+}
+
+bool loadCheckpoint(const std::string& path, Solver& solver, Emitter& emitter, std::string& error)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+
+    CheckpointHeader header{};
+    if (file.size() < sizeof(CheckpointHeader))
+    {
+        error = path + " is too small to be a checkpoint";
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(CheckpointHeader));
+
+    if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0)
+    {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+
+    if (header.version != checkpoint_version || header.header_size != sizeof(CheckpointHeader))
+    {
+        error = path + ": unsupported checkpoint version " + std::to_string(header.version);
+        return false;
+    }
+
+    if (header.broadphase > static_cast<uint32_t>(BroadphaseType::Chunked))
+    {
+        error = path + ": unknown broadphase";
+        return false;
+    }
+
+    const uint64_t count = header.particle_count;
+    for (uint32_t k = 0; k < array_count; k++)
+    {
+        const uint64_t offset = header.array_offset[k];
+        if (offset % array_alignment != 0 || offset > file.size() || count > (file.size() - offset) / 4)
+        {
+            error = path + " is truncated or corrupt";
+            return false;
+        }
+    }
+
+    const unsigned char* data = file.data();
+    ParticleStore store;
+    adopt(data + header.array_offset[0], count, store.x);
+    adopt(data + header.array_offset[1], count, store.y);
+    adopt(data + header.array_offset[2], count, store.last_x);
+    adopt(data + header.array_offset[3], count, store.last_y);
+    adopt(data + header.array_offset[4], count, store.ax);
+    adopt(data + header.array_offset[5], count, store.ay);
+    adopt(data + header.array_offset[6], count, store.radius);
+    adopt(data + header.array_offset[7], count, store.color);
+    adopt(data + header.array_offset[8], count, store.id);
+    adopt(data + header.array_offset[9], count, store.expires);
+    if (!store.rebuildSlots())
+    {
+        error = path + ": particle ids are corrupt";
+        return false;
+    }
+
+    solver.setObjects(std::move(store));
+    solver.setFrameCount(header.frame_count);
+    solver.setSubsteps(header.substeps);
+    solver.setBroadphase(static_cast<BroadphaseType>(header.broadphase));
+    solver.setBoundary(Vec2{header.boundary_x, header.boundary_y}, header.boundary_radius);
+    solver.setWorldBounds(Vec2{header.world_min_x, header.world_min_y}, Vec2{header.world_max_x, header.world_max_y});
+    solver.setWorldBorder(header.world_border != 0);
+
+    emitter.position = Vec2{header.emitter_x, header.emitter_y};
+    emitter.radius = header.emitter_radius;
+    emitter.spawn_velocity = header.spawn_velocity;
+    emitter.max_angle = header.max_angle;
+    emitter.spawn_delay = header.spawn_delay;
+    emitter.time = header.emitter_time;
+    emitter.since_spawn = header.since_spawn;
+    emitter.max_objects = header.max_objects;
+    emitter.rows = header.rows;
+    emitter.lifetime = header.emitter_lifetime;
+    emitter.spawned = header.emitter_spawned;
+    return true;
+}
@@ -0,0 +1,20 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "emitter.hpp"
+#include <string>
+
+// binary snapshot of a running simulation: particle arrays with their ids and lifetimes, boundary, world bounds,
+// substeps, broadphase, frame counter and the emitter, so a settled scene can be reloaded instead of re-simulated.
+//
+// layout (little endian): a fixed CheckpointHeader, then every particle array at a 64 byte aligned
+// offset listed in the header. loading maps the file and copies each array in one go, nothing is parsed per particle
+constexpr uint32_t checkpoint_version = 1;
+
+bool saveCheckpoint(const std::string& path, const Solver& solver, const Emitter& emitter, std::string& error);
+
+// replaces the solver's particles and settings, and the emitter, with the snapshot.
+// on failure both are left untouched
+bool loadCheckpoint(const std::string& path, Solver& solver, Emitter& emitter, std::string& error);
+
+#endif
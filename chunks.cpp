@@ -0,0 +1,436 @@
+#include "chunks.hpp"
+#include <algorithm>
+
+namespace
+{
+    const int32_t neighbour_x[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    const int32_t neighbour_y[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+    // index into neighbour_x/y, the neighbour on the other side is 7 - k
+    int neighbourIndex(int32_t dx, int32_t dy)
+    {
+        const int k = (dy + 1) * 3 + dx + 1;
+        return k > 4 ? k - 1 : k;
+    }
+}
+
+
+uint64_t ChunkedBroadphase::keyOf(int32_t cx, int32_t cy)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+}
+
+uint32_t ChunkedBroadphase::find(int32_t cx, int32_t cy) const
+{
+    const auto it = m_lookup.find(keyOf(cx, cy));
+    return it == m_lookup.end() ? no_chunk : it->second;
+}
+
+uint32_t ChunkedBroadphase::findOrAdd(int32_t cx, int32_t cy)
+{
+    const auto inserted = m_lookup.emplace(keyOf(cx, cy), static_cast<uint32_t>(m_chunks.size()));
+    if (inserted.second)
+    {
+        Chunk chunk;
+        chunk.cx = cx;
+        chunk.cy = cy;
+        m_chunks.push_back(std::move(chunk));
+    }
+    return inserted.first->second;
+}
+
+uint32_t ChunkedBroadphase::chunkOf(const ParticleStore& store, uint32_t p) const
+{
+    const float x = store.x[p];
+    const float y = store.y[p];
+    const uint32_t c = m_chunk_of[p];
+    if (c != no_chunk)
+    {
+        const float left = m_chunks[c].cx * m_chunk_size;
+        const float top = m_chunks[c].cy * m_chunk_size;
+        if (x >= left - m_hysteresis && x < left + m_chunk_size + m_hysteresis &&
+            y >= top - m_hysteresis && y < top + m_chunk_size + m_hysteresis)
+        {
+            return c;
+        }
+    }
+    return find(coordinate(x), coordinate(y));
+}
+
+void ChunkedBroadphase::dropChunks()
+{
+    m_wake_all = m_wake_all || !m_chunks.empty();
+    m_chunks.clear();
+    m_lookup.clear();
+    m_chunk_of.clear();
+    m_frame_x.clear();
+    m_frame_y.clear();
+}
+
+void ChunkedBroadphase::reset()
+{
+    m_chunks.clear();
+    m_lookup.clear();
+    m_chunk_of.clear();
+    m_frame_x.clear();
+    m_frame_y.clear();
+}
+
+std::size_t ChunkedBroadphase::getSleepingChunkCount() const
+{
+    return std::count_if(m_chunks.begin(), m_chunks.end(), [](const Chunk& chunk) { return chunk.sleeping; });
+}
+
+void ChunkedBroadphase::build(const ParticleStore& store, float margin)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    m_margin = margin;
+
+    float max_radius = 0.0f;
+    for (float r : store.radius)
+    {
+        max_radius = std::max(max_radius, r);
+    }
+    m_reach = 2.0f * max_radius + margin;
+
+    // halos only look one chunk over, so a chunk can't be smaller than the reach. slots were reused if the store shrank
+    if (m_reach > m_chunk_size || count < m_chunk_of.size())
+    {
+        dropChunks();
+        m_chunk_size = std::max(m_chunk_size, std::exp2(std::ceil(std::log2(m_reach))));
+    }
+    // a particle past the border still has to be within reach of it for the halos, and two particles of chunks that
+    // aren't neighbours must stay out of reach of each other
+    m_hysteresis = 0.5f * std::min(m_reach, m_chunk_size - m_reach);
+    const bool restore = m_chunk_of.empty() && !m_wake_all;
+    m_chunk_of.resize(count, no_chunk);
+
+    auto asleep = [&](uint32_t p) { return m_chunk_of[p] != no_chunk && m_chunks[m_chunk_of[p]].sleeping; };
+
+    // wake every sleeping chunk an awake particle moved into first, their particles are binned again below
+    for (uint32_t p = 0; p < count; p++)
+    {
+        if (asleep(p)) continue;
+
+        const uint32_t c = chunkOf(store, p);
+        if (c != no_chunk && m_chunks[c].sleeping)
+        {
+            m_chunks[c].sleeping = false;
+            m_chunks[c].quiet_frames = 0;
+        }
+    }
+
+    for (Chunk& chunk : m_chunks)
+    {
+        if (!chunk.sleeping) chunk.particles.clear();
+    }
+    for (uint32_t p = 0; p < count; p++)
+    {
+        if (asleep(p)) continue;
+
+        uint32_t c = chunkOf(store, p);
+        if (c == no_chunk) c = findOrAdd(coordinate(store.x[p]), coordinate(store.y[p]));
+        m_chunks[c].particles.push_back(p);
+        m_chunk_of[p] = c;
+    }
+    removeEmptyChunks();
+
+    // after a reset the sleep flags are all that's left of the chunk states
+    if (restore)
+    {
+        for (Chunk& chunk : m_chunks)
+        {
+            const auto asleep_count = std::count_if(chunk.particles.begin(), chunk.particles.end(),
+                                                    [&](uint32_t p) { return store.asleep[p] != 0; });
+            chunk.sleeping = asleep_count == static_cast<std::ptrdiff_t>(chunk.particles.size());
+            chunk.flagged = asleep_count > 0; // a partly flagged chunk gets its flags cleared by updateSleep
+            chunk.quiet_frames = chunk.sleeping ? sleep_frames : 0;
+        }
+    }
+
+    // halos: every chunk hands the particles near its border to the awake chunks around it.
+    // sleeping chunks still do, from the edge list of their last build
+    for (Chunk& chunk : m_chunks)
+    {
+        if (!chunk.sleeping) chunk.halo.clear();
+    }
+    for (Chunk& chunk : m_chunks)
+    {
+        if (chunk.sleeping && chunk.edge_reach >= m_reach)
+        {
+            for (uint32_t p : chunk.edge)
+            {
+                shareWithNeighbours(store, p, chunk);
+            }
+            continue;
+        }
+
+        chunk.edge.clear();
+        chunk.edge_reach = m_reach;
+        for (uint32_t p : chunk.particles)
+        {
+            if (shareWithNeighbours(store, p, chunk))
+            {
+                chunk.edge.push_back(p);
+            }
+        }
+    }
+
+    // around the own particles and the halo, a power of two like the quadtree broadphase's root so the leaves end
+    // up the same size
+    const float half = std::exp2(std::ceil(std::log2(0.5f * m_chunk_size + m_reach + m_hysteresis)));
+    for (Chunk& chunk : m_chunks)
+    {
+        if (chunk.sleeping) continue;
+
+        m_members.assign(chunk.particles.begin(), chunk.particles.end());
+        m_members.insert(m_members.end(), chunk.halo.begin(), chunk.halo.end());
+        chunk.tree.build(store, m_members, (chunk.cx + 0.5f) * m_chunk_size, (chunk.cy + 0.5f) * m_chunk_size,
+                         half, half);
+    }
+}
+
+bool ChunkedBroadphase::shareWithNeighbours(const ParticleStore& store, uint32_t p, const Chunk& chunk)
+{
+    // a particle of a neighbour can hang over the border by m_hysteresis, so p has to be shared that much further
+    const float share = m_reach + m_hysteresis;
+    const float local_x = store.x[p] - chunk.cx * m_chunk_size;
+    const float local_y = store.y[p] - chunk.cy * m_chunk_size;
+    const bool near_left = local_x < share;
+    const bool near_right = local_x > m_chunk_size - share;
+    const bool near_top = local_y < share;
+    const bool near_bottom = local_y > m_chunk_size - share;
+    if (!near_left && !near_right && !near_top && !near_bottom) return false;
+
+    for (int k = 0; k < 8; k++)
+    {
+        const int32_t dx = neighbour_x[k];
+        const int32_t dy = neighbour_y[k];
+        if ((dx < 0 && !near_left) || (dx > 0 && !near_right) || (dy < 0 && !near_top) || (dy > 0 && !near_bottom))
+        {
+            continue;
+        }
+
+        const uint32_t n = find(chunk.cx + dx, chunk.cy + dy);
+        if (n != no_chunk && !m_chunks[n].sleeping)
+        {
+            m_chunks[n].halo.push_back(p);
+        }
+    }
+    return true;
+}
+
+void ChunkedBroadphase::removeEmptyChunks()
+{
+    for (uint32_t c = 0; c < m_chunks.size();)
+    {
+        if (!m_chunks[c].particles.empty())
+        {
+            c++;
+            continue;
+        }
+
+        // swap with the last chunk and point its particles to the new index
+        m_lookup.erase(keyOf(m_chunks[c].cx, m_chunks[c].cy));
+        const uint32_t last = static_cast<uint32_t>(m_chunks.size() - 1);
+        if (c != last)
+        {
+            m_chunks[c] = std::move(m_chunks[last]);
+            m_lookup[keyOf(m_chunks[c].cx, m_chunks[c].cy)] = c;
+            for (uint32_t p : m_chunks[c].particles)
+            {
+                m_chunk_of[p] = c;
+            }
+        }
+        m_chunks.pop_back();
+    }
+}
+
+void ChunkedBroadphase::findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    // the contacts of the awake chunks are found again, the sleeping ones keep what they had when they fell asleep
+    for (Chunk& chunk : m_chunks)
+    {
+        if (!chunk.sleeping) chunk.contacts = 0;
+    }
+
+    for (uint32_t c = 0; c < m_chunks.size(); c++)
+    {
+        Chunk& chunk = m_chunks[c];
+        if (chunk.sleeping) continue;
+
+        m_local_pairs.clear();
+        chunk.tree.getAllCollisionPairs(store, m_margin, m_local_pairs);
+
+        // a pair across a border shows up in both chunks, the one with the lower index keeps it.
+        // a sleeping chunk reports nothing, so the awake side always keeps those
+        for (const auto& pair : m_local_pairs)
+        {
+            const uint32_t chunk_a = m_chunk_of[pair.first];
+            const uint32_t chunk_b = m_chunk_of[pair.second];
+            if (chunk_a != c && chunk_b != c) continue; // two halo particles
+
+            const uint32_t other = chunk_a == c ? chunk_b : chunk_a;
+            if (other != c)
+            {
+                const int k = neighbourIndex(m_chunks[other].cx - chunk.cx, m_chunks[other].cy - chunk.cy);
+                chunk.contacts |= static_cast<uint8_t>(1u << k);
+                m_chunks[other].contacts |= static_cast<uint8_t>(1u << (7 - k));
+            }
+            if (other == c || other > c || m_chunks[other].sleeping)
+            {
+                pairs.push_back(pair);
+            }
+        }
+    }
+}
+
+void ChunkedBroadphase::queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles)
+{
+    // a particle hangs over its chunk's border by up to m_hysteresis, plus what it moved since the build
+    const float reach = radius + 0.5f * m_margin + m_hysteresis;
+    const int32_t x0 = coordinate(x - reach);
+    const int32_t x1 = coordinate(x + reach);
+    const int32_t y0 = coordinate(y - reach);
+    const int32_t y1 = coordinate(y + reach);
+
+    const std::size_t first = particles.size();
+    for (int32_t cy = y0; cy <= y1; cy++)
+    {
+        for (int32_t cx = x0; cx <= x1; cx++)
+        {
+            const uint32_t c = find(cx, cy);
+            if (c == no_chunk) continue;
+
+            particles.insert(particles.end(), m_chunks[c].particles.begin(), m_chunks[c].particles.end());
+        }
+    }
+    keepWithinRadius(store, x, y, radius, particles, first);
+}
+
+void ChunkedBroadphase::wake(ParticleStore& store, uint32_t p)
+{
+    if (p >= m_chunk_of.size() || m_chunk_of[p] == no_chunk) return;
+
+    // the rest of its island wakes up in updateSleep
+    Chunk& chunk = m_chunks[m_chunk_of[p]];
+    if (!chunk.sleeping) return;
+
+    chunk.sleeping = false;
+    chunk.quiet_frames = 0;
+    for (uint32_t q : chunk.particles)
+    {
+        store.asleep[q] = 0;
+    }
+    chunk.flagged = false;
+}
+
+bool ChunkedBroadphase::updateSleep(ParticleStore& store)
+{
+    bool changed = false;
+    if (m_wake_all)
+    {
+        std::fill(store.asleep.begin(), store.asleep.end(), 0);
+        m_wake_all = false;
+        changed = true;
+    }
+
+    // particles that are new (or new to us after a reset) start from where they are
+    if (m_frame_x.size() != store.size())
+    {
+        const std::size_t known = std::min(m_frame_x.size(), store.size());
+        m_frame_x.resize(store.size());
+        m_frame_y.resize(store.size());
+        std::copy(store.x.begin() + known, store.x.end(), m_frame_x.begin() + known);
+        std::copy(store.y.begin() + known, store.y.end(), m_frame_y.begin() + known);
+    }
+
+    for (Chunk& chunk : m_chunks)
+    {
+        if (chunk.sleeping) continue;
+
+        float motion = 0.0f;
+        float total = 0.0f;
+        for (uint32_t p : chunk.particles)
+        {
+            const float moved = std::max(std::abs(store.x[p] - m_frame_x[p]), std::abs(store.y[p] - m_frame_y[p]));
+            motion = std::max(motion, moved);
+            total += moved;
+            m_frame_x[p] = store.x[p];
+            m_frame_y[p] = store.y[p];
+        }
+        chunk.motion = motion;
+        chunk.mean_motion = chunk.particles.empty() ? 0.0f : total / chunk.particles.size();
+        const bool quiet = chunk.mean_motion < sleep_motion && chunk.motion < sleep_max_motion;
+        chunk.quiet_frames = quiet ? chunk.quiet_frames + 1 : 0;
+    }
+
+    // islands of chunks with pairs across their borders sleep and wake as a whole. a sleeping chunk doesn't push on
+    // the awake ones under it, so a pile that is half asleep loses the weight on its awake half, which springs back
+    // and wakes the rest again. chunks that are only next to each other sleep apart
+    const uint32_t chunk_count = static_cast<uint32_t>(m_chunks.size());
+    m_island_of.assign(chunk_count, no_chunk);
+    m_island_sleeps.clear();
+    for (uint32_t start = 0; start < chunk_count; start++)
+    {
+        if (m_island_of[start] != no_chunk) continue;
+
+        const uint32_t island = static_cast<uint32_t>(m_island_sleeps.size());
+        bool any_asleep = false;
+        bool any_awake = false;
+        bool settled = true;
+
+        m_island_of[start] = island;
+        m_stack.assign(1, start);
+        while (!m_stack.empty())
+        {
+            const Chunk& chunk = m_chunks[m_stack.back()];
+            m_stack.pop_back();
+            any_asleep = any_asleep || chunk.sleeping;
+            any_awake = any_awake || !chunk.sleeping;
+            settled = settled && (chunk.sleeping || chunk.quiet_frames >= sleep_frames);
+
+            for (int k = 0; k < 8; k++)
+            {
+                if (!(chunk.contacts & (1u << k))) continue;
+
+                // an awake chunk forgets its contacts when it looks for pairs again, the bit a sleeping neighbour
+                // kept towards it may be stale
+                const uint32_t n = find(chunk.cx + neighbour_x[k], chunk.cy + neighbour_y[k]);
+                if (n == no_chunk || m_island_of[n] != no_chunk || !(m_chunks[n].contacts & (1u << (7 - k)))) continue;
+
+                m_island_of[n] = island;
+                m_stack.push_back(n);
+            }
+        }
+
+        // an island with some of it awake wakes up: a chunk an awake particle moved into was woken by build, or an
+        // awake chunk found pairs with a sleeping one
+        m_island_sleeps.push_back(!any_awake || (!any_asleep && settled));
+    }
+
+    for (uint32_t c = 0; c < chunk_count; c++)
+    {
+        Chunk& chunk = m_chunks[c];
+        const bool sleeping = m_island_sleeps[m_island_of[c]] != 0;
+        if (chunk.sleeping && !sleeping)
+        {
+            chunk.quiet_frames = 0;
+            chunk.motion = 0.0f;
+            chunk.mean_motion = 0.0f;
+        }
+        chunk.sleeping = sleeping;
+
+        // particles that joined since the last build aren't in the list yet, they stay awake until the next one
+        if (chunk.sleeping != chunk.flagged)
+        {
+            for (uint32_t p : chunk.particles)
+            {
+                store.asleep[p] = chunk.sleeping ? 1 : 0;
+            }
+            chunk.flagged = chunk.sleeping;
+            changed = true;
+        }
+    }
+    return changed;
+}
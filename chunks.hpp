@@ -0,0 +1,108 @@
+#ifndef CHUNKS_HPP
+#define CHUNKS_HPP
+
+#include "broadphase.hpp"
+#include "sleep.hpp"
+#include <cmath>
+#include <unordered_map>
+
+// side of a chunk, grown to the largest interaction distance if the particles are bigger than that
+constexpr float default_chunk_size = 256.0f;
+
+
+// sparse world of fixed size square chunks. only chunks with particles in them exist, looked up by their
+// coordinates in a hash map, so the world has no bounds and empty space costs nothing. every chunk owns a quadtree
+// over its particles plus a halo: the particles of the chunks around it that are within reach of its border.
+//
+// quiet islands of chunks are put to sleep: their particles are flagged asleep so the solver stops integrating
+// them, their trees are kept as they are and pairs between two sleepers are left out. an island is made of the chunks
+// that have pairs across their borders, so piles that don't touch sleep apart. it wakes up when a particle moves into
+// it or comes within reach of one of its particles
+class ChunkedBroadphase : public Broadphase
+{
+private:
+    struct Chunk
+    {
+        int32_t cx = 0;
+        int32_t cy = 0;
+        std::vector<uint32_t> particles; // the ones whose centre is inside
+        std::vector<uint32_t> edge;      // the ones within reach of the border, they are the halo of the neighbours
+        float edge_reach = 0.0f;         // reach the edge list was made with
+        std::vector<uint32_t> halo;
+        Quadtree tree;                   // particles + halo
+
+        float motion = 0.0f;      // largest displacement of one of the particles during the last frame
+        float mean_motion = 0.0f;
+        uint32_t quiet_frames = 0;
+        uint8_t contacts = 0;     // bit k: a pair with the neighbour at neighbour_x/y[k], kept while asleep
+        bool sleeping = false;
+        bool flagged = false; // what the particles' asleep flags currently say
+    };
+
+    static constexpr uint32_t no_chunk = UINT32_MAX;
+
+    float m_chunk_size = default_chunk_size;
+    float m_margin = 0.0f;
+    float m_reach = 0.0f; // largest r1 + r2 + margin
+    float m_hysteresis = 0.0f;
+
+    std::vector<Chunk> m_chunks;
+    std::unordered_map<uint64_t, uint32_t> m_lookup; // chunk coordinates -> index into m_chunks
+    std::vector<uint32_t> m_chunk_of;                // chunk of every particle at the last build
+    std::vector<float> m_frame_x;                    // positions at the previous updateSleep
+    std::vector<float> m_frame_y;
+    std::vector<uint32_t> m_island_of; // island of every chunk, for updateSleep
+    std::vector<uint8_t> m_island_sleeps;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_members;
+    std::vector<std::pair<uint32_t, uint32_t>> m_local_pairs;
+
+    bool m_wake_all = false; // chunks were dropped while some particles may still be flagged asleep
+
+    int32_t coordinate(float position) const { return static_cast<int32_t>(std::floor(position / m_chunk_size)); }
+
+    static uint64_t keyOf(int32_t cx, int32_t cy);
+
+    uint32_t find(int32_t cx, int32_t cy) const;
+
+    // the chunk p belongs to now, or no_chunk if that one doesn't exist yet. a particle keeps its chunk until it is
+    // m_hysteresis past the border, so one sitting on it doesn't flip between two chunks and wake the sleeping one
+    uint32_t chunkOf(const ParticleStore& store, uint32_t p) const;
+
+    // creates the chunk if it doesn't exist yet
+    uint32_t findOrAdd(int32_t cx, int32_t cy);
+
+    // adds p to the halo of every awake chunk next to c it is close enough to, false if it's far from every border
+    bool shareWithNeighbours(const ParticleStore& store, uint32_t p, const Chunk& chunk);
+
+    void removeEmptyChunks();
+
+    void dropChunks();
+
+public:
+    BroadphaseType type() const override { return BroadphaseType::Chunked; }
+
+    void build(const ParticleStore& store, float margin) override;
+
+    void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) override;
+
+    // looks through the particles of every chunk in range, sleeping ones included
+    void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) override;
+
+    // the chunks are made again on the next build, the ones whose particles are all still flagged asleep keep sleeping
+    void reset() override;
+
+    bool updateSleep(ParticleStore& store) override;
+
+    bool tracksSleep() const override { return true; }
+
+    void wake(ParticleStore& store, uint32_t p) override;
+
+    float getChunkSize() const { return m_chunk_size; }
+
+    std::size_t getChunkCount() const { return m_chunks.size(); }
+
+    std::size_t getSleepingChunkCount() const;
+};
+
+#endif
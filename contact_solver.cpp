@@ -0,0 +1,92 @@
+#include "contact_solver.hpp"
+#include "profiler.hpp"
+
+void ContactSolver::colour(std::size_t particle_count, const std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    PROFILE_SCOPE("ContactSolver::colour");
+    m_used.assign(particle_count, 0);
+    m_pair_colour.resize(pairs.size());
+
+    // greedy edge colouring: lowest colour neither particle uses yet
+    std::vector<uint32_t>& counts = m_batch_start;
+    counts.assign(max_colours + 2, 0);
+
+    for (std::size_t k = 0; k < pairs.size(); k++)
+    {
+        const uint32_t a = pairs[k].first;
+        const uint32_t b = pairs[k].second;
+        const uint64_t free = ~(m_used[a] | m_used[b]);
+
+        uint32_t c = max_colours; // overflow
+        if (free != 0)
+        {
+            c = 0;
+            while (!(free & (uint64_t{1} << c))) c++;
+            m_used[a] |= uint64_t{1} << c;
+            m_used[b] |= uint64_t{1} << c;
+        }
+        m_pair_colour[k] = static_cast<uint8_t>(c);
+        counts[c + 1]++;
+    }
+
+    // drop the unused colours at the end, but keep the overflow batch last
+    uint32_t colours = 0;
+    for (uint32_t c = 0; c < max_colours; c++)
+    {
+        if (counts[c + 1] != 0) colours = c + 1;
+    }
+    const uint32_t overflow = counts[max_colours + 1];
+
+    for (uint32_t c = 0; c <= max_colours; c++)
+    {
+        counts[c + 1] += counts[c];
+    }
+
+    m_pairs.resize(pairs.size());
+    m_cursor.assign(counts.begin(), counts.end() - 1);
+    for (std::size_t k = 0; k < pairs.size(); k++)
+    {
+        m_pairs[m_cursor[m_pair_colour[k]]++] = pairs[k];
+    }
+
+    // the empty colours sit between the last real colour and the overflow pairs,
+    // so the overflow batch directly follows colour (colours - 1)
+    const uint32_t end = counts[colours];
+    m_batch_start.resize(colours + 2);
+    m_batch_start[colours + 1] = end + overflow;
+}
+
+void ContactSolver::solve(ParticleStore& store, ThreadPool& pool) const
+{
+    float* x = store.x.data();
+    float* y = store.y.data();
+    const float* radius = store.radius.data();
+    const uint8_t* asleep = store.asleep.data();
+
+    const std::size_t batches = getBatchCount();
+    for (std::size_t c = 0; c < batches; c++)
+    {
+        const uint32_t begin = m_batch_start[c];
+        const uint32_t count = m_batch_start[c + 1] - begin;
+        const std::pair<uint32_t, uint32_t>* batch = m_pairs.data() + begin;
+
+        // the overflow batch can repeat particles, keep it on one thread
+        if (c + 1 == batches)
+        {
+            PROFILE_SCOPE("contact overflow batch");
+            for (uint32_t k = 0; k < count; k++)
+            {
+                solveContact(x, y, radius, asleep, batch[k].first, batch[k].second);
+            }
+            continue;
+        }
+
+        pool.parallelFor(count, 1024, [&](uint32_t chunk_begin, uint32_t chunk_end)
+        {
+            for (uint32_t k = chunk_begin; k < chunk_end; k++)
+            {
+                solveContact(x, y, radius, asleep, batch[k].first, batch[k].second);
+            }
+        });
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CONTACT_SOLVER_HPP
+#define CONTACT_SOLVER_HPP
+
+#include "particle.hpp"
+#include "thread_pool.hpp"
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// pushes overlapping particles apart, shared by the serial and the parallel path.
+// a sleeping particle doesn't move, nothing would integrate it back into place
+inline void solveContact(float* x, float* y, const float* radius, const uint8_t* asleep, uint32_t p_1, uint32_t p_2)
+{
+    const float vx = x[p_1] - x[p_2];
+    const float vy = y[p_1] - y[p_2];
+    const float dist2 = vx * vx + vy * vy;
+    const float min_distance = radius[p_1] + radius[p_2];
+
+    if (dist2 < min_distance * min_distance && dist2 > 0.0f)
+    {
+        const float distance = std::sqrt(dist2);
+        const float nx = vx / distance;
+        const float ny = vy / distance;
+        const float total_mass = radius[p_1] * radius[p_1] + radius[p_2] * radius[p_2];
+        const float mass_ratio = (radius[p_1] * radius[p_2]) / total_mass;
+        const float delta = 0.5f * (min_distance - distance);
+
+        float share_1 = 1 - mass_ratio;
+        float share_2 = mass_ratio;
+        if (asleep[p_1] | asleep[p_2])
+        {
+            share_1 = asleep[p_1] ? 0.0f : 1.0f;
+            share_2 = asleep[p_2] ? 0.0f : 1.0f;
+        }
+
+        x[p_1] += nx * share_1 * delta;
+        y[p_1] += ny * share_1 * delta;
+        x[p_2] -= nx * share_2 * delta;
+        y[p_2] -= ny * share_2 * delta;
+    }
+}
+
+
+// splits the contact pairs into colours (batches) in which no particle appears twice,
+// so every batch can be solved by several threads without two of them touching the same particle.
+// the colouring is greedy and only redone when the pairs change
+class ContactSolver
+{
+private:
+    static constexpr uint32_t max_colours = 64; // one bit per colour in m_used
+
+    std::vector<std::pair<uint32_t, uint32_t>> m_pairs; // grouped by colour
+    std::vector<uint32_t> m_batch_start;                // colour c is [start[c], start[c + 1]), the last batch is the serial overflow
+    std::vector<uint64_t> m_used;                       // colours already taken by each particle
+    std::vector<uint8_t> m_pair_colour;
+    std::vector<uint32_t> m_cursor;
+
+public:
+    void colour(std::size_t particle_count, const std::vector<std::pair<uint32_t, uint32_t>>& pairs);
+
+    void solve(ParticleStore& store, ThreadPool& pool) const;
+
+    std::size_t getBatchCount() const { return m_batch_start.empty() ? 0 : m_batch_start.size() - 1; }
+};
+
+#endif
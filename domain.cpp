@@ -0,0 +1,185 @@
+#include "domain.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+DomainSolver::DomainSolver(Solver& solver, Transport& transport) : m_solver{solver}, m_transport{transport}
+{
+    const int rank = transport.getRank();
+    const int rank_count = transport.getRankCount();
+    if (rank > 0) m_peers.push_back(rank - 1);
+    if (rank + 1 < rank_count) m_peers.push_back(rank + 1);
+    m_records.resize(m_peers.size());
+
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float world_min = solver.getWorldMin().x;
+    const float width = (solver.getWorldMax().x - world_min) / static_cast<float>(rank_count);
+    m_slab_min = rank == 0 ? -infinity : world_min + width * static_cast<float>(rank);
+    m_slab_max = rank + 1 == rank_count ? infinity : world_min + width * static_cast<float>(rank + 1);
+
+    solver.setSleeping(false);
+    AdaptiveSubsteps fixed = solver.getAdaptiveSubsteps();
+    fixed.enabled = false;
+    solver.setAdaptiveSubsteps(fixed);
+    solver.setSubstepHook([this](Solver&, int) { exchange(); });
+}
+
+DomainSolver::~DomainSolver()
+{
+    m_solver.setSubstepHook(nullptr);
+}
+
+bool DomainSolver::known(uint32_t slot) const
+{
+    const ParticleStore& store = m_solver.getObjects();
+    const uint32_t id = store.id[slot];
+    return id < m_generation.size() && m_generation[id] == store.generation[id];
+}
+
+bool DomainSolver::isGhost(uint32_t slot) const
+{
+    return known(slot) && m_ghost[m_solver.getObjects().id[slot]];
+}
+
+void DomainSolver::tag(uint32_t slot, bool ghost)
+{
+    const ParticleStore& store = m_solver.getObjects();
+    const uint32_t id = store.id[slot];
+    if (id >= m_generation.size())
+    {
+        m_ghost.resize(store.idCount(), 0);
+        m_generation.resize(store.idCount(), unknown_generation);
+    }
+    m_ghost[id] = ghost ? 1 : 0;
+    m_generation[id] = store.generation[id];
+}
+
+double DomainSolver::takeExchangeMs()
+{
+    const double ms = m_exchange_time * 1e-6;
+    m_exchange_time = 0;
+    return ms;
+}
+
+void DomainSolver::exchange()
+{
+    if (m_failed) return;
+
+    PROFILE_SCOPE("DomainSolver::exchange");
+    const uint64_t start = profiler::now();
+
+    const ParticleStore& store = m_solver.getObjects();
+    const int rank = getRank();
+    // where m_peers has the neighbour on each side, -1 at the ends of the row
+    const int left = rank > 0 ? 0 : -1;
+    const int right = rank + 1 < getRankCount() ? static_cast<int>(m_peers.size()) - 1 : -1;
+
+    // the ghosts of the last substep go, and whatever left the slab moves over
+    for (auto& records : m_records) records.clear();
+    m_remove.assign(store.size(), 0);
+    float max_radius = 0.0f;
+    for (uint32_t slot = 0; slot < store.size(); slot++)
+    {
+        const bool was_there = known(slot);
+        if (was_there && m_ghost[store.id[slot]])
+        {
+            m_remove[slot] = 1;
+            continue;
+        }
+        const float x = store.x[slot];
+        const bool owned = owns(x);
+        if (owned || was_there) max_radius = std::max(max_radius, store.radius[slot]);
+        if (owned) continue;
+
+        m_remove[slot] = 1;
+        // new particles outside the slab were made by their own rank as well
+        if (!was_there) continue;
+
+        const int side = x < m_slab_min ? left : right;
+        m_records[side].push_back({x, store.y[slot], store.last_x[slot], store.last_y[slot], store.radius[slot],
+                                   store.color[slot], store.expires[slot]});
+        m_migrated++;
+    }
+
+    std::vector<float> peer_radius;
+    if (!swap("migration", max_radius, peer_radius)) return;
+
+    m_solver.removeObjects(m_remove);
+    for (const auto& records : m_records) addRecords(records, false);
+
+    // every particle that could touch one of the neighbour's goes over. particles the neighbour takes in this
+    // substep from its other side are assumed to be no bigger than the ones it reported
+    for (auto& records : m_records) records.clear();
+    const float left_reach = left >= 0 ? std::max(max_radius, peer_radius[left]) + m_ghost_margin : 0.0f;
+    const float right_reach = right >= 0 ? std::max(max_radius, peer_radius[right]) + m_ghost_margin : 0.0f;
+    for (uint32_t slot = 0; slot < store.size(); slot++)
+    {
+        const float x = store.x[slot];
+        const float r = store.radius[slot];
+        const ParticleRecord record{x, store.y[slot], store.last_x[slot], store.last_y[slot], r, store.color[slot],
+                                    store.expires[slot]};
+        if (left >= 0 && x - r - left_reach < m_slab_min) m_records[left].push_back(record);
+        if (right >= 0 && x + r + right_reach >= m_slab_max) m_records[right].push_back(record);
+        tag(slot, false);
+    }
+
+    std::vector<float> unused;
+    m_owned = static_cast<uint32_t>(store.size());
+    if (!swap("ghost", 0.0f, unused)) return;
+
+    for (const auto& records : m_records) addRecords(records, true);
+
+    m_exchange_time += profiler::now() - start;
+}
+
+bool DomainSolver::swap(const char* what, float extra, std::vector<float>& peer_extra)
+{
+    const std::size_t count = m_peers.size();
+    m_out.resize(count);
+    for (std::size_t k = 0; k < count; k++)
+    {
+        const std::size_t record_bytes = m_records[k].size() * sizeof(ParticleRecord);
+        m_out[k].resize(sizeof(float) + record_bytes);
+        std::memcpy(m_out[k].data(), &extra, sizeof(float));
+        if (record_bytes > 0) std::memcpy(m_out[k].data() + sizeof(float), m_records[k].data(), record_bytes);
+    }
+
+    if (!exchangeMessages(m_transport, m_peers, m_out, m_in))
+    {
+        m_failed = true;
+        m_error = "rank " + std::to_string(getRank()) + ": the " + what + " exchange with its neighbours failed";
+        return false;
+    }
+
+    peer_extra.assign(count, 0.0f);
+    for (std::size_t k = 0; k < count; k++)
+    {
+        const std::vector<uint8_t>& in = m_in[k];
+        if (in.size() < sizeof(float) || (in.size() - sizeof(float)) % sizeof(ParticleRecord) != 0)
+        {
+            m_failed = true;
+            m_error = "rank " + std::to_string(getRank()) + ": malformed " + what + " message from rank " +
+                      std::to_string(m_peers[k]);
+            return false;
+        }
+        std::memcpy(&peer_extra[k], in.data(), sizeof(float));
+        m_records[k].resize((in.size() - sizeof(float)) / sizeof(ParticleRecord));
+        if (!m_records[k].empty()) std::memcpy(m_records[k].data(), in.data() + sizeof(float), in.size() - sizeof(float));
+    }
+    return true;
+}
+
+void DomainSolver::addRecords(const std::vector<ParticleRecord>& records, bool ghost)
+{
+    for (const ParticleRecord& record : records)
+    {
+        ParticleHandle particle = m_solver.addObject({record.x, record.y}, record.radius);
+        // a step of 1 carries last_x and last_y over as they were
+        particle.setVelocity({record.x - record.last_x, record.y - record.last_y}, 1.0f);
+        particle.setColor(record.color);
+        if (std::isfinite(record.expires)) m_solver.setObjectLifetime(particle, record.expires - m_solver.getTime());
+        tag(particle.index(), ghost);
+    }
+}
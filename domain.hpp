@@ -0,0 +1,116 @@
+#ifndef DOMAIN_HPP
+#define DOMAIN_HPP
+
+#include "solver.hpp"
+#include "transport.hpp"
+#include <string>
+
+// one rank of a run split over several processes. the world is cut into equal slabs along x, rank 0 on the left,
+// and each rank's solver only owns the particles whose centre lies in its slab. the outer slabs reach on to
+// infinity, so nothing is lost without a world border.
+//
+// at the start of every substep the ranks swap what their neighbours need, in two rounds:
+//   1. particles that left the slab move to the rank on that side
+//   2. the owned particles near a slab edge go over as ghosts, read-only copies the neighbour collides its own
+//      particles with. they are dropped and sent again in the next substep
+// removing and adding particles makes the solver rebuild its neighbour list every substep.
+//
+// particles added between updates, e.g. by an Emitter every rank runs the same way, are kept by the rank whose
+// slab they are in and dropped by the others. sleeping is turned off, the ghosts would never settle, and so are
+// adaptive substeps: every rank has to take the same number of them.
+// n-body forces only act between the particles of one rank
+class DomainSolver
+{
+private:
+    // what goes over the wire for one particle, the ranks all run the same build
+    struct ParticleRecord
+    {
+        float x;
+        float y;
+        float last_x;
+        float last_y;
+        float radius;
+        Color color;
+        float expires;
+    };
+
+    Solver& m_solver;
+    Transport& m_transport;
+    std::vector<int> m_peers; // rank - 1 and rank + 1 where there are
+
+    float m_slab_min;
+    float m_slab_max;
+
+    // ghosts reach this far past the distance a contact needs
+    float m_ghost_margin = 1.0f;
+
+    static constexpr uint32_t unknown_generation = UINT32_MAX;
+
+    // what each particle was at the last exchange, by id. a particle whose generation doesn't match m_generation
+    // was added since, or got the id of one that was removed
+    std::vector<uint8_t> m_ghost;
+    std::vector<uint32_t> m_generation;
+    uint32_t m_owned = 0;
+
+    bool m_failed = false;
+    std::string m_error;
+
+    uint64_t m_exchange_time = 0; // ns, since the last takeExchangeMs
+    uint64_t m_migrated = 0;      // particles sent to a neighbour over the whole run
+
+    // reused between substeps
+    std::vector<uint8_t> m_remove;
+    std::vector<std::vector<ParticleRecord>> m_records;
+    std::vector<std::vector<uint8_t>> m_out;
+    std::vector<std::vector<uint8_t>> m_in;
+
+    void exchange();
+
+    // sends m_records[k] to m_peers[k], with a float of extra data, and unpacks what came back into m_records.
+    // false once a link failed
+    bool swap(const char* what, float extra, std::vector<float>& peer_extra);
+
+    // true if the particle in that slot was there at the last exchange
+    bool known(uint32_t slot) const;
+
+    void tag(uint32_t slot, bool ghost);
+
+    void addRecords(const std::vector<ParticleRecord>& records, bool ghost);
+
+public:
+    // hooks itself into the solver's substeps, the solver has to outlive it
+    DomainSolver(Solver& solver, Transport& transport);
+    ~DomainSolver();
+
+    DomainSolver(const DomainSolver&) = delete;
+    DomainSolver& operator=(const DomainSolver&) = delete;
+
+    int getRank() const { return m_transport.getRank(); }
+
+    int getRankCount() const { return m_transport.getRankCount(); }
+
+    // -inf and +inf at the ends of the row
+    float getSlabMin() const { return m_slab_min; }
+
+    float getSlabMax() const { return m_slab_max; }
+
+    bool owns(float x) const { return x >= m_slab_min && x < m_slab_max; }
+
+    // as of the last exchange, ghosts not included
+    uint32_t getOwnedCount() const { return m_owned; }
+
+    bool isGhost(uint32_t slot) const;
+
+    uint64_t getMigratedCount() const { return m_migrated; }
+
+    // wall time spent exchanging since the last call
+    double takeExchangeMs();
+
+    // a link broke or a neighbour stopped answering. the solver then goes on with what it has, nothing is exchanged
+    // anymore and the run can't be trusted
+    bool failed() const { return m_failed; }
+
+    const std::string& getError() const { return m_error; }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "emitter.hpp"
+#include <cmath>
+
+Color rainbowColor(float t)
+{
+    constexpr float two_pi = 2.0f * 3.14159265f;
+    const float r = std::sin(t);
+    const float g = std::sin(t + 0.33f * two_pi);
+    const float b = std::sin(t + 0.66f * two_pi);
+    return {static_cast<uint8_t>(255.0f * r * r),
+            static_cast<uint8_t>(255.0f * g * g),
+            static_cast<uint8_t>(255.0f * b * b)};
+}
+
+void Emitter::update(Solver& solver, float dt)
+{
+    time += dt;
+    since_spawn += dt;
+
+    if (since_spawn < spawn_delay) return;
+    since_spawn = 0.0f;
+
+    const float angle = 3.14159265f * 0.5f + max_angle * std::sin(3.0f * time);
+    const Vec2 direction{std::cos(angle), std::sin(angle)};
+    const Vec2 side{-direction.y, direction.x};
+
+    for (uint32_t row = 0; row < rows && !finished(); row++)
+    {
+        // rows sit next to each other across the jet, centred on the emitter
+        const float offset = (static_cast<float>(row) - 0.5f * static_cast<float>(rows - 1)) * 2.2f * radius;
+
+        auto particle = solver.addObject(position + side * offset, radius);
+        particle.setColor(rainbowColor(time));
+        solver.setObjectVelocity(particle, spawn_velocity * direction);
+        if (lifetime > 0.0f) solver.setObjectLifetime(particle, lifetime);
+        spawned++;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef EMITTER_HPP
+#define EMITTER_HPP
+
+#include "solver.hpp"
+#include <cstdint>
+
+// the swinging particle jet from the original render loop, driven by simulated time
+// so the windowed app and headless runs spawn the same scene
+struct Emitter
+{
+    Vec2 position{420.0f, 100.0f};
+    float radius = 3.0f;
+    float spawn_velocity = 0.5f;
+    float max_angle = 120.0f * 3.14159265f / 180.0f; // swing either side of straight down
+    float spawn_delay = 0.01f;
+    uint32_t max_objects = 2000; // 0 keeps it going, for particles with a lifetime or sinks to remove them again
+    uint32_t rows = 1; // particles spawned side by side per volley
+    float lifetime = 0.0f; // seconds every particle lives, 0 for ever
+
+    float time = 0.0f;        // simulated seconds since the start
+    float since_spawn = 0.0f;
+
+    // particles made so far, max_objects caps these rather than the store. in a domain run every rank runs the
+    // same emitter but holds only some of the particles, and they all have to stop together
+    uint32_t spawned = 0;
+
+    // spawns at most one volley per call, like the render loop did once per frame
+    void update(Solver& solver, float dt);
+
+    bool finished() const { return max_objects > 0 && spawned >= max_objects; }
+};
+
+Color rainbowColor(float t);
+
+#endif
@@ -0,0 +1,38 @@
+#include "force_field.hpp"
+#include <algorithm>
+#include <cmath>
+
+const char* forceFieldName(ForceFieldType type)
+{
+    switch (type)
+    {
+        case ForceFieldType::Attractor: return "attractor";
+        case ForceFieldType::Repulsor:  return "repulsor";
+        case ForceFieldType::Vortex:    return "vortex";
+        case ForceFieldType::Wind:      return "wind";
+        case ForceFieldType::Sink:      return "sink";
+    }
+    return "unknown";
+}
+
+Vec2 forceFieldAcceleration(const ForceField& field, const Vec2& p)
+{
+    const Vec2 to_centre = field.position - p;
+    const float distance = std::sqrt(to_centre.x * to_centre.x + to_centre.y * to_centre.y);
+    const float falloff = field.strength * std::max(0.0f, field.radius - distance);
+
+    switch (field.type)
+    {
+        case ForceFieldType::Attractor: return to_centre * falloff;
+        case ForceFieldType::Repulsor:  return to_centre * -falloff;
+        case ForceFieldType::Vortex:    return Vec2(to_centre.y, -to_centre.x) * falloff; // y points down
+        case ForceFieldType::Wind:
+        {
+            const float length = std::sqrt(field.direction.x * field.direction.x + field.direction.y * field.direction.y);
+            if (length == 0.0f) return Vec2();
+            return field.direction * (field.strength / length);
+        }
+        case ForceFieldType::Sink:      return Vec2();
+    }
+    return Vec2();
+}
@@ -0,0 +1,34 @@
+#ifndef FORCE_FIELD_HPP
+#define FORCE_FIELD_HPP
+
+#include "Vec2.hpp"
+
+enum class ForceFieldType
+{
+    Attractor, // pulls towards the centre
+    Repulsor,  // pushes away from it
+    Vortex,    // swirls around it, clockwise on screen for a positive strength
+    Wind,      // the same push along direction everywhere inside
+    Sink       // removes the particles inside at the end of every frame, strength is unused
+};
+
+const char* forceFieldName(ForceFieldType type);
+
+
+// a force on every particle whose centre is within radius of position, nothing outside of it.
+// attractors, repulsors and vortices scale with the offset from the centre times (radius - distance), so they
+// vanish at both the centre and the rim. with the defaults an attractor is the old mouse pull and a repulsor the
+// push. wind accelerates by strength px/s^2 along direction
+struct ForceField
+{
+    ForceFieldType type = ForceFieldType::Attractor;
+    Vec2 position;
+    float radius = 120.0f;
+    float strength = 10.0f;
+    Vec2 direction = Vec2(1.0f, 0.0f); // wind only, normalized when applied
+};
+
+// acceleration of a particle at p, which has to be inside the field. none for a sink
+Vec2 forceFieldAcceleration(const ForceField& field, const Vec2& p);
+
+#endif
@@ -0,0 +1,308 @@
+#include "grid.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // largest interaction distance between two particles, used as the cell size
+    float cellSizeFor(const ParticleStore& store, float margin)
+    {
+        float max_radius = 0.0f;
+        for (float r : store.radius)
+        {
+            max_radius = std::max(max_radius, r);
+        }
+        return std::max(2.0f * max_radius + margin, 1.0f);
+    }
+
+    // floor of a position in cells. clamped before the cast, which is undefined past the int range in an unbounded
+    // world. 2^29 leaves room for the neighbour offsets and the width of a query range
+    inline int cellCoord(float cells)
+    {
+        constexpr float limit = 536870912.0f;
+        return static_cast<int>(std::floor(std::clamp(cells, -limit, limit)));
+    }
+
+    inline void testPair(const ParticleStore& store, float margin, uint32_t a, uint32_t b,
+                         std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+    {
+        const float dx = store.x[a] - store.x[b];
+        const float dy = store.y[a] - store.y[b];
+        const float max_dist = store.radius[a] + store.radius[b] + margin;
+        if (dx * dx + dy * dy < max_dist * max_dist)
+        {
+            if (a < b) pairs.push_back({a, b});
+            else       pairs.push_back({b, a});
+        }
+    }
+}
+
+
+void GridBroadphase::build(const ParticleStore& store, float margin)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    m_margin = margin;
+    m_cell_size = cellSizeFor(store, margin);
+
+    m_cols = 0;
+    m_rows = 0;
+    m_cell_start.assign(1, 0);
+    m_cell_particles.clear();
+    m_particle_cell.resize(count);
+    if (count == 0) return;
+
+    // bounds of the particle cloud, so nothing is ever dropped
+    float min_x = store.x[0], max_x = store.x[0];
+    float min_y = store.y[0], max_y = store.y[0];
+    for (uint32_t i = 1; i < count; i++)
+    {
+        min_x = std::min(min_x, store.x[i]);
+        max_x = std::max(max_x, store.x[i]);
+        min_y = std::min(min_y, store.y[i]);
+        max_y = std::max(max_y, store.y[i]);
+    }
+
+    // keep the cell count proportional to the particle count if the cloud is very spread out. a thin cloud has
+    // hardly any area, so each axis is bounded on its own as well
+    const float width = max_x - min_x;
+    const float height = max_y - min_y;
+    const float max_cells = 4.0f * count + 1024.0f;
+    if ((width / m_cell_size + 1.0f) * (height / m_cell_size + 1.0f) > max_cells)
+    {
+        m_cell_size = std::max({m_cell_size, std::sqrt(width * height / max_cells) + 1.0f,
+                                std::max(width, height) / max_cells + 1.0f});
+    }
+
+    m_min_x = min_x;
+    m_min_y = min_y;
+    m_cols = static_cast<int>(width / m_cell_size) + 1;
+    m_rows = static_cast<int>(height / m_cell_size) + 1;
+
+    const std::size_t cells = static_cast<std::size_t>(m_cols) * m_rows;
+    m_cell_start.assign(cells + 1, 0);
+    m_cell_particles.resize(count);
+
+    // pass 1: count particles per cell
+    const float inv_cell = 1.0f / m_cell_size;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int cx = std::min(static_cast<int>((store.x[i] - min_x) * inv_cell), m_cols - 1);
+        int cy = std::min(static_cast<int>((store.y[i] - min_y) * inv_cell), m_rows - 1);
+        uint32_t cell = static_cast<uint32_t>(cy * m_cols + cx);
+        m_particle_cell[i] = cell;
+        m_cell_start[cell + 1]++;
+    }
+
+    for (std::size_t c = 0; c < cells; c++)
+    {
+        m_cell_start[c + 1] += m_cell_start[c];
+    }
+
+    // pass 2: scatter, m_cell_start[c] is used as the write cursor and restored afterwards
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_cell_particles[m_cell_start[m_particle_cell[i]]++] = i;
+    }
+    for (std::size_t c = cells; c > 0; c--)
+    {
+        m_cell_start[c] = m_cell_start[c - 1];
+    }
+    m_cell_start[0] = 0;
+}
+
+void GridBroadphase::findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    // only the forward half of the neighbourhood, so every cell pair is visited once
+    static constexpr int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    for (int cy = 0; cy < m_rows; cy++)
+    {
+        for (int cx = 0; cx < m_cols; cx++)
+        {
+            const uint32_t cell = static_cast<uint32_t>(cy * m_cols + cx);
+            const uint32_t begin = m_cell_start[cell];
+            const uint32_t end = m_cell_start[cell + 1];
+            if (begin == end) continue;
+
+            // inside the cell
+            for (uint32_t i = begin; i < end; i++)
+            {
+                for (uint32_t j = i + 1; j < end; j++)
+                {
+                    testPair(store, m_margin, m_cell_particles[i], m_cell_particles[j], pairs);
+                }
+            }
+
+            // against the forward neighbours
+            for (const auto& offset : offsets)
+            {
+                const int nx = cx + offset[0];
+                const int ny = cy + offset[1];
+                if (nx < 0 || nx >= m_cols || ny >= m_rows) continue;
+
+                const uint32_t other = static_cast<uint32_t>(ny * m_cols + nx);
+                const uint32_t other_begin = m_cell_start[other];
+                const uint32_t other_end = m_cell_start[other + 1];
+
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    for (uint32_t j = other_begin; j < other_end; j++)
+                    {
+                        testPair(store, m_margin, m_cell_particles[i], m_cell_particles[j], pairs);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void GridBroadphase::queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles)
+{
+    if (m_cols == 0) return;
+
+    // the cells the particles were binned into, so their positions at the last build plus what they moved since
+    const float reach = radius + 0.5f * m_margin;
+    const float inv_cell = 1.0f / m_cell_size;
+    auto cellOf = [&](float position, float min, int cells) {
+        return std::clamp(cellCoord((position - min) * inv_cell), 0, cells - 1);
+    };
+    const int x0 = cellOf(x - reach, m_min_x, m_cols);
+    const int x1 = cellOf(x + reach, m_min_x, m_cols);
+    const int y0 = cellOf(y - reach, m_min_y, m_rows);
+    const int y1 = cellOf(y + reach, m_min_y, m_rows);
+
+    const std::size_t first = particles.size();
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        // a row of cells is one range of the scattered indices
+        const uint32_t begin = m_cell_start[cy * m_cols + x0];
+        const uint32_t end = m_cell_start[cy * m_cols + x1 + 1];
+        particles.insert(particles.end(), m_cell_particles.begin() + begin, m_cell_particles.begin() + end);
+    }
+    keepWithinRadius(store, x, y, radius, particles, first);
+}
+
+
+uint32_t HashGridBroadphase::bucketOf(int cx, int cy) const
+{
+    // large primes from the classic spatial hashing paper by Teschner et al.
+    const uint32_t h = (static_cast<uint32_t>(cx) * 73856093u) ^ (static_cast<uint32_t>(cy) * 19349663u);
+    return h & m_table_mask;
+}
+
+void HashGridBroadphase::build(const ParticleStore& store, float margin)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    m_margin = margin;
+    m_cell_size = cellSizeFor(store, margin);
+
+    // power of two table, about twice as many buckets as particles
+    uint32_t table_size = 64;
+    while (table_size < 2 * count) table_size <<= 1;
+    m_table_mask = table_size - 1;
+
+    m_bucket_start.assign(table_size + 1, 0);
+    m_bucket_particles.resize(count);
+    m_particle_bucket.resize(count);
+
+    const float inv_cell = 1.0f / m_cell_size;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const int cx = cellCoord(store.x[i] * inv_cell);
+        const int cy = cellCoord(store.y[i] * inv_cell);
+        const uint32_t bucket = bucketOf(cx, cy);
+        m_particle_bucket[i] = bucket;
+        m_bucket_start[bucket + 1]++;
+    }
+
+    for (uint32_t b = 0; b < table_size; b++)
+    {
+        m_bucket_start[b + 1] += m_bucket_start[b];
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_bucket_particles[m_bucket_start[m_particle_bucket[i]]++] = i;
+    }
+    for (uint32_t b = table_size; b > 0; b--)
+    {
+        m_bucket_start[b] = m_bucket_start[b - 1];
+    }
+    m_bucket_start[0] = 0;
+}
+
+void HashGridBroadphase::findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    const float inv_cell = 1.0f / m_cell_size;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const int cx = cellCoord(store.x[i] * inv_cell);
+        const int cy = cellCoord(store.y[i] * inv_cell);
+
+        // two neighbour cells can hash to the same bucket, only walk each bucket once
+        uint32_t visited[9];
+        int visited_count = 0;
+
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                const uint32_t bucket = bucketOf(cx + dx, cy + dy);
+                if (std::find(visited, visited + visited_count, bucket) != visited + visited_count) continue;
+                visited[visited_count++] = bucket;
+
+                const uint32_t end = m_bucket_start[bucket + 1];
+                for (uint32_t k = m_bucket_start[bucket]; k < end; k++)
+                {
+                    const uint32_t j = m_bucket_particles[k];
+                    if (j <= i) continue; // each pair once
+
+                    testPair(store, m_margin, i, j, pairs);
+                }
+            }
+        }
+    }
+}
+
+void HashGridBroadphase::queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles)
+{
+    if (m_bucket_particles.empty()) return;
+
+    const float reach = radius + 0.5f * m_margin;
+    const float inv_cell = 1.0f / m_cell_size;
+    const int x0 = cellCoord((x - reach) * inv_cell);
+    const int x1 = cellCoord((x + reach) * inv_cell);
+    const int y0 = cellCoord((y - reach) * inv_cell);
+    const int y1 = cellCoord((y + reach) * inv_cell);
+
+    // cells can share a bucket, collect the buckets first so each is only walked once. past the table size every
+    // bucket is in range anyway
+    const std::size_t first = particles.size();
+    const uint64_t cells = static_cast<uint64_t>(x1 - x0 + 1) * static_cast<uint64_t>(y1 - y0 + 1);
+    if (cells > m_table_mask)
+    {
+        particles.insert(particles.end(), m_bucket_particles.begin(), m_bucket_particles.end());
+        keepWithinRadius(store, x, y, radius, particles, first);
+        return;
+    }
+
+    m_query_buckets.clear();
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            m_query_buckets.push_back(bucketOf(cx, cy));
+        }
+    }
+    std::sort(m_query_buckets.begin(), m_query_buckets.end());
+    m_query_buckets.erase(std::unique(m_query_buckets.begin(), m_query_buckets.end()), m_query_buckets.end());
+
+    for (uint32_t bucket : m_query_buckets)
+    {
+        particles.insert(particles.end(), m_bucket_particles.begin() + m_bucket_start[bucket],
+                         m_bucket_particles.begin() + m_bucket_start[bucket + 1]);
+    }
+    keepWithinRadius(store, x, y, radius, particles, first);
+}
@@ -0,0 +1,60 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include "broadphase.hpp"
+
+// uniform grid binned with a counting sort: one pass to count particles per cell,
+// one pass to scatter their indices, then pairs come from the 3x3 cell neighbourhood.
+// the cell size is the largest interaction distance, so it suits same sized particles
+class GridBroadphase : public Broadphase
+{
+private:
+    float m_margin = 0.0f;
+    float m_cell_size = 1.0f;
+    float m_min_x = 0.0f;
+    float m_min_y = 0.0f;
+    int m_cols = 0;
+    int m_rows = 0;
+
+    std::vector<uint32_t> m_cell_start; // size cells + 1, particles of cell c are [start[c], start[c + 1])
+    std::vector<uint32_t> m_cell_particles;
+    std::vector<uint32_t> m_particle_cell;
+
+public:
+    BroadphaseType type() const override { return BroadphaseType::Grid; }
+
+    void build(const ParticleStore& store, float margin) override;
+
+    void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) override;
+
+    void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) override;
+};
+
+
+// same binning, but cells are hashed into a table sized to the particle count
+// so memory does not depend on how far apart the particles are
+class HashGridBroadphase : public Broadphase
+{
+private:
+    float m_margin = 0.0f;
+    float m_cell_size = 1.0f;
+    uint32_t m_table_mask = 0;
+
+    std::vector<uint32_t> m_bucket_start;
+    std::vector<uint32_t> m_bucket_particles;
+    std::vector<uint32_t> m_particle_bucket;
+    std::vector<uint32_t> m_query_buckets;
+
+    uint32_t bucketOf(int cx, int cy) const;
+
+public:
+    BroadphaseType type() const override { return BroadphaseType::HashGrid; }
+
+    void build(const ParticleStore& store, float margin) override;
+
+    void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) override;
+
+    void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) override;
+};
+
+#endif
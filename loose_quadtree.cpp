@@ -0,0 +1,336 @@
+#include "loose_quadtree.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+    // a depth first walk holds at most 3 siblings per level plus 4 children
+    constexpr int traversal_stack_size = 64;
+    static_assert(3 * loose_max_depth + 4 <= traversal_stack_size, "traversal stack too small for loose_max_depth");
+
+    inline uint32_t quadrantOf(float px, float py, const LooseNode& node)
+    {
+        return (px >= node.x ? 1u : 0u) + (py >= node.y ? 2u : 0u);
+    }
+
+    inline void testPair(const ParticleStore& store, uint32_t p1, uint32_t p2, float margin,
+                         std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+    {
+        const float dx = store.x[p1] - store.x[p2];
+        const float dy = store.y[p1] - store.y[p2];
+        const float max_dist = store.radius[p1] + store.radius[p2] + margin;
+        if (dx * dx + dy * dy < max_dist * max_dist)
+        {
+            if (p1 < p2) pairs.push_back({p1, p2});
+            else         pairs.push_back({p2, p1});
+        }
+    }
+}
+
+
+void LooseQuadtree::clear()
+{
+    m_nodes.clear();
+    m_indices.clear();
+}
+
+void LooseQuadtree::build(const ParticleStore& store)
+{
+    m_nodes.clear();
+    m_indices.clear();
+
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    if (count == 0) return;
+
+    float min_x = store.x[0], max_x = store.x[0];
+    float min_y = store.y[0], max_y = store.y[0];
+    for (uint32_t i = 1; i < count; i++)
+    {
+        min_x = std::min(min_x, store.x[i]);
+        max_x = std::max(max_x, store.x[i]);
+        min_y = std::min(min_y, store.y[i]);
+        max_y = std::max(max_y, store.y[i]);
+    }
+
+    LooseNode root;
+    root.x = 0.5f * (min_x + max_x);
+    root.y = 0.5f * (min_y + max_y);
+    root.half = std::max(0.5f * std::max(max_x - min_x, max_y - min_y), 1.0f);
+    root.count = count;
+
+    // the deepest level whose cells are still at least as big as the radius
+    m_depth.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t depth = 0;
+        float child_half = 0.5f * root.half;
+        while (depth < loose_max_depth && child_half >= store.radius[i])
+        {
+            depth++;
+            child_half *= 0.5f;
+        }
+        m_depth[i] = static_cast<uint8_t>(depth);
+    }
+
+    m_indices.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_indices[i] = i;
+    }
+    m_scratch.resize(count);
+    m_bucket.resize(count);
+
+    m_nodes.push_back(root);
+
+    // children are appended behind their parent, so walking the array in order visits every node once
+    for (uint32_t n = 0; n < m_nodes.size(); n++)
+    {
+        LooseNode& node = m_nodes[n];
+        if (node.count > loose_leaf_particles && node.depth < loose_max_depth)
+        {
+            subdivide(store, n);
+        }
+        else
+        {
+            node.own = node.count;
+        }
+    }
+
+    // children always come after their parent, so a backwards pass sees them first
+    for (uint32_t n = static_cast<uint32_t>(m_nodes.size()); n-- > 0;)
+    {
+        LooseNode& node = m_nodes[n];
+        float max_radius = 0.0f;
+        for (uint32_t k = node.first; k < node.first + node.own; k++)
+        {
+            max_radius = std::max(max_radius, store.radius[m_indices[k]]);
+        }
+        if (!node.isLeaf())
+        {
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                max_radius = std::max(max_radius, m_nodes[node.children + c].max_radius);
+            }
+        }
+        node.max_radius = max_radius;
+    }
+}
+
+void LooseQuadtree::subdivide(const ParticleStore& store, uint32_t n)
+{
+    // m_nodes may reallocate below, work on a copy
+    const LooseNode node = m_nodes[n];
+
+    // counting sort into five buckets: the particles that stay in this node, then the four quadrants
+    uint32_t bucket_count[5] = {0, 0, 0, 0, 0};
+    for (uint32_t k = node.first; k < node.first + node.count; k++)
+    {
+        const uint32_t p = m_indices[k];
+        const uint32_t bucket = m_depth[p] <= node.depth ? 0 : 1 + quadrantOf(store.x[p], store.y[p], node);
+        m_bucket[k] = static_cast<uint8_t>(bucket);
+        bucket_count[bucket]++;
+    }
+
+    // all of them too big for the children, nothing to gain from splitting
+    if (bucket_count[0] == node.count)
+    {
+        m_nodes[n].own = node.count;
+        return;
+    }
+
+    uint32_t offset[5];
+    offset[0] = node.first;
+    for (int b = 1; b < 5; b++)
+    {
+        offset[b] = offset[b - 1] + bucket_count[b - 1];
+    }
+
+    uint32_t cursor[5] = {offset[0], offset[1], offset[2], offset[3], offset[4]};
+    for (uint32_t k = node.first; k < node.first + node.count; k++)
+    {
+        m_scratch[cursor[m_bucket[k]]++] = m_indices[k];
+    }
+    std::copy(m_scratch.begin() + node.first, m_scratch.begin() + node.first + node.count, m_indices.begin() + node.first);
+
+    const uint32_t children = static_cast<uint32_t>(m_nodes.size());
+    m_nodes[n].own = bucket_count[0];
+    m_nodes[n].children = children;
+
+    const float h = node.half / 2.0f;
+    const float child_x[4] = {node.x - h, node.x + h, node.x - h, node.x + h};
+    const float child_y[4] = {node.y - h, node.y - h, node.y + h, node.y + h};
+
+    for (int q = 0; q < 4; q++)
+    {
+        LooseNode child;
+        child.x = child_x[q];
+        child.y = child_y[q];
+        child.half = h;
+        child.first = offset[q + 1];
+        child.count = bucket_count[q + 1];
+        child.depth = node.depth + 1;
+        m_nodes.push_back(child);
+    }
+}
+
+void LooseQuadtree::queryRange(const ParticleStore& store, uint32_t p, std::vector<uint32_t>& particles) const
+{
+    queryRange(store.x[p], store.y[p], store.radius[p], particles);
+}
+
+void LooseQuadtree::queryRange(float px, float py, float reach, std::vector<uint32_t>& particles) const
+{
+    if (m_nodes.empty()) return;
+
+    uint32_t stack[traversal_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const LooseNode& n = m_nodes[stack[--top]];
+
+        // the loose bounds: the cell grown by the largest particle in it
+        const float extent = n.half + n.max_radius + reach;
+        if (n.count == 0 || std::abs(px - n.x) > extent || std::abs(py - n.y) > extent)
+        {
+            continue;
+        }
+
+        particles.insert(particles.end(), m_indices.begin() + n.first, m_indices.begin() + n.first + n.own);
+
+        if (!n.isLeaf())
+        {
+            assert(top + 4 <= traversal_stack_size);
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                stack[top++] = n.children + c;
+            }
+        }
+    }
+}
+
+void LooseQuadtree::getAllCollisionPairs(const ParticleStore& store, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+    if (m_nodes.empty()) return;
+
+    selfPairs(store, 0, margin, pairs);
+}
+
+void LooseQuadtree::selfPairs(const ParticleStore& store, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+    const LooseNode& node = m_nodes[n];
+    if (node.count < 2) return;
+
+    const uint32_t own_end = node.first + node.own;
+    for (uint32_t i = node.first; i < own_end; i++)
+    {
+        for (uint32_t j = i + 1; j < own_end; j++)
+        {
+            testPair(store, m_indices[i], m_indices[j], margin, pairs);
+        }
+    }
+    if (node.isLeaf()) return;
+
+    // the big particles kept here against everything below them
+    for (uint32_t i = node.first; i < own_end; i++)
+    {
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            particlePairs(store, m_indices[i], node.children + c, margin, pairs);
+        }
+    }
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        selfPairs(store, node.children + i, margin, pairs);
+
+        for (uint32_t j = i + 1; j < 4; j++)
+        {
+            crossPairs(store, node.children + i, node.children + j, margin, pairs);
+        }
+    }
+}
+
+void LooseQuadtree::crossPairs(const ParticleStore& store, uint32_t a, uint32_t b, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+    const LooseNode& node_a = m_nodes[a];
+    const LooseNode& node_b = m_nodes[b];
+    if (node_a.count == 0 || node_b.count == 0) return;
+
+    // gap between the two cells along each axis, the particles can only touch if it's below this reach
+    const float reach = node_a.max_radius + node_b.max_radius + margin;
+    const float gap_x = std::abs(node_a.x - node_b.x) - node_a.half - node_b.half;
+    const float gap_y = std::abs(node_a.y - node_b.y) - node_a.half - node_b.half;
+    if (gap_x >= reach || gap_y >= reach) return;
+
+    if (node_a.isLeaf() && node_b.isLeaf())
+    {
+        for (uint32_t i = node_a.first; i < node_a.first + node_a.count; i++)
+        {
+            for (uint32_t j = node_b.first; j < node_b.first + node_b.count; j++)
+            {
+                testPair(store, m_indices[i], m_indices[j], margin, pairs);
+            }
+        }
+        return;
+    }
+
+    // split the bigger node (or the only one that can be split): its own particles go against
+    // the whole other subtree, its children recurse
+    const bool split_a = !node_a.isLeaf() && (node_b.isLeaf() || node_a.half >= node_b.half);
+    const LooseNode& split = split_a ? node_a : node_b;
+    const uint32_t other = split_a ? b : a;
+    for (uint32_t i = split.first; i < split.first + split.own; i++)
+    {
+        particlePairs(store, m_indices[i], other, margin, pairs);
+    }
+    for (uint32_t c = 0; c < 4; c++)
+    {
+        if (split_a) crossPairs(store, split.children + c, b, margin, pairs);
+        else         crossPairs(store, a, split.children + c, margin, pairs);
+    }
+}
+
+void LooseQuadtree::particlePairs(const ParticleStore& store, uint32_t p, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+    const LooseNode& node = m_nodes[n];
+    if (node.count == 0) return;
+
+    const float reach = store.radius[p] + node.max_radius + margin;
+    if (std::abs(store.x[p] - node.x) - node.half >= reach || std::abs(store.y[p] - node.y) - node.half >= reach)
+    {
+        return;
+    }
+
+    for (uint32_t k = node.first; k < node.first + node.own; k++)
+    {
+        testPair(store, p, m_indices[k], margin, pairs);
+    }
+    if (node.isLeaf()) return;
+
+    for (uint32_t c = 0; c < 4; c++)
+    {
+        particlePairs(store, p, node.children + c, margin, pairs);
+    }
+}
+
+
+void LooseQuadtreeBroadphase::build(const ParticleStore& store, float margin)
+{
+    m_tree.build(store);
+    m_margin = margin;
+}
+
+void LooseQuadtreeBroadphase::findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    m_tree.getAllCollisionPairs(store, m_margin, pairs);
+}
+
+void LooseQuadtreeBroadphase::queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles)
+{
+    const std::size_t first = particles.size();
+    m_tree.queryRange(x, y, radius + 0.5f * m_margin, particles);
+    keepWithinRadius(store, x, y, radius, particles, first);
+}
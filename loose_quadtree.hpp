@@ -0,0 +1,97 @@
+#ifndef LOOSE_QUADTREE_HPP
+#define LOOSE_QUADTREE_HPP
+
+#include "broadphase.hpp"
+
+// a node with more particles than this is split, unless they are all too big for its children
+constexpr uint32_t loose_leaf_particles = 8;
+
+constexpr uint32_t loose_max_depth = 16;
+
+
+struct LooseNode
+{
+    float x{};
+    float y{};
+    float half{}; // the cell is square, its particles have their centre inside it and a radius of at most half
+
+    float max_radius{}; // largest particle in the subtree, they all stay within half + max_radius of the centre
+
+    // ORDER: top left, top right, bottom left, bottom right
+    uint32_t children{};
+
+    // particles of the subtree are indices[first, first + count). the first own of them are stored
+    // in this node itself, the rest belong to the children in quadrant order
+    uint32_t first{};
+    uint32_t own{};
+    uint32_t count{};
+
+    uint32_t depth{};
+
+    bool isLeaf() const { return children == 0; }
+};
+
+
+// loose quadtree: a particle is stored at the deepest level whose cells are at least as big as its radius,
+// in the cell containing its centre, so it never reaches further than one cell size out of it.
+// small particles sink to small cells and big ones stay near the root, which keeps the node bounds tight
+// for scenes that mix radii over orders of magnitude. the root covers the particle cloud, nothing is dropped
+class LooseQuadtree
+{
+private:
+    std::vector<LooseNode> m_nodes;
+    std::vector<uint32_t> m_indices;
+    std::vector<uint32_t> m_scratch;
+    std::vector<uint8_t> m_bucket;
+    std::vector<uint8_t> m_depth; // level every particle belongs to by its radius
+
+    void subdivide(const ParticleStore& store, uint32_t n);
+
+    void selfPairs(const ParticleStore& store, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+
+    void crossPairs(const ParticleStore& store, uint32_t a, uint32_t b, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+
+    // every particle of the subtree of n against p
+    void particlePairs(const ParticleStore& store, uint32_t p, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+
+public:
+    void build(const ParticleStore& store);
+
+    void clear();
+
+    bool empty() const { return m_nodes.empty(); }
+
+    const std::vector<LooseNode>& getNodes() const { return m_nodes; }
+
+    const std::vector<uint32_t>& getIndices() const { return m_indices; }
+
+    // particles whose circle may overlap the box of half size reach around (px, py)
+    void queryRange(float px, float py, float reach, std::vector<uint32_t>& particles) const;
+
+    // candidates touching particle p, whatever their size
+    void queryRange(const ParticleStore& store, uint32_t p, std::vector<uint32_t>& particles) const;
+
+    // appends every pair closer than r1 + r2 + margin exactly once, with first < second
+    void getAllCollisionPairs(const ParticleStore& store, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+};
+
+
+class LooseQuadtreeBroadphase : public Broadphase
+{
+private:
+    LooseQuadtree m_tree;
+    float m_margin = 0.0f;
+
+public:
+    const LooseQuadtree& getTree() const { return m_tree; }
+
+    BroadphaseType type() const override { return BroadphaseType::LooseQuadtree; }
+
+    void build(const ParticleStore& store, float margin) override;
+
+    void findPairs(const ParticleStore& store, std::vector<std::pair<uint32_t, uint32_t>>& pairs) override;
+
+    void queryRadius(const ParticleStore& store, float x, float y, float radius, std::vector<uint32_t>& particles) override;
+};
+
+#endif
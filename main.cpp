@@ -2,37 +2,23 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/System/Clock.hpp>
 #include "renderer.hpp"
-
-static sf::Color getColor(float t)
-{
-    const float r = sin(t);
-    const float g = sin(t + 0.33f * 2.0f * M_PI);
-    const float b = sin(t + 0.66f * 2.0f * M_PI);
-    return {static_cast<uint8_t>(255.0f * r * r),
-            static_cast<uint8_t>(255.0f * g * g),
-            static_cast<uint8_t>(255.0f * b * b)};
-}
+#include "emitter.hpp"
+#include "profiler.hpp"
+#include "checkpoint.hpp"
+#include "recorder.hpp"
+#include "sim_thread.hpp"
+#include <deque>
 
 int main()
 {
 
-    float max_angle = 120.0f * M_PI / 180.0f;
-
-    constexpr float spawn_velocity = 0.5f;
-
     constexpr uint32_t window_width = 800;
     constexpr uint32_t window_height = 800;
 
-    constexpr uint32_t max_objects = 2000;
-    constexpr float spawn_delay = 0.01f;
-
 
     sf::RenderWindow window(sf::VideoMode({window_width, window_height}), "My window");
 
-    sf::Clock globalClock;
-    sf::Clock clock;
-
-    sf::Clock respawnClock, timer, fpstimer;
+    sf::Clock fpstimer;
     sf::Font arialFont;
     arialFont.openFromFile("/mnt/c/Projects/ParticleSimulation/arial.ttf");
 
@@ -51,6 +37,15 @@ int main()
     // run the program as long as the window is open
 
     Solver solver;
+    solver.setWorldBounds(Vec2{0.0f, 0.0f}, Vec2{static_cast<float>(window_width), static_cast<float>(window_height)});
+    profiler::setThreadName("main");
+
+    // same jet as before: one particle per frame from (420, 100), up to 2000 of them
+    Emitter emitter;
+    emitter.max_objects = 2000;
+
+    // R starts and stops recording to particlesim.traj, frames are dropped rather than stalling the window
+    TrajectoryRecorder recorder;
     
 
     // circular boundary stuff
@@ -66,6 +61,20 @@ int main()
     //auto& object = solver.addObject(Vec2{420.0f, 100.0f}, 10.0f);
 
 
+    // the simulation runs on its own thread and hands finished frames over as snapshots, so this thread only
+    // draws and turns input into commands. the emitter and the recorder belong to the simulation thread from here on
+    SimulationThread simulation(solver,
+                                [&](Solver& s) { emitter.update(s, Solver::getFrameDt()); },
+                                [&](Solver& s) { recorder.record(s.getObjects(), s.getFrameCount()); });
+    simulation.setFrameRate(static_cast<float>(frame_rate));
+    simulation.start();
+
+    sf::Clock frametimer;
+
+    // key commands the full command queue turned away, posted again on the next frame so no key press is lost.
+    // the mouse ones are posted every frame the button is held, dropping one of those is harmless
+    std::deque<SimulationThread::Command> key_commands;
+
     while (window.isOpen()) // this is where we will update 
     {
         // check all the window's events that were triggered since the last iteration of the loop
@@ -74,48 +83,95 @@ int main()
             // "close requested" event: we close the window
             if (event->is<sf::Event::Closed>())
                 window.close();
-        }
 
-        if (solver.getObjects().size() < max_objects && clock.getElapsedTime().asSeconds() >= spawn_delay)
-        {
-            float t = globalClock.getElapsedTime().asSeconds();
-            auto& particle = solver.addObject(Vec2{420.0f, 100.0f}, 3.0f);
-            
-            float angle = M_PI * 0.5f + max_angle * sin(3.0f * t);
-
-            particle.setColor(getColor(t));
-            
-            solver.setObjectVelocity(particle, spawn_velocity * Vec2{cos(angle), sin(angle)});
-            clock.restart();
+            // B cycles the broadphase so they can be compared on the same scene
+            if (const auto* key = event->getIf<sf::Event::KeyPressed>())
+            {
+                if (key->code == sf::Keyboard::Key::B)
+                {
+                    key_commands.push_back([](Solver& s) {
+                        switch (s.getBroadphaseType())
+                        {
+                            case BroadphaseType::Quadtree: s.setBroadphase(BroadphaseType::Grid); break;
+                            case BroadphaseType::Grid:     s.setBroadphase(BroadphaseType::HashGrid); break;
+                            case BroadphaseType::HashGrid: s.setBroadphase(BroadphaseType::LooseQuadtree); break;
+                            case BroadphaseType::LooseQuadtree: s.setBroadphase(BroadphaseType::Chunked); break;
+                            case BroadphaseType::Chunked:  s.setBroadphase(BroadphaseType::Quadtree); break;
+                        }
+                    });
+                }
+
+                // F5 saves the scene, F9 goes back to it
+                if (key->code == sf::Keyboard::Key::F5 || key->code == sf::Keyboard::Key::F9)
+                {
+                    const bool save = key->code == sf::Keyboard::Key::F5;
+                    key_commands.push_back([&emitter, save](Solver& s) {
+                        std::string error;
+                        const bool ok = save ? saveCheckpoint("particlesim.ckpt", s, emitter, error)
+                                             : loadCheckpoint("particlesim.ckpt", s, emitter, error);
+                        if (!ok)
+                            std::cout << error << "\n";
+                    });
+                }
+
+                if (key->code == sf::Keyboard::Key::R)
+                {
+                    key_commands.push_back([&recorder](Solver&) {
+                        std::string error;
+                        if (recorder.isOpen())
+                        {
+                            recorder.close();
+                            std::cout << "recording stopped, " << recorder.getDroppedFrames() << " frames dropped\n";
+                        }
+                        else if (!recorder.open("particlesim.traj", error, 1.0f / 64.0f, 60, 8, true))
+                        {
+                            std::cout << error << "\n";
+                        }
+                    });
+                }
+
+                // T dumps the spans recorded since the last performance report (PARTICLESIM_PROFILE builds only)
+                if (key->code == sf::Keyboard::Key::T)
+                {
+                    key_commands.push_back([](Solver&) {
+                        if (profiler::compiled_in && profiler::writeChromeTrace("particlesim_trace.json"))
+                            std::cout << "wrote particlesim_trace.json\n";
+                    });
+                }
+            }
         }
 
+        while (!key_commands.empty() && simulation.post(key_commands.front()))
+            key_commands.pop_front();
+
         if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left))
         {
             float ratio = 840.0f / window.getSize().x;
             sf::Vector2f pos = static_cast<sf::Vector2f>(sf::Mouse::getPosition(window)) * ratio;
-            solver.mousePull(Vec2{pos.x, pos.y});
+            simulation.post([pos](Solver& s) { s.mousePull(Vec2{pos.x, pos.y}); });
         }
         if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Right))
         {
             float ratio = 840.0f / window.getSize().x;
             sf::Vector2f pos = static_cast<sf::Vector2f>(sf::Mouse::getPosition(window)) * ratio;
-            solver.mousePush(Vec2{pos.x, pos.y});
+            simulation.post([pos](Solver& s) { s.mousePush(Vec2{pos.x, pos.y}); });
         }
 
-        fpstimer.restart();
-        solver.update();
-        float solver_ms = fpstimer.getElapsedTime().asMicroseconds() / 1000.0f;
-        
+        // the newest frame the simulation finished, it keeps going on the next one meanwhile
+        const FrameSnapshot& snapshot = simulation.acquire();
+
         fpstimer.restart();
         window.clear(sf::Color::White);
-        renderWithDebug(window, solver, false);
+        render(window, snapshot);
         float render_ms = fpstimer.getElapsedTime().asMicroseconds() / 1000.0f;
+        float frame_ms = frametimer.restart().asMicroseconds() / 1000.0f;
 
         sf::Text number(arialFont);
         number.setFont(arialFont);
-        number.setString("Solver: " + std::to_string(solver_ms) + "ms | Render: " + std::to_string(render_ms) + 
-                        "ms | Total: " + std::to_string(solver_ms + render_ms) + "ms | " + 
-                        std::to_string(solver.getObjects().size()) + " particles");
+        number.setString("Solver: " + std::to_string(snapshot.frame_ms) + "ms | Render: " + std::to_string(render_ms) +
+                        "ms | Frame: " + std::to_string(frame_ms) + "ms | " +
+                        std::to_string(snapshot.size()) + " particles, " +
+                        std::to_string(snapshot.timings.asleep) + " asleep");
         number.setCharacterSize(20);
         number.setFillColor(sf::Color::Magenta);
         window.draw(number);
@@ -123,6 +179,8 @@ int main()
         window.display();
     }
 
+    simulation.stop();
+
     return 0;
 }
 
@@ -0,0 +1,136 @@
+#include "morton.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+
+uint32_t mortonKey(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+const std::vector<uint32_t>& MortonSorter::sort(const ParticleStore& store, ThreadPool& pool)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    m_keys.resize(count);
+    m_order.resize(count);
+    if (count == 0) return m_order;
+
+    float min_x = store.x[0], max_x = store.x[0];
+    float min_y = store.y[0], max_y = store.y[0];
+    for (uint32_t i = 1; i < count; i++)
+    {
+        min_x = std::min(min_x, store.x[i]);
+        max_x = std::max(max_x, store.x[i]);
+        min_y = std::min(min_y, store.y[i]);
+        max_y = std::max(max_y, store.y[i]);
+    }
+
+    // 16 bits per axis over the larger side, so cells stay square
+    const float extent = std::max(std::max(max_x - min_x, max_y - min_y), 1e-6f);
+    const float scale = 65535.0f / extent;
+    pool.parallelFor(count, 4096, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const uint32_t qx = static_cast<uint32_t>((store.x[i] - min_x) * scale);
+            const uint32_t qy = static_cast<uint32_t>((store.y[i] - min_y) * scale);
+            m_keys[i] = mortonKey(qx, qy);
+            m_order[i] = i;
+        }
+    });
+
+    // stable, so equal keys keep their relative order
+    m_sorter.sort(m_keys, m_order, 32, pool);
+    return m_order;
+}
+
+void RadixSorter::sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t key_bits, ThreadPool& pool)
+{
+    const uint32_t count = static_cast<uint32_t>(keys.size());
+    if (count < 2) return;
+
+    const uint32_t blocks = (count - 1) / block_size + 1;
+    m_keys_scratch.resize(count);
+    m_values_scratch.resize(count);
+    m_offsets.resize(blocks);
+
+    for (uint32_t shift = 0; shift < key_bits; shift += 8)
+    {
+        const uint64_t* src_keys = keys.data();
+        const uint32_t* src_values = values.data();
+
+        pool.parallelFor(blocks, 1, [&](uint32_t first_block, uint32_t last_block)
+        {
+            for (uint32_t b = first_block; b < last_block; b++)
+            {
+                auto& counts = m_offsets[b];
+                counts.fill(0);
+                const uint32_t end = std::min(count, (b + 1) * block_size);
+                for (uint32_t i = b * block_size; i < end; i++)
+                {
+                    counts[(src_keys[i] >> shift) & 0xff]++;
+                }
+            }
+        });
+
+        // bucket by bucket, and block by block inside a bucket, which is what keeps the sort stable
+        uint32_t total = 0;
+        bool one_bucket = false;
+        for (uint32_t d = 0; d < 256; d++)
+        {
+            const uint32_t bucket_first = total;
+            for (uint32_t b = 0; b < blocks; b++)
+            {
+                const uint32_t block_count = m_offsets[b][d];
+                m_offsets[b][d] = total;
+                total += block_count;
+            }
+            one_bucket |= total - bucket_first == count;
+        }
+        // every key shares this byte, nothing to do for this pass
+        if (one_bucket) continue;
+
+        uint64_t* dst_keys = m_keys_scratch.data();
+        uint32_t* dst_values = m_values_scratch.data();
+        pool.parallelFor(blocks, 1, [&](uint32_t first_block, uint32_t last_block)
+        {
+            for (uint32_t b = first_block; b < last_block; b++)
+            {
+                auto& offsets = m_offsets[b];
+                const uint32_t end = std::min(count, (b + 1) * block_size);
+                for (uint32_t i = b * block_size; i < end; i++)
+                {
+                    const uint32_t dst = offsets[(src_keys[i] >> shift) & 0xff]++;
+                    dst_keys[dst] = src_keys[i];
+                    dst_values[dst] = src_values[i];
+                }
+            }
+        });
+        keys.swap(m_keys_scratch);
+        values.swap(m_values_scratch);
+    }
+}
+
+float pairIndexSpread(const std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    if (pairs.empty()) return 0.0f;
+
+    constexpr std::size_t samples = 4096;
+    const std::size_t stride = std::max<std::size_t>(1, pairs.size() / samples);
+
+    double total = 0.0;
+    std::size_t counted = 0;
+    for (std::size_t k = 0; k < pairs.size(); k += stride)
+    {
+        total += pairs[k].second - pairs[k].first; // pairs have first < second
+        counted++;
+    }
+    return static_cast<float>(total / counted);
+}
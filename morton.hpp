@@ -0,0 +1,49 @@
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include "particle.hpp"
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// interleaves the low 16 bits of x and y, x in the even bits
+uint32_t mortonKey(uint32_t x, uint32_t y);
+
+// stable lsd radix sort of 64 bit keys that carry a 32 bit value each, 8 bits per pass. blocks of the input are
+// counted and scattered in parallel, each block into its own range of every bucket. buffers are kept between calls
+class RadixSorter
+{
+private:
+    static constexpr uint32_t block_size = 16384;
+
+    std::vector<uint64_t> m_keys_scratch;
+    std::vector<uint32_t> m_values_scratch;
+    std::vector<std::array<uint32_t, 256>> m_offsets; // by block, counts first and then where the block writes to
+
+public:
+    // sorts on the lowest key_bits bits only, passes over higher bytes are skipped
+    void sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t key_bits, ThreadPool& pool);
+};
+
+// sorts particle slots along a Z-order curve over the particles' bounding box, so particles that are
+// close in space end up close in memory. the keys are made and sorted on the pool, buffers are kept between calls
+class MortonSorter
+{
+private:
+    std::vector<uint64_t> m_keys;
+    std::vector<uint32_t> m_order;
+    RadixSorter m_sorter;
+
+public:
+    // slots in curve order, ready for ParticleStore::reorder
+    const std::vector<uint32_t>& sort(const ParticleStore& store, ThreadPool& pool);
+};
+
+// mean slot distance between the two particles of a pair, over a sample of the pairs.
+// grows as particles wander away from the order they were sorted in
+float pairIndexSpread(const std::vector<std::pair<uint32_t, uint32_t>>& pairs);
+
+#endif
@@ -0,0 +1,186 @@
+#include "nbody.hpp"
+#include "profiler.hpp"
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+
+void BarnesHut::compute(const ParticleStore& store, const NBodySettings& settings, ThreadPool& pool)
+{
+    PROFILE_SCOPE("BarnesHut::compute");
+
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    m_ax.assign(count, 0.0f);
+    m_ay.assign(count, 0.0f);
+    m_groups.clear();
+    if (count == 0)
+    {
+        m_tree.clear();
+        return;
+    }
+
+    // a square root around every particle, wherever they are
+    float min_x = store.x[0];
+    float max_x = store.x[0];
+    float min_y = store.y[0];
+    float max_y = store.y[0];
+    for (uint32_t i = 1; i < count; i++)
+    {
+        min_x = std::min(min_x, store.x[i]);
+        max_x = std::max(max_x, store.x[i]);
+        min_y = std::min(min_y, store.y[i]);
+        max_y = std::max(max_y, store.y[i]);
+    }
+    const float half = 0.5f * std::max(max_x - min_x, max_y - min_y) + 1.0f;
+    m_tree.buildSorted(store, 0.5f * (min_x + max_x), 0.5f * (min_y + max_y), half, half, pool);
+    m_tree.aggregateMass(store);
+    collectGroups(0);
+
+    const float softening2 = settings.softening * settings.softening;
+    const std::vector<uint32_t>& indices = m_tree.getIndices();
+
+    pool.parallelFor(static_cast<uint32_t>(m_groups.size()), 4, [&](uint32_t begin, uint32_t end)
+    {
+        Sources sources;
+        std::vector<uint32_t> stack;
+        for (uint32_t g = begin; g < end; g++)
+        {
+            const Node& group = m_tree.getNode(m_groups[g]);
+            gatherSources(store, m_groups[g], settings.theta, stack, sources);
+
+            const PointMasses masses{sources.mass.data(), sources.x.data(), sources.y.data()};
+            const uint32_t source_count = static_cast<uint32_t>(sources.mass.size());
+
+            // a built tree keeps every subtree in one range of the index buffer
+            for (uint32_t k = group.first; k < group.first + group.count; k++)
+            {
+                const uint32_t p = indices[k];
+                if (store.asleep[p]) continue;
+
+                // p is among its own sources, at distance 0 it adds nothing
+                const Vec2 pull = sumPointMasses(masses, source_count, store.x[p], store.y[p], softening2);
+                m_ax[p] = settings.strength * pull.x;
+                m_ay[p] = settings.strength * pull.y;
+            }
+        }
+    });
+}
+
+void BarnesHut::collectGroups(uint32_t n)
+{
+    const Node& node = m_tree.getNode(n);
+    if (node.count == 0) return;
+
+    if (node.isLeaf() || node.count <= nbody_group_size)
+    {
+        m_groups.push_back(n);
+        return;
+    }
+    for (uint32_t c = node.children; c < node.children + 4; c++)
+    {
+        collectGroups(c);
+    }
+}
+
+void BarnesHut::gatherSources(const ParticleStore& store, uint32_t group, float theta, std::vector<uint32_t>& stack,
+                              Sources& sources) const
+{
+    const Node& target = m_tree.getNode(group);
+    const std::vector<uint32_t>& indices = m_tree.getIndices();
+    const float theta2 = theta * theta;
+
+    sources.mass.clear();
+    sources.x.clear();
+    sources.y.clear();
+    auto addParticles = [&](const Node& node) {
+        for (uint32_t k = node.first; k < node.first + node.count; k++)
+        {
+            const uint32_t q = indices[k];
+            sources.mass.push_back(store.getMass(q));
+            sources.x.push_back(store.x[q]);
+            sources.y.push_back(store.y[q]);
+        }
+    };
+
+    stack.assign(1, 0);
+    while (!stack.empty())
+    {
+        const uint32_t n = stack.back();
+        stack.pop_back();
+
+        const Node& node = m_tree.getNode(n);
+        const MassAggregate& aggregate = m_tree.getMass(n);
+        if (aggregate.mass == 0.0f) continue;
+
+        // the group pulls on itself particle by particle
+        if (n == group)
+        {
+            addParticles(node);
+            continue;
+        }
+
+        // nodes are aligned quadrants, so the ones holding the group's centre are its ancestors and have to be opened
+        const bool ancestor = std::abs(target.x - node.x) < node.half_W && std::abs(target.y - node.y) < node.half_H;
+        if (!ancestor)
+        {
+            // from the centre of mass to the nearest point of the group
+            const float dx = std::max(0.0f, std::abs(aggregate.x - target.x) - target.half_W);
+            const float dy = std::max(0.0f, std::abs(aggregate.y - target.y) - target.half_H);
+            const float size = 2.0f * std::max(node.half_W, node.half_H);
+            if (size * size < theta2 * (dx * dx + dy * dy))
+            {
+                sources.mass.push_back(aggregate.mass);
+                sources.x.push_back(aggregate.x);
+                sources.y.push_back(aggregate.y);
+                continue;
+            }
+            if (node.isLeaf())
+            {
+                addParticles(node);
+                continue;
+            }
+        }
+
+        for (uint32_t c = node.children; c < node.children + 4; c++)
+        {
+            stack.push_back(c);
+        }
+    }
+}
+
+void BarnesHut::removeFlagged(const std::vector<uint8_t>& remove)
+{
+    // nothing computed for these slots
+    if (m_ax.size() != remove.size())
+    {
+        m_ax.clear();
+        m_ay.clear();
+        return;
+    }
+
+    std::size_t kept = 0;
+    for (std::size_t k = 0; k < remove.size(); k++)
+    {
+        if (remove[k]) continue;
+        m_ax[kept] = m_ax[k];
+        m_ay[kept] = m_ay[k];
+        kept++;
+    }
+    m_ax.resize(kept);
+    m_ay.resize(kept);
+}
+
+void BarnesHut::removeSwap(uint32_t slot, std::size_t count)
+{
+    // nothing computed for these slots
+    if (m_ax.size() != count)
+    {
+        m_ax.clear();
+        m_ay.clear();
+        return;
+    }
+
+    m_ax[slot] = m_ax.back();
+    m_ay[slot] = m_ay.back();
+    m_ax.pop_back();
+    m_ay.pop_back();
+}
@@ -0,0 +1,78 @@
+#ifndef NBODY_HPP
+#define NBODY_HPP
+
+#include "particle.hpp"
+#include "quadtree.hpp"
+#include "thread_pool.hpp"
+#include <vector>
+
+// mutual attraction between all particles: strength * m1 * m2 / r^2, softened as r^2 + softening^2 so close pairs
+// stay bounded, softening 0 gives the plain 1 / r^2 with coincident pairs left out. a negative strength pushes every
+// particle away from every other, like equal charges
+struct NBodySettings
+{
+    float strength = 0.0f; // 0 turns it off
+    float theta = 0.5f;    // barnes-hut opening angle, 0 sums every pair directly
+    float softening = 2.0f;
+
+    bool enabled() const { return strength != 0.0f; }
+};
+
+// particles that share one walk of the tree, a subtree of at most this many
+constexpr uint32_t nbody_group_size = 32;
+
+
+// barnes-hut evaluation of the NBodySettings force in O(n log n). the particles go into a quadtree whose nodes know
+// their total mass and centre of mass. a node that is seen under a smaller angle than theta (size / distance) acts
+// as one particle at its centre of mass, closer ones are opened up down to the leaves, whose particles are summed
+// directly.
+// the tree is walked once per group of nearby particles rather than once per particle, measuring the distance to
+// the group's bounds. that gives a list of sources that is then summed for every particle of the group
+class BarnesHut
+{
+private:
+    // sources of one group, point masses
+    struct Sources
+    {
+        std::vector<float> mass;
+        std::vector<float> x;
+        std::vector<float> y;
+    };
+
+    Quadtree m_tree;
+    std::vector<uint32_t> m_groups; // nodes
+    std::vector<float> m_ax;
+    std::vector<float> m_ay;
+
+    void collectGroups(uint32_t n);
+
+    void gatherSources(const ParticleStore& store, uint32_t group, float theta, std::vector<uint32_t>& stack,
+                       Sources& sources) const;
+
+public:
+    // the acceleration of every awake particle, pulled on by all particles including the sleeping ones.
+    // sleeping particles get none, nothing would integrate it
+    void compute(const ParticleStore& store, const NBodySettings& settings, ThreadPool& pool);
+
+    // by slot, from the last compute
+    const std::vector<float>& getAccelerationX() const { return m_ax; }
+
+    const std::vector<float>& getAccelerationY() const { return m_ay; }
+
+    // follows ParticleStore::removeFlagged, so the accelerations stay with their particles
+    void removeFlagged(const std::vector<uint8_t>& remove);
+
+    // follows ParticleStore::removeSwap on a store of count particles
+    void removeSwap(uint32_t slot, std::size_t count);
+
+    // particles added since the last compute get none
+    void resize(std::size_t count)
+    {
+        m_ax.resize(count, 0.0f);
+        m_ay.resize(count, 0.0f);
+    }
+
+    const Quadtree& getTree() const { return m_tree; }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "neighbour_list.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+
+void NeighbourList::setSkin(float p_skin)
+{
+    m_skin = p_skin;
+    m_valid = false;
+}
+
+bool NeighbourList::needsRebuild(const ParticleStore& store) const
+{
+    if (!m_valid || m_build_x.size() != store.size()) return true;
+
+    const float limit = 0.5f * m_skin;
+    const float limit2 = limit * limit;
+    const std::size_t count = store.size();
+
+    const float* x = store.x.data();
+    const float* y = store.y.data();
+    const float* bx = m_build_x.data();
+    const float* by = m_build_y.data();
+
+    // blocks without an early exit in the inner loop so it vectorizes
+    constexpr std::size_t block = 256;
+    for (std::size_t begin = 0; begin < count; begin += block)
+    {
+        const std::size_t end = std::min(begin + block, count);
+        float max_d2 = 0.0f;
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const float dx = x[i] - bx[i];
+            const float dy = y[i] - by[i];
+            max_d2 = std::max(max_d2, dx * dx + dy * dy);
+        }
+        if (max_d2 > limit2) return true;
+    }
+    return false;
+}
+
+void NeighbourList::rebuild(const ParticleStore& store, Broadphase& broadphase)
+{
+    {
+        PROFILE_SCOPE("broadphase build");
+        broadphase.build(store, m_skin);
+    }
+    {
+        PROFILE_SCOPE("broadphase pairs");
+        m_pairs.clear();
+        broadphase.findPairs(store, m_pairs);
+
+        // sleeping particles don't move, two of them have nothing to solve
+        m_pairs.erase(std::remove_if(m_pairs.begin(), m_pairs.end(), [&](const std::pair<uint32_t, uint32_t>& pair) {
+            return store.asleep[pair.first] && store.asleep[pair.second];
+        }), m_pairs.end());
+    }
+
+    m_build_x = store.x;
+    m_build_y = store.y;
+
+    m_valid = true;
+    m_rebuilds++;
+}
+
+uint32_t NeighbourList::takeRebuildCount()
+{
+    uint32_t rebuilds = m_rebuilds;
+    m_rebuilds = 0;
+    return rebuilds;
+}
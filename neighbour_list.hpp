@@ -0,0 +1,50 @@
+#ifndef NEIGHBOUR_LIST_HPP
+#define NEIGHBOUR_LIST_HPP
+
+#include "broadphase.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// verlet neighbour list: pairs are gathered within r1 + r2 + skin and stay valid
+// until some particle has moved more than skin / 2 since the list was built
+// (two particles closing in on each other can then cover at most the whole skin).
+// pairs of two sleeping particles are left out, so it has to be rebuilt when particles wake up
+class NeighbourList
+{
+private:
+    float m_skin;
+
+    std::vector<std::pair<uint32_t, uint32_t>> m_pairs;
+
+    // positions at the last build
+    std::vector<float> m_build_x;
+    std::vector<float> m_build_y;
+
+    bool m_valid = false;
+    uint32_t m_rebuilds = 0;
+
+public:
+    explicit NeighbourList(float p_skin) : m_skin{p_skin} {}
+
+    float getSkin() const { return m_skin; }
+
+    void setSkin(float p_skin);
+
+    // true if particles were added or removed, or one moved further than skin / 2
+    bool needsRebuild(const ParticleStore& store) const;
+
+    void rebuild(const ParticleStore& store, Broadphase& broadphase);
+
+    // force a rebuild on the next check, e.g. after the broadphase or the particles were swapped out
+    void invalidate() { m_valid = false; }
+
+    std::vector<std::pair<uint32_t, uint32_t>>& getPairs() { return m_pairs; }
+
+    const std::vector<std::pair<uint32_t, uint32_t>>& getPairs() const { return m_pairs; }
+
+    // number of rebuilds since the last call
+    uint32_t takeRebuildCount();
+};
+
+#endif
@@ -1,49 +1,290 @@
 #include "particle.hpp"
+#include <limits>
 
-Particle::Particle() = default;
+uint32_t ParticleStore::add(const Vec2& p_position, float p_radius)
+{
+    x.push_back(p_position.x);
+    y.push_back(p_position.y);
+    last_x.push_back(p_position.x);
+    last_y.push_back(p_position.y);
+    ax.push_back(10.0f);
+    ay.push_back(10.0f);
+    radius.push_back(p_radius);
+    color.push_back(Color{});
+    asleep.push_back(0);
+    expires.push_back(std::numeric_limits<float>::infinity());
+
+    const uint32_t slot = static_cast<uint32_t>(x.size() - 1);
+    uint32_t new_id = static_cast<uint32_t>(slot_of_id.size());
+    if (free_ids.empty())
+    {
+        slot_of_id.push_back(slot);
+        generation.push_back(0);
+    }
+    else
+    {
+        new_id = free_ids.back();
+        free_ids.pop_back();
+        slot_of_id[new_id] = slot;
+    }
+    id.push_back(new_id);
+    return slot;
+}
+
+void ParticleStore::reserve(std::size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    last_x.reserve(count);
+    last_y.reserve(count);
+    ax.reserve(count);
+    ay.reserve(count);
+    radius.reserve(count);
+    color.reserve(count);
+    asleep.reserve(count);
+    expires.reserve(count);
+    id.reserve(count);
+    slot_of_id.reserve(count);
+    generation.reserve(count);
+}
+
+void ParticleStore::clear()
+{
+    x.clear();
+    y.clear();
+    last_x.clear();
+    last_y.clear();
+    ax.clear();
+    ay.clear();
+    radius.clear();
+    color.clear();
+    asleep.clear();
+    expires.clear();
+    id.clear();
+    slot_of_id.clear();
+    generation.clear();
+    free_ids.clear();
+}
+
+namespace
+{
+    // values[k] = old values[order[k]], the old array ends up in scratch for the next call to reuse
+    template <typename T>
+    void gather(std::vector<T>& values, const std::vector<uint32_t>& order, std::vector<T>& scratch)
+    {
+        scratch.resize(values.size());
+        for (std::size_t k = 0; k < order.size(); k++)
+        {
+            scratch[k] = values[order[k]];
+        }
+        values.swap(scratch);
+    }
+}
+
+void ParticleStore::reorder(const std::vector<uint32_t>& order)
+{
+    std::vector<float> scratch;
+    gather(x, order, scratch);
+    gather(y, order, scratch);
+    gather(last_x, order, scratch);
+    gather(last_y, order, scratch);
+    gather(ax, order, scratch);
+    gather(ay, order, scratch);
+    gather(radius, order, scratch);
+
+    std::vector<Color> color_scratch;
+    gather(color, order, color_scratch);
+
+    std::vector<uint8_t> asleep_scratch;
+    gather(asleep, order, asleep_scratch);
+    gather(expires, order, scratch);
+
+    std::vector<uint32_t> id_scratch;
+    gather(id, order, id_scratch);
+
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        slot_of_id[id[k]] = k;
+    }
+}
+
+namespace
+{
+    template <typename T>
+    void keepUnflagged(std::vector<T>& values, const std::vector<uint8_t>& remove)
+    {
+        std::size_t kept = 0;
+        for (std::size_t k = 0; k < values.size(); k++)
+        {
+            if (!remove[k]) values[kept++] = values[k];
+        }
+        values.resize(kept);
+    }
+}
+
+void ParticleStore::removeFlagged(const std::vector<uint8_t>& remove)
+{
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        if (!remove[k]) continue;
+        slot_of_id[id[k]] = no_slot;
+        generation[id[k]]++;
+        free_ids.push_back(id[k]);
+    }
+
+    keepUnflagged(x, remove);
+    keepUnflagged(y, remove);
+    keepUnflagged(last_x, remove);
+    keepUnflagged(last_y, remove);
+    keepUnflagged(ax, remove);
+    keepUnflagged(ay, remove);
+    keepUnflagged(radius, remove);
+    keepUnflagged(color, remove);
+    keepUnflagged(asleep, remove);
+    keepUnflagged(expires, remove);
+    keepUnflagged(id, remove);
+
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        slot_of_id[id[k]] = k;
+    }
+}
+
+namespace
+{
+    template <typename T>
+    void swapRemove(std::vector<T>& values, uint32_t slot)
+    {
+        values[slot] = values.back();
+        values.pop_back();
+    }
+}
+
+void ParticleStore::removeSwap(uint32_t slot)
+{
+    const uint32_t removed = id[slot];
+    slot_of_id[removed] = no_slot;
+    generation[removed]++;
+    free_ids.push_back(removed);
+
+    swapRemove(x, slot);
+    swapRemove(y, slot);
+    swapRemove(last_x, slot);
+    swapRemove(last_y, slot);
+    swapRemove(ax, slot);
+    swapRemove(ay, slot);
+    swapRemove(radius, slot);
+    swapRemove(color, slot);
+    swapRemove(asleep, slot);
+    swapRemove(expires, slot);
+    swapRemove(id, slot);
+    if (slot < id.size()) slot_of_id[id[slot]] = slot;
+}
+
+void ParticleStore::resetIds()
+{
+    id.resize(size());
+    slot_of_id.resize(size());
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        id[k] = k;
+        slot_of_id[k] = k;
+    }
+    generation.assign(size(), 0);
+    free_ids.clear();
+}
 
-Particle::Particle(const Vec2& p_position, float p_radius)
-    : m_position{p_position},
-    m_position_last{p_position},
-    m_acceleration{10.0f, 10.0f},
-    m_radius{p_radius}
-{}
+bool ParticleStore::rebuildSlots()
+{
+    if (id.size() != size()) return false;
+
+    slot_of_id.assign(id.size(), no_slot);
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        if (id[k] >= id.size() || slot_of_id[id[k]] != no_slot) return false;
+        slot_of_id[id[k]] = k;
+    }
+    generation.assign(id.size(), 0);
+    free_ids.clear();
+    return true;
+}
+
+void ParticleStore::packedIds(std::vector<uint32_t>& packed) const
+{
+    // the rank of every live id among the live ones
+    std::vector<uint32_t> rank(idCount(), 0);
+    uint32_t next = 0;
+    for (uint32_t n = 0; n < idCount(); n++)
+    {
+        if (slot_of_id[n] != no_slot) rank[n] = next++;
+    }
+
+    packed.resize(id.size());
+    for (uint32_t k = 0; k < id.size(); k++)
+    {
+        packed[k] = rank[id[k]];
+    }
+}
 
-void Particle::update(float dt)
+void ParticleStore::setVelocity(uint32_t i, const Vec2& p_velocity, float dt)
 {
-    Vec2 displacement = m_position - m_position_last;
-    m_position_last = m_position;
-    m_position = m_position + displacement + m_acceleration * (dt * dt);
-    m_acceleration = {0.0f, 0.0f}; //reset acceleration
+    last_x[i] = x[i] - p_velocity.x * dt;
+    last_y[i] = y[i] - p_velocity.y * dt;
 }
 
-void Particle::accelerate(const Vec2& p_acceleration)
+void ParticleStore::addVelocity(uint32_t i, const Vec2& p_velocity, float dt)
 {
-    m_acceleration += p_acceleration;
+    last_x[i] -= p_velocity.x * dt;
+    last_y[i] -= p_velocity.y * dt;
 }
 
-void Particle::setVelocity(const Vec2& p_velocity, float dt)
+void ParticleStore::accelerate(uint32_t i, const Vec2& p_acceleration)
 {
-    m_position_last = m_position - (p_velocity * dt);
+    ax[i] += p_acceleration.x;
+    ay[i] += p_acceleration.y;
 }
 
-void Particle::addVelocity(const Vec2& p_velocity, float dt)
+Vec2 ParticleHandle::getPosition() const
 {
-    m_position_last -= p_velocity * dt;
+    return valid() ? m_store->getPosition(index()) : Vec2();
 }
 
-Vec2 Particle::getVelocity()
+void ParticleHandle::setPosition(const Vec2& p_position)
 {
-    return m_position - m_position_last;
+    if (valid()) m_store->setPosition(index(), p_position);
 }
 
-void Particle::setColor(sf::Color color)
+float ParticleHandle::getRadius() const
 {
-    m_color = color;
+    return valid() ? m_store->radius[index()] : 0.0f;
 }
 
-sf::Color Particle::getColor() const
+void ParticleHandle::accelerate(const Vec2& p_acceleration)
 {
-    return m_color;
+    if (valid()) m_store->accelerate(index(), p_acceleration);
 }
 
+void ParticleHandle::setVelocity(const Vec2& p_velocity, float dt)
+{
+    if (valid()) m_store->setVelocity(index(), p_velocity, dt);
+}
+
+void ParticleHandle::addVelocity(const Vec2& p_velocity, float dt)
+{
+    if (valid()) m_store->addVelocity(index(), p_velocity, dt);
+}
+
+Vec2 ParticleHandle::getVelocity() const
+{
+    return valid() ? m_store->getVelocity(index()) : Vec2();
+}
+
+void ParticleHandle::setColor(Color color)
+{
+    if (valid()) m_store->color[index()] = color;
+}
+
+Color ParticleHandle::getColor() const
+{
+    return valid() ? m_store->color[index()] : Color{};
+}
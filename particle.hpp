@@ -2,44 +2,149 @@
 #define PARTICLE_HPP
 
 #include "Vec2.hpp"
-#include <iostream>
-#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <vector>
 
 
-class Particle
+// rgba colour, kept free of any graphics library so the simulation core builds headless
+struct Color
 {
-private:
-    Vec2 m_position_last;
-    Vec2 m_acceleration;
+    uint8_t r = 255;
+    uint8_t g = 255;
+    uint8_t b = 255;
+    uint8_t a = 255;
+};
+
+
+// structure of arrays particle storage, every attribute lives in its own contiguous array
+// so the hot loops only stream the fields they actually use
+struct ParticleStore
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> last_x;
+    std::vector<float> last_y;
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> radius;
+
+    std::vector<Color> color;
+
+    // 1 while the particle sleeps: it isn't integrated and isn't collided with other sleepers
+    std::vector<uint8_t> asleep;
+
+    // simulated second the particle is removed at, infinity while it lives on
+    std::vector<float> expires;
+
+    // stable id of the particle in each slot, and the slot of each id.
+    // slots get reordered for cache locality, ids never change
+    std::vector<uint32_t> id;
+
+    // by id. the ids of removed particles point at no_slot and wait in free_ids to be handed out again, their
+    // generation goes up by one so handles to the removed particle can tell
+    std::vector<uint32_t> slot_of_id;
+    std::vector<uint32_t> generation;
+    std::vector<uint32_t> free_ids;
+
+    static constexpr uint32_t no_slot = UINT32_MAX;
+
+    // at the end of the arrays, with a free id if there is one
+    uint32_t add(const Vec2& p_position, float p_radius);
+
+    uint32_t slot(uint32_t p_id) const { return slot_of_id[p_id]; }
+
+    // ids handed out so far, the live ones and the free ones. arrays by id need this many entries
+    std::size_t idCount() const { return slot_of_id.size(); }
+
+    bool alive(uint32_t p_id, uint32_t p_generation) const
+    {
+        return p_id < generation.size() && generation[p_id] == p_generation && slot_of_id[p_id] != no_slot;
+    }
+
+    // moves the particle in slot order[k] to slot k, for every k
+    void reorder(const std::vector<uint32_t>& order);
+
+    // drops every particle whose flag is set, the others keep their order and their ids
+    void removeFlagged(const std::vector<uint8_t>& remove);
+
+    // drops one particle by moving the last one into its slot
+    void removeSwap(uint32_t slot);
+
+    // ids equal to slots again and nothing free, for arrays that were filled in from elsewhere
+    void resetIds();
+
+    // recomputes slot_of_id from id, false if id isn't a permutation of [0, size). nothing is free afterwards
+    bool rebuildSlots();
+
+    // the id of every slot renumbered into [0, size) in the same order, for saving without the free ids
+    void packedIds(std::vector<uint32_t>& packed) const;
+
+    void reserve(std::size_t count);
 
-    float m_mass;
-   
-    sf::Color m_color;
+    void clear();
+
+    std::size_t size() const { return x.size(); }
+
+    Vec2 getPosition(uint32_t i) const { return {x[i], y[i]}; }
+
+    void setPosition(uint32_t i, const Vec2& p_position) { x[i] = p_position.x; y[i] = p_position.y; }
+
+    Vec2 getVelocity(uint32_t i) const { return {x[i] - last_x[i], y[i] - last_y[i]}; }
+
+    // unit density by area, the contact solver weighs particles the same way
+    float getMass(uint32_t i) const { return radius[i] * radius[i]; }
+
+    void setVelocity(uint32_t i, const Vec2& p_velocity, float dt);
+
+    void addVelocity(uint32_t i, const Vec2& p_velocity, float dt);
+
+    void accelerate(uint32_t i, const Vec2& p_acceleration);
+};
+
+
+// lightweight reference to one particle in a store, cheap to copy around.
+// holds the particle's id, so it stays valid when the store reorders its slots, and the id's generation, so it
+// knows once the particle was removed. on a removed particle the setters do nothing and the getters return zeros,
+// index() is no_slot
+class ParticleHandle
+{
+private:
+    ParticleStore* m_store = nullptr;
+    uint32_t m_id = 0;
+    uint32_t m_generation = 0;
 
 public:
+    ParticleHandle() = default;
+    ParticleHandle(ParticleStore* p_store, uint32_t p_id) : m_store{p_store}, m_id{p_id}, m_generation{p_store->generation[p_id]} {}
 
-    Vec2 m_position; //displacement vector
-    float m_radius = 1.0f;
+    uint32_t id() const { return m_id; }
 
-    Particle();
-    Particle(const Vec2& p_position, float p_radius);
+    uint32_t generation() const { return m_generation; }
 
-    void accelerate(const Vec2& p_acceleration);
+    // false once the particle was removed, even if its id went to a new one since
+    bool valid() const { return m_store && m_store->alive(m_id, m_generation); }
 
-    void setVelocity(const Vec2& p_velocity, float dt);
+    // current slot in the store's arrays, no_slot once the particle was removed
+    uint32_t index() const { return valid() ? m_store->slot(m_id) : ParticleStore::no_slot; }
 
-    void addVelocity(const Vec2& p_velocity, float dt);
+    Vec2 getPosition() const;
 
-    Vec2 getVelocity();
+    void setPosition(const Vec2& p_position);
 
-    void update(float dt);
+    float getRadius() const;
 
-    void setColor(sf::Color color);
+    void accelerate(const Vec2& p_acceleration);
+
+    void setVelocity(const Vec2& p_velocity, float dt);
+
+    void addVelocity(const Vec2& p_velocity, float dt);
 
-    sf::Color getColor() const;
+    Vec2 getVelocity() const;
 
+    void setColor(Color color);
 
+    Color getColor() const;
 };
 
 
-#endif 
\ No newline at end of file
+#endif 
@@ -0,0 +1,213 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+namespace
+{
+    struct Span
+    {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    // written only by its own thread. head counts every span ever pushed, the writer publishes
+    // with a release store so a reader that acquires head sees complete spans below it
+    struct ThreadBuffer
+    {
+        std::array<Span, profiler::ring_capacity> spans;
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0}; // spans below this were reset away
+        uint32_t id = 0;
+        std::string name;
+    };
+
+    std::mutex g_registry_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> g_buffers; // never shrinks, so buffers outlive their threads
+
+    std::atomic<bool> g_enabled{true};
+
+    thread_local ThreadBuffer* t_buffer = nullptr;
+
+    const auto g_epoch = std::chrono::steady_clock::now();
+
+    ThreadBuffer& localBuffer()
+    {
+        if (!t_buffer)
+        {
+            auto buffer = std::make_unique<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(g_registry_mutex);
+            buffer->id = static_cast<uint32_t>(g_buffers.size());
+            buffer->name = "thread " + std::to_string(buffer->id);
+            t_buffer = buffer.get();
+            g_buffers.push_back(std::move(buffer));
+        }
+        return *t_buffer;
+    }
+
+    // the recorded part of a buffer, oldest first
+    template <typename Fn>
+    void forEachSpan(const ThreadBuffer& buffer, Fn&& fn)
+    {
+        const uint64_t head = buffer.head.load(std::memory_order_acquire);
+        const uint64_t tail = std::max(buffer.tail.load(std::memory_order_relaxed),
+                                       head > profiler::ring_capacity ? head - profiler::ring_capacity : 0);
+        for (uint64_t k = tail; k < head; k++)
+        {
+            fn(buffer.spans[k % profiler::ring_capacity]);
+        }
+    }
+
+    void writeEscaped(std::ostream& out, const char* text)
+    {
+        for (; *text; text++)
+        {
+            if (*text == '"' || *text == '\\') out << '\\';
+            out << *text;
+        }
+    }
+}
+
+namespace profiler
+{
+    uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+    }
+
+    void setEnabled(bool enabled)
+    {
+        g_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isEnabled()
+    {
+        return g_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setThreadName(const std::string& name)
+    {
+        ThreadBuffer& buffer = localBuffer();
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+        buffer.name = name;
+    }
+
+    Scope::Scope(const char* name)
+        : m_name(g_enabled.load(std::memory_order_relaxed) ? name : nullptr), m_start(m_name ? now() : 0)
+    {
+    }
+
+    Scope::~Scope()
+    {
+        if (!m_name) return;
+
+        const uint64_t end = now();
+        ThreadBuffer& buffer = localBuffer();
+        const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        buffer.spans[head % ring_capacity] = Span{m_name, m_start, end};
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    std::vector<PhaseStats> getPhaseStats()
+    {
+        // keyed by text, the same literal can have different addresses in different translation units
+        std::map<std::string, std::vector<double>> durations;
+        {
+            std::lock_guard<std::mutex> lock(g_registry_mutex);
+            for (const auto& buffer : g_buffers)
+            {
+                forEachSpan(*buffer, [&](const Span& span) {
+                    durations[span.name].push_back((span.end - span.start) * 1e-6);
+                });
+            }
+        }
+
+        std::vector<PhaseStats> stats;
+        stats.reserve(durations.size());
+        for (auto& [name, ms] : durations)
+        {
+            std::sort(ms.begin(), ms.end());
+
+            PhaseStats phase;
+            phase.name = name;
+            phase.samples = static_cast<uint32_t>(ms.size());
+            phase.min_ms = ms.front();
+            phase.median_ms = ms[ms.size() / 2];
+            phase.p99_ms = ms[std::min(ms.size() - 1, ms.size() * 99 / 100)];
+            phase.max_ms = ms.back();
+            for (double d : ms) phase.total_ms += d;
+            stats.push_back(phase);
+        }
+
+        // biggest cost first
+        std::sort(stats.begin(), stats.end(), [](const PhaseStats& a, const PhaseStats& b) { return a.total_ms > b.total_ms; });
+        return stats;
+    }
+
+    void printPhaseStats(std::ostream& out)
+    {
+        char line[160];
+        std::snprintf(line, sizeof(line), "  %-28s %8s %9s %9s %9s %9s\n", "phase", "samples", "min ms", "median", "p99", "max");
+        out << line;
+        for (const PhaseStats& phase : getPhaseStats())
+        {
+            std::snprintf(line, sizeof(line), "  %-28s %8u %9.3f %9.3f %9.3f %9.3f\n", phase.name.c_str(), phase.samples,
+                          phase.min_ms, phase.median_ms, phase.p99_ms, phase.max_ms);
+            out << line;
+        }
+    }
+
+    bool writeChromeTrace(const std::string& path)
+    {
+        std::ofstream file(path);
+        if (!file) return false;
+
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        auto separator = [&] {
+            if (!first) file << ",\n";
+            first = false;
+        };
+
+        char numbers[96];
+        for (const auto& buffer : g_buffers)
+        {
+            separator();
+            file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id << ", \"args\": {\"name\": \"";
+            writeEscaped(file, buffer->name.c_str());
+            file << "\"}}";
+
+            forEachSpan(*buffer, [&](const Span& span) {
+                separator();
+                file << "{\"name\": \"";
+                writeEscaped(file, span.name);
+                // microseconds with fractions, so sub microsecond spans don't collapse to zero
+                std::snprintf(numbers, sizeof(numbers), "\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, ",
+                              span.start * 1e-3, (span.end - span.start) * 1e-3);
+                file << numbers << "\"pid\": 1, \"tid\": " << buffer->id << "}";
+            });
+        }
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+        for (const auto& buffer : g_buffers)
+        {
+            buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// scoped timers that record spans into one ring buffer per thread.
+// PROFILE_SCOPE compiles to nothing unless PARTICLESIM_PROFILE is defined,
+// the functions below always exist so callers don't need their own #ifdefs
+namespace profiler
+{
+    // spans kept per thread, older ones are overwritten
+    constexpr uint32_t ring_capacity = 1u << 15;
+
+    constexpr bool compiled_in =
+#ifdef PARTICLESIM_PROFILE
+        true;
+#else
+        false;
+#endif
+
+    // nanoseconds on a monotonic clock since the first call
+    uint64_t now();
+
+    // runtime switch on top of the compile time one, spans started while disabled are dropped
+    void setEnabled(bool enabled);
+
+    bool isEnabled();
+
+    // name shown for the calling thread in traces, must be called from that thread
+    void setThreadName(const std::string& name);
+
+    // name has to outlive the profiler, in practice a string literal
+    class Scope
+    {
+    private:
+        const char* m_name;
+        uint64_t m_start;
+
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // duration statistics of one span name over what is still in the ring buffers
+    struct PhaseStats
+    {
+        std::string name;
+        uint32_t samples = 0;
+        double min_ms = 0.0;
+        double median_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+        double total_ms = 0.0;
+    };
+
+    // the buffers are read without locking the writers, so call these between frames
+    // while no other thread is recording
+    std::vector<PhaseStats> getPhaseStats();
+
+    void printPhaseStats(std::ostream& out);
+
+    // chrome://tracing / ui.perfetto.dev "X" events, one track per thread
+    bool writeChromeTrace(const std::string& path);
+
+    // forget every recorded span
+    void reset();
+}
+
+#ifdef PARTICLESIM_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ::profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+#endif
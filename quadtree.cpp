@@ -1,279 +1,867 @@
 #include "quadtree.hpp"
-
-std::unique_ptr<Node> root = nullptr;
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 
 constexpr float EPS = 1e-6f;
 
+namespace
+{
+	// nodes this many levels below the root don't split any further, in every build and in incremental updates.
+	// a depth first walk then holds at most 3 siblings per level plus 4 children, which fits the traversal stacks
+	constexpr int max_depth = 31;
+	constexpr int traversal_stack_size = 128;
+	static_assert(3 * max_depth + 4 <= traversal_stack_size, "traversal stack too small for max_depth");
+
+	// halving is exact, so the nodes max_depth levels down are exactly this small
+	bool canSplit(const Node& node, const Node& root)
+	{
+		return node.count > MAX_PARTICLES && node.half_W > 4.0f && node.half_H > 4.0f &&
+			   node.half_W > std::ldexp(root.half_W, -max_depth) && node.half_H > std::ldexp(root.half_H, -max_depth);
+	}
+}
+
 
-void initialize_root()
+void Quadtree::clear()
 {
-	root = std::make_unique<Node>(WIDTH/2, HEIGHT/2, WIDTH/2, HEIGHT/2);
+	m_nodes.clear();
+	m_indices.clear();
+	m_free_blocks.clear();
+	m_incremental = false;
 }
 
-void insert(Particle* p, Node* n)
+void Quadtree::build(const ParticleStore& store, float x, float y, float half_W, float half_H)
 {
+	if (m_pool)
+	{
+		buildSorted(store, x, y, half_W, half_H, *m_pool);
+		return;
+	}
 
-    // Safety: if particle is outside this node, don't insert
-    if (p->m_position.x < n->x - n->half_W || p->m_position.x > n->x + n->half_W ||
-        p->m_position.y < n->y - n->half_H || p->m_position.y > n->y + n->half_H)
-    {
-        return;  // particle outside bounds, skip
-    }
-
-	// if the node has children, place particles in correct children
-	if (n->children[0] != nullptr)
-	{
-		
-        int index = getChildIndex(p, n);
-        insert(p, n->children[index].get());
-        return;
-    }
-  
-    //place if no children
-    n->particles.push_back(p);
-
-    if (n->particles.size() > MAX_PARTICLES && n->half_W > 4.0f && n->half_H > 4.0f)
-    {
-        subdivide(n);
-        std::vector<Particle*> copy = n->particles;
-        n->particles.clear();
-
-        for (auto& childParticle : copy)
-        {		
-            int index = getChildIndex(childParticle, n);
-            insert(childParticle, n->children[index].get());
-        }
-    }
-	
+	m_indices.clear();
 
+	const uint32_t count = static_cast<uint32_t>(store.size());
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// Safety: if particle is outside the root, don't insert
+		if (store.x[i] < x - half_W || store.x[i] > x + half_W ||
+			store.y[i] < y - half_H || store.y[i] > y + half_H)
+		{
+			continue;
+		}
+		m_indices.push_back(i);
+	}
+	buildNodes(store, x, y, half_W, half_H);
 }
 
-int getChildIndex(const Particle* p, const Node* n)
+void Quadtree::build(const ParticleStore& store, const std::vector<uint32_t>& particles, float x, float y, float half_W, float half_H)
 {
-	
-	int index = 0;
+	m_indices.clear();
+
+	for (uint32_t i : particles)
+	{
+		if (store.x[i] < x - half_W || store.x[i] > x + half_W ||
+			store.y[i] < y - half_H || store.y[i] > y + half_H)
+		{
+			continue;
+		}
+		m_indices.push_back(i);
+	}
+	buildNodes(store, x, y, half_W, half_H);
+}
 
-	if (p->m_position.x >= n->x - EPS) index += 1;
-	if (p->m_position.y >= n->y - EPS) index += 2;
+void Quadtree::buildNodes(const ParticleStore& store, float x, float y, float half_W, float half_H)
+{
+	m_nodes.clear();
+	m_free_blocks.clear();
+	m_incremental = false;
+
+	m_scratch.resize(m_indices.size());
+	m_quadrant.resize(m_indices.size());
+
+	Node root_node;
+	root_node.x = x;
+	root_node.y = y;
+	root_node.half_W = half_W;
+	root_node.half_H = half_H;
+	root_node.first = 0;
+	root_node.count = static_cast<uint32_t>(m_indices.size());
+	root_node.parent = no_node;
+	m_nodes.push_back(root_node);
+
+	// children are appended behind their parent, so walking the array in order visits every node once
+	for (uint32_t n = 0; n < m_nodes.size(); n++)
+	{
+		const Node& node = m_nodes[n];
+		if (canSplit(node, m_nodes[0]))
+		{
+			subdivide(store, n);
+		}
+	}
 
-	return index;
+	// children always come after their parent, so a backwards pass sees them first
+	for (uint32_t n = static_cast<uint32_t>(m_nodes.size()); n-- > 0;)
+	{
+		setMaxRadius(store, n);
+	}
 }
 
+void Quadtree::setMaxRadius(const ParticleStore& store, uint32_t n)
+{
+	Node& node = m_nodes[n];
+	float max_radius = 0.0f;
+	if (node.isLeaf())
+	{
+		for (uint32_t k = node.first; k < node.first + node.count; k++)
+		{
+			max_radius = std::max(max_radius, store.radius[m_indices[k]]);
+		}
+	}
+	else
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			max_radius = std::max(max_radius, m_nodes[node.children + c].max_radius);
+		}
+	}
+	node.max_radius = max_radius;
+}
 
-void subdivide(Node* n)
+void Quadtree::subdivide(const ParticleStore& store, uint32_t n)
 {
-	float hw = n->half_W / 2.0f;
-    float hh = n ->half_H / 2.0f;
-    // top left
-    n->children[0] = std::make_unique<Node>(n->x - hw, n->y - hh, hw, hh); // - -
+	const uint32_t first = m_nodes[n].first;
+	const uint32_t count = m_nodes[n].count;
+
+	// counting sort of the node's particles into the four quadrants
+	uint32_t quadrant_count[4] = {0, 0, 0, 0};
+	for (uint32_t k = first; k < first + count; k++)
+	{
+		const uint32_t p = m_indices[k];
+		const int index = getChildIndex(store.x[p], store.y[p], &m_nodes[n]);
+		m_quadrant[k] = static_cast<uint8_t>(index);
+		quadrant_count[index]++;
+	}
+
+	uint32_t offset[4];
+	offset[0] = first;
+	for (int q = 1; q < 4; q++)
+	{
+		offset[q] = offset[q - 1] + quadrant_count[q - 1];
+	}
 
-    // top right
-    n->children[1] = std::make_unique<Node>(n->x + hw, n->y - hh, hw, hh); // + -
+	uint32_t cursor[4] = {offset[0], offset[1], offset[2], offset[3]};
+	for (uint32_t k = first; k < first + count; k++)
+	{
+		m_scratch[cursor[m_quadrant[k]]++] = m_indices[k];
+	}
+	std::copy(m_scratch.begin() + first, m_scratch.begin() + first + count, m_indices.begin() + first);
 
-    // bottom left
-    n->children[2] = std::make_unique<Node>(n->x - hw, n->y + hh, hw, hh); // - + 
+	const uint32_t children = static_cast<uint32_t>(m_nodes.size());
 
-    // bottom right
-    n->children[3] = std::make_unique<Node>(n->x + hw, n->y + hh, hw, hh); // + +
+	// m_nodes may reallocate below, copy what we need first
+	const float x = m_nodes[n].x;
+	const float y = m_nodes[n].y;
+	const float hw = m_nodes[n].half_W / 2.0f;
+	const float hh = m_nodes[n].half_H / 2.0f;
 
-	
+	const float child_x[4] = {x - hw, x + hw, x - hw, x + hw}; // - - / + - / - + / + +
+	const float child_y[4] = {y - hh, y - hh, y + hh, y + hh};
+
+	for (int q = 0; q < 4; q++)
+	{
+		Node child;
+		child.x = child_x[q];
+		child.y = child_y[q];
+		child.half_W = hw;
+		child.half_H = hh;
+		child.first = offset[q];
+		child.count = quadrant_count[q];
+		child.parent = n;
+		m_nodes.push_back(child);
+	}
+
+	m_nodes[n].children = children;
 }
 
-void clearParticles(Node* n)
+namespace
 {
-    if (!n) return;
-    n->particles.clear();
-    for (auto& child : n->children)
-    {
-        if (child) clearParticles(child.get());
-    }
+	// spare slots a leaf gets on top of what it holds, so a few arrivals don't relocate it
+	uint32_t leafSlack(uint32_t count)
+	{
+		return std::max(2u, count / 2);
+	}
+
 }
 
+void Quadtree::buildSorted(const ParticleStore& store, float x, float y, float half_W, float half_H, ThreadPool& pool)
+{
+	m_nodes.clear();
+	m_free_blocks.clear();
+	m_incremental = false;
+
+	// levels that can still be split, by the same half size test as buildNodes. halving is exact, so these are
+	// the half sizes subdivide gives the nodes of every level
+	uint32_t depth = 0;
+	float level_half_W[max_depth + 1];
+	float level_half_H[max_depth + 1];
+	level_half_W[0] = half_W;
+	level_half_H[0] = half_H;
+	while (depth < max_depth && level_half_W[depth] > 4.0f && level_half_H[depth] > 4.0f)
+	{
+		level_half_W[depth + 1] = level_half_W[depth] / 2.0f;
+		level_half_H[depth + 1] = level_half_H[depth] / 2.0f;
+		depth++;
+	}
 
+	// particles outside the root get a key past every real one, they are cut off after the sort
+	const uint64_t outside = uint64_t(1) << (2 * depth);
+	const uint32_t count = static_cast<uint32_t>(store.size());
+	m_keys.resize(count);
+	m_indices.resize(count);
+	pool.parallelFor(count, 4096, [&](uint32_t begin, uint32_t end)
+	{
+		const float* px = store.x.data();
+		const float* py = store.y.data();
+		uint64_t* keys = m_keys.data();
+
+		// getChildIndex and the child centres of subdivide, float for float, so a particle on a split line goes
+		// where build() puts it. level by level over blocks of particles, so the inner loop vectorizes
+		constexpr uint32_t block = 256;
+		float cx[block];
+		float cy[block];
+		for (uint32_t block_begin = begin; block_begin < end; block_begin += block)
+		{
+			const uint32_t block_count = std::min(block, end - block_begin);
+			uint64_t* block_keys = keys + block_begin;
+			for (uint32_t j = 0; j < block_count; j++)
+			{
+				cx[j] = x;
+				cy[j] = y;
+				block_keys[j] = 0;
+				m_indices[block_begin + j] = block_begin + j;
+			}
+			for (uint32_t level = 0; level < depth; level++)
+			{
+				const float hw = level_half_W[level + 1];
+				const float hh = level_half_H[level + 1];
+				for (uint32_t j = 0; j < block_count; j++)
+				{
+					const bool qx = px[block_begin + j] >= cx[j] - EPS;
+					const bool qy = py[block_begin + j] >= cy[j] - EPS;
+					block_keys[j] = block_keys[j] << 2 | uint64_t(qx) | uint64_t(qy) << 1;
+					cx[j] += qx ? hw : -hw;
+					cy[j] += qy ? hh : -hh;
+				}
+			}
+			for (uint32_t j = 0; j < block_count; j++)
+			{
+				const uint32_t i = block_begin + j;
+				if (px[i] < x - half_W || px[i] > x + half_W || py[i] < y - half_H || py[i] > y + half_H)
+				{
+					block_keys[j] = outside;
+				}
+			}
+		}
+	});
+
+	// a leaf's particles end up in curve order rather than the slot order build() leaves them in
+	m_sorter.sort(m_keys, m_indices, 2 * depth + 1, pool);
+	const uint32_t inside = static_cast<uint32_t>(std::lower_bound(m_keys.begin(), m_keys.end(), outside) - m_keys.begin());
+	m_keys.resize(inside);
+	m_indices.resize(inside);
+	m_scratch.resize(inside);
+	m_quadrant.resize(inside);
+
+	Node root_node;
+	root_node.x = x;
+	root_node.y = y;
+	root_node.half_W = half_W;
+	root_node.half_H = half_H;
+	root_node.first = 0;
+	root_node.count = inside;
+	root_node.parent = no_node;
+	m_nodes.push_back(root_node);
+
+	// one depth at a time, which also lays the nodes out in the order build() appends them in
+	m_level_first.assign({0, 1});
+	for (uint32_t level = 0; level < depth; level++)
+	{
+		const uint32_t first = m_level_first[level];
+		const uint32_t last = m_level_first[level + 1];
 
-void clear(Node* n)
-{
+		uint32_t next = last;
+		for (uint32_t n = first; n < last; n++)
+		{
+			if (!canSplit(m_nodes[n], m_nodes[0])) continue;
+
+			m_nodes[n].children = next;
+			next += 4;
+		}
+		if (next == last) break;
 
-	if (!n) return;
+		m_nodes.resize(next);
+		m_level_first.push_back(next);
 
+		// the node's keys are sorted, so they are sorted by this level's digit too
+		const uint32_t shift = 2 * (depth - 1 - level);
+		auto digitBelow = [shift](uint64_t key, uint64_t q) { return ((key >> shift) & 3) < q; };
+		const uint64_t* keys = m_keys.data();
 
-	for (auto& child : n->children)
-	{	
-		if (child)
+		pool.parallelFor(last - first, 256, [&](uint32_t begin, uint32_t end)
 		{
-			clear(child.get());
-			child.reset();
-		}
+			for (uint32_t n = first + begin; n < first + end; n++)
+			{
+				const Node& node = m_nodes[n];
+				if (node.isLeaf()) continue;
+
+				uint32_t offset[5];
+				offset[0] = node.first;
+				offset[4] = node.first + node.count;
+				for (uint32_t q = 1; q < 4; q++)
+				{
+					offset[q] = static_cast<uint32_t>(std::lower_bound(keys + offset[q - 1], keys + offset[4], q, digitBelow) - keys);
+				}
+
+				const float hw = node.half_W / 2.0f;
+				const float hh = node.half_H / 2.0f;
+				const float child_x[4] = {node.x - hw, node.x + hw, node.x - hw, node.x + hw};
+				const float child_y[4] = {node.y - hh, node.y - hh, node.y + hh, node.y + hh};
+				for (uint32_t q = 0; q < 4; q++)
+				{
+					Node& child = m_nodes[node.children + q];
+					child = Node();
+					child.x = child_x[q];
+					child.y = child_y[q];
+					child.half_W = hw;
+					child.half_H = hh;
+					child.first = offset[q];
+					child.count = offset[q + 1] - offset[q];
+					child.parent = n;
+				}
+			}
+		});
+	}
+
+	// the deepest level first, a level's nodes only read their own children
+	for (std::size_t level = m_level_first.size() - 1; level-- > 0;)
+	{
+		const uint32_t first = m_level_first[level];
+		const uint32_t last = m_level_first[level + 1];
+		pool.parallelFor(last - first, 1024, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t n = first + begin; n < first + end; n++)
+			{
+				setMaxRadius(store, n);
+			}
+		});
 	}
-	n->particles.clear();		
 }
 
-Node* query(Particle* p, Node* n)
+void Quadtree::update(const ParticleStore& store, float x, float y, float half_W, float half_H)
 {
-	 if (!n) return nullptr;
+	const uint32_t count = static_cast<uint32_t>(store.size());
+	const Node* root = m_nodes.empty() ? nullptr : &m_nodes[0];
+	const bool same_root = root && root->x == x && root->y == y && root->half_W == half_W && root->half_H == half_H;
 
-    if (p->m_position.x < n->x - n->half_W || p->m_position.x > n->x + n->half_W ||
-        p->m_position.y < n->y - n->half_H || p->m_position.y > n->y + n->half_H)
-    {
-        return nullptr;
-    }
+	auto rebuild = [&] {
+		build(store, x, y, half_W, half_H);
+		layoutLeaves(store);
+		m_last_moved = count;
+	};
 
-    if (n->children[0] != nullptr)
-    {
-        int idx = getChildIndex(p, n);
-        return query(p, n->children[idx].get());
-    }
+	if (!m_incremental || !same_root || count < m_tracked)
+	{
+		rebuild();
+		return;
+	}
+
+	// the only pass over every particle: a box test against the leaf it was in
+	m_moved.clear();
+	for (uint32_t p = 0; p < m_tracked; p++)
+	{
+		const uint32_t leaf = m_leaf_of[p];
+		if (leaf == no_node ? contains(m_nodes[0], store, p) : !contains(m_nodes[leaf], store, p))
+		{
+			m_moved.push_back(p);
+		}
+	}
+	m_leaf_of.resize(count, no_node);
+	for (uint32_t p = m_tracked; p < count; p++)
+	{
+		m_moved.push_back(p);
+	}
+
+	// past this point reinserting one by one loses to the counting sort build
+	if (m_moved.size() > count / 4)
+	{
+		rebuild();
+		return;
+	}
+
+	for (uint32_t p : m_moved)
+	{
+		if (m_leaf_of[p] != no_node) remove(p);
+	}
+	for (uint32_t p : m_moved)
+	{
+		if (contains(m_nodes[0], store, p)) insert(store, p);
+	}
+	m_tracked = count;
+	m_last_moved = static_cast<uint32_t>(m_moved.size());
 
-    return n;
+	// relocated leaves leave holes behind, squeeze them out once they make up half the buffer
+	if (m_garbage > m_indices.size() / 2)
+	{
+		layoutLeaves(store);
+	}
 }
 
-void queryRange(Particle* p, Node* n, std::vector<Particle*>& nodes)
+bool Quadtree::contains(const Node& node, const ParticleStore& store, uint32_t p) const
 {
-    if (!n) return;
-
-    float px = p->m_position.x;
-    float py = p->m_position.y;
-    float pr = 2 * p->m_radius;
-
-    // Node bounds
-    float left   = n->x - n->half_W;
-    float right  = n->x + n->half_W;
-    float top    = n->y - n->half_H;
-    float bottom = n->y + n->half_H;
-
-    // AABB overlap test: skip if particle circle doesn't overlap this node
-    if (px + pr < left  || px - pr > right ||
-        py + pr < top   || py - pr > bottom)
-    {
-        return;  // no overlap, prune this branch
-    }
-
-    
-
-
-    if (n->children[0] == nullptr)
-    {
-        for (auto& particle : n->particles)
-        {
-            nodes.push_back(particle);
-        }
-        //std::cout << nodes.size() << " Particles queried\n";
-    }
-    else
-    {
-        for (auto& child : n->children)
-        {
-            if (child)
-            {
-                  queryRange(p, child.get(), nodes);
-            }
-          
-        }
-    }
+	return store.x[p] >= node.x - node.half_W && store.x[p] <= node.x + node.half_W &&
+		   store.y[p] >= node.y - node.half_H && store.y[p] <= node.y + node.half_H;
 }
 
-void getAllCollisionPairs(Node* n, std::vector<std::pair<Particle*, Particle*>>& pairs)
+void Quadtree::layoutLeaves(const ParticleStore& store)
 {
-	if (!n) return;
-	
-	if (n->children[0] == nullptr)
+	const uint32_t count = static_cast<uint32_t>(store.size());
+	m_leaf_of.assign(count, no_node);
+	m_scratch.clear();
+
+	// depth first from the root, so unreachable (freed) nodes are skipped
+	uint32_t stack[traversal_stack_size];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
 	{
-		for (int i = 0; i < n->particles.size(); i++)
+		const uint32_t n = stack[--top];
+		Node& node = m_nodes[n];
+		if (!node.isLeaf())
 		{
-			for (int j = i + 1; j < n->particles.size(); j++)
+			assert(top + 4 <= traversal_stack_size);
+			for (uint32_t c = 0; c < 4; c++)
 			{
-				pairs.push_back({n->particles[i], n->particles[j]});
+				stack[top++] = node.children + c;
 			}
+			continue;
+		}
+
+		const uint32_t first = static_cast<uint32_t>(m_scratch.size());
+		for (uint32_t k = node.first; k < node.first + node.count; k++)
+		{
+			m_scratch.push_back(m_indices[k]);
+			m_leaf_of[m_indices[k]] = n;
+		}
+		node.first = first;
+		node.capacity = node.count + leafSlack(node.count);
+		m_scratch.resize(first + node.capacity);
+	}
+
+	m_indices.swap(m_scratch);
+	m_garbage = 0;
+	m_tracked = count;
+	m_incremental = true;
+}
+
+uint32_t Quadtree::allocateRange(uint32_t count, uint32_t& capacity)
+{
+	capacity = count + leafSlack(count);
+	const uint32_t first = static_cast<uint32_t>(m_indices.size());
+	m_indices.resize(first + capacity);
+	return first;
+}
+
+void Quadtree::insert(const ParticleStore& store, uint32_t p)
+{
+	const float radius = store.radius[p];
+
+	uint32_t n = 0;
+	for (;;)
+	{
+		Node& node = m_nodes[n];
+		node.count++;
+		node.max_radius = std::max(node.max_radius, radius);
+		if (node.isLeaf()) break;
+		n = node.children + getChildIndex(store.x[p], store.y[p], &node);
+	}
+
+	Node& leaf = m_nodes[n];
+	if (leaf.count > leaf.capacity)
+	{
+		// full, move the whole leaf behind everything else with room to grow
+		const uint32_t old_first = leaf.first;
+		m_garbage += leaf.capacity;
+		const uint32_t first = allocateRange(leaf.count, leaf.capacity);
+		std::copy(m_indices.begin() + old_first, m_indices.begin() + old_first + leaf.count - 1, m_indices.begin() + first);
+		leaf.first = first;
+	}
+	m_indices[leaf.first + leaf.count - 1] = p;
+	m_leaf_of[p] = n;
+
+	if (canSplit(leaf, m_nodes[0]))
+	{
+		split(store, n);
+	}
+}
+
+void Quadtree::remove(uint32_t p)
+{
+	const uint32_t n = m_leaf_of[p];
+	Node& leaf = m_nodes[n];
+
+	// swap with the last particle of the leaf, the order inside a leaf doesn't matter
+	const uint32_t last = leaf.first + leaf.count - 1;
+	for (uint32_t k = leaf.first; k <= last; k++)
+	{
+		if (m_indices[k] == p)
+		{
+			m_indices[k] = m_indices[last];
+			break;
 		}
-	
+	}
+	m_leaf_of[p] = no_node;
+
+	for (uint32_t a = n; a != no_node; a = m_nodes[a].parent)
+	{
+		m_nodes[a].count--;
+	}
+
+	mergeUpwards(leaf.parent);
+}
+
+void Quadtree::split(const ParticleStore& store, uint32_t n)
+{
+	uint32_t children;
+	if (!m_free_blocks.empty())
+	{
+		children = m_free_blocks.back();
+		m_free_blocks.pop_back();
 	}
 	else
 	{
-	
-		for (auto& child : n->children)
+		children = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.resize(m_nodes.size() + 4);
+	}
+
+	Node& node = m_nodes[n];
+	const float hw = node.half_W / 2.0f;
+	const float hh = node.half_H / 2.0f;
+	const float child_x[4] = {node.x - hw, node.x + hw, node.x - hw, node.x + hw};
+	const float child_y[4] = {node.y - hh, node.y - hh, node.y + hh, node.y + hh};
+
+	uint32_t quadrant_count[4] = {0, 0, 0, 0};
+	for (uint32_t k = node.first; k < node.first + node.count; k++)
+	{
+		const uint32_t p = m_indices[k];
+		quadrant_count[getChildIndex(store.x[p], store.y[p], &node)]++;
+	}
+
+	const uint32_t first = node.first;
+	const uint32_t count = node.count;
+	m_garbage += node.capacity;
+	node.children = children;
+	node.capacity = 0;
+
+	// ranges are allocated before filling, m_indices may reallocate while we do
+	for (uint32_t q = 0; q < 4; q++)
+	{
+		Node child;
+		child.x = child_x[q];
+		child.y = child_y[q];
+		child.half_W = hw;
+		child.half_H = hh;
+		child.parent = n;
+		child.first = allocateRange(quadrant_count[q], child.capacity);
+		m_nodes[children + q] = child;
+	}
+
+	for (uint32_t k = first; k < first + count; k++)
+	{
+		const uint32_t p = m_indices[k];
+		const uint32_t c = children + getChildIndex(store.x[p], store.y[p], &m_nodes[n]);
+		Node& child = m_nodes[c];
+		m_indices[child.first + child.count++] = p;
+		child.max_radius = std::max(child.max_radius, store.radius[p]);
+		m_leaf_of[p] = c;
+	}
+
+	// everything can land in the same quadrant
+	for (uint32_t q = 0; q < 4; q++)
+	{
+		if (canSplit(m_nodes[children + q], m_nodes[0]))
 		{
-			if (child)
-			{
-				getAllCollisionPairs(child.get(), pairs);
-			}
+			split(store, children + q);
+		}
+	}
+}
+
+void Quadtree::mergeUpwards(uint32_t n)
+{
+	for (; n != no_node; n = m_nodes[n].parent)
+	{
+		Node& node = m_nodes[n];
+		if (node.count >= MAX_PARTICLES) return; // the ancestors hold even more
+
+		const uint32_t children = node.children;
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			if (!m_nodes[children + c].isLeaf()) return;
 		}
-		
 
-		for (int i = 0; i < 4; i++)
+		const uint32_t first = allocateRange(node.count, node.capacity);
+		uint32_t k = first;
+		for (uint32_t c = 0; c < 4; c++)
 		{
-			if (!n->children[i]) continue;
-			
-			for (int j = i + 1; j < 4; j++)
+			const Node& child = m_nodes[children + c];
+			for (uint32_t i = child.first; i < child.first + child.count; i++)
 			{
-				if (!n->children[j]) continue;
-
-				std::vector<Particle*> particles_i;
-				std::vector<Particle*> particles_j;
-
-				getAllParticles(n->children[i].get(), particles_i);
-				getAllParticles(n->children[j].get(), particles_j);
-
-                for (auto* p1 : particles_i)
-                {
-                    for (auto* p2 : particles_j)
-                    {
-                        Vec2 v = p1->m_position - p2->m_position;
-                        float max_dist = (p1->m_radius + p2->m_radius) * 2.0f;
-                        if (v.x * v.x + v.y * v.y < max_dist * max_dist)
-                        {
-                            pairs.push_back({p1, p2});
-                        }
-                    }
-                }
-			
-			
+				m_leaf_of[m_indices[i]] = n;
+				m_indices[k++] = m_indices[i];
 			}
-		
+			m_garbage += child.capacity;
 		}
-	
+
+		Node& merged = m_nodes[n];
+		merged.first = first;
+		merged.children = 0;
+		m_free_blocks.push_back(children);
 	}
+}
+
+int getChildIndex(float px, float py, const Node* n)
+{
+
+	int index = 0;
 
+	if (px >= n->x - EPS) index += 1;
+	if (py >= n->y - EPS) index += 2;
 
+	return index;
+}
 
 
+const Node* Quadtree::query(float px, float py) const
+{
+	if (m_nodes.empty()) return nullptr;
+
+	const Node* n = &m_nodes[0];
+	if (px < n->x - n->half_W || px > n->x + n->half_W ||
+		py < n->y - n->half_H || py > n->y + n->half_H)
+	{
+		return nullptr;
+	}
 
+	while (!n->isLeaf())
+	{
+		n = &m_nodes[n->children + getChildIndex(px, py, n)];
+	}
+
+	return n;
 }
 
+const Node* Quadtree::query(const ParticleStore& store, uint32_t p) const
+{
+	return query(store.x[p], store.y[p]);
+}
 
+void Quadtree::queryRange(const ParticleStore& store, uint32_t p, std::vector<uint32_t>& nodes) const
+{
+	queryRange(store.x[p], store.y[p], store.radius[p], nodes);
+}
 
-void getAllParticles(Node* n, std::vector<Particle*>& particles)
+void Quadtree::queryRange(float px, float py, float pr, std::vector<uint32_t>& nodes) const
 {
-	if (!n) return;
+	if (m_nodes.empty()) return;
+
+	// explicit stack instead of recursion, the depth is capped at max_depth
+	uint32_t stack[traversal_stack_size];
+	int top = 0;
+	stack[top++] = 0;
 
-	if (n->children[0] == nullptr)
+	while (top > 0)
 	{
-		particles.insert(particles.end(), n->particles.begin(), n->particles.end());
+		const Node& n = m_nodes[stack[--top]];
+
+		// Node bounds, grown by the largest particle in it since those can stick out
+		float left   = n.x - n.half_W - n.max_radius;
+		float right  = n.x + n.half_W + n.max_radius;
+		float up     = n.y - n.half_H - n.max_radius;
+		float bottom = n.y + n.half_H + n.max_radius;
+
+		// AABB overlap test: skip if particle circle doesn't overlap what this node covers
+		if (px + pr < left || px - pr > right ||
+			py + pr < up   || py - pr > bottom)
+		{
+			continue;  // no overlap, prune this branch
+		}
+
+		if (n.isLeaf())
+		{
+			nodes.insert(nodes.end(), m_indices.begin() + n.first, m_indices.begin() + n.first + n.count);
+		}
+		else
+		{
+			assert(top + 4 <= traversal_stack_size);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				stack[top++] = n.children + c;
+			}
+		}
 	}
-	else
+}
+
+namespace
+{
+	inline void testPair(const ParticleStore& store, uint32_t p1, uint32_t p2, float margin,
+						 std::vector<std::pair<uint32_t, uint32_t>>& pairs)
 	{
-		
-			for (auto& child : n->children)
-			{
-                if (child)
-		        {
-				    getAllParticles(child.get(), particles);
-    			}
-		
+		const float dx = store.x[p1] - store.x[p2];
+		const float dy = store.y[p1] - store.y[p2];
+		const float max_dist = store.radius[p1] + store.radius[p2] + margin;
+		if (dx * dx + dy * dy < max_dist * max_dist)
+		{
+			if (p1 < p2) pairs.push_back({p1, p2});
+			else         pairs.push_back({p2, p1});
 		}
 	}
+}
+
+void Quadtree::getAllCollisionPairs(const ParticleStore& store, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+	if (m_nodes.empty()) return;
 
+	selfPairs(store, 0, margin, pairs);
 }
 
+void Quadtree::selfPairs(const ParticleStore& store, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+	const Node& node = m_nodes[n];
+	if (node.count < 2) return;
 
+	if (node.isLeaf())
+	{
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			for (uint32_t j = i + 1; j < node.first + node.count; j++)
+			{
+				testPair(store, m_indices[i], m_indices[j], margin, pairs);
+			}
+		}
+		return;
+	}
 
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		selfPairs(store, node.children + i, margin, pairs);
 
+		for (uint32_t j = i + 1; j < 4; j++)
+		{
+			crossPairs(store, node.children + i, node.children + j, margin, pairs);
+		}
+	}
+}
 
+void Quadtree::crossPairs(const ParticleStore& store, uint32_t a, uint32_t b, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+	const Node& node_a = m_nodes[a];
+	const Node& node_b = m_nodes[b];
+	if (node_a.count == 0 || node_b.count == 0) return;
 
+	// gap between the two boxes along each axis, the particles can only touch if it's below this reach
+	const float reach = node_a.max_radius + node_b.max_radius + margin;
+	const float gap_x = std::abs(node_a.x - node_b.x) - node_a.half_W - node_b.half_W;
+	const float gap_y = std::abs(node_a.y - node_b.y) - node_a.half_H - node_b.half_H;
+	if (gap_x >= reach || gap_y >= reach) return;
+
+	if (node_a.isLeaf() && node_b.isLeaf())
+	{
+		for (uint32_t i = node_a.first; i < node_a.first + node_a.count; i++)
+		{
+			for (uint32_t j = node_b.first; j < node_b.first + node_b.count; j++)
+			{
+				testPair(store, m_indices[i], m_indices[j], margin, pairs);
+			}
+		}
+		return;
+	}
 
+	// split the bigger node (or the only one that can be split)
+	const bool split_a = !node_a.isLeaf() && (node_b.isLeaf() || node_a.half_W >= node_b.half_W);
+	if (split_a)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			crossPairs(store, node_a.children + c, b, margin, pairs);
+		}
+	}
+	else
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			crossPairs(store, a, node_b.children + c, margin, pairs);
+		}
+	}
+}
 
+void Quadtree::getAllParticles(uint32_t n, std::vector<uint32_t>& particles) const
+{
+	if (n >= m_nodes.size()) return;
 
+	const Node& node = m_nodes[n];
+	if (node.isLeaf() || !m_incremental)
+	{
+		particles.insert(particles.end(), m_indices.begin() + node.first, m_indices.begin() + node.first + node.count);
+		return;
+	}
 
+	// subtree ranges are no longer contiguous after incremental updates
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		getAllParticles(node.children + c, particles);
+	}
+}
 
+void Quadtree::aggregateMass(const ParticleStore& store)
+{
+	m_mass.resize(m_nodes.size());
+	if (!m_nodes.empty())
+	{
+		aggregateMass(store, 0);
+	}
+}
 
+void Quadtree::aggregateMass(const ParticleStore& store, uint32_t n)
+{
+	const Node& node = m_nodes[n];
+	float mass = 0.0f;
+	float mx = 0.0f;
+	float my = 0.0f;
 
+	if (node.isLeaf())
+	{
+		for (uint32_t k = node.first; k < node.first + node.count; k++)
+		{
+			const uint32_t p = m_indices[k];
+			const float m = store.getMass(p);
+			mass += m;
+			mx += m * store.x[p];
+			my += m * store.y[p];
+		}
+	}
+	else
+	{
+		for (uint32_t c = node.children; c < node.children + 4; c++)
+		{
+			aggregateMass(store, c);
+			mass += m_mass[c].mass;
+			mx += m_mass[c].mass * m_mass[c].x;
+			my += m_mass[c].mass * m_mass[c].y;
+		}
+	}
 
+	// an empty node keeps its centre, nothing is attracted to it anyway
+	m_mass[n].mass = mass;
+	m_mass[n].x = mass > 0.0f ? mx / mass : node.x;
+	m_mass[n].y = mass > 0.0f ? my / mass : node.y;
+}
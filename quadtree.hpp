@@ -2,56 +2,179 @@
 #define QUADTREE_HPP
 
 #include "particle.hpp"
+#include "morton.hpp"
 #include <iostream>
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <utility>
 
 // keep dividing the quad tree if the particles in the region is greater than this
 constexpr int MAX_PARTICLES = 4;
 
-// screen size
-constexpr int HEIGHT = 800;
-constexpr int WIDTH = 800;
+constexpr uint32_t no_node = UINT32_MAX;
+
+class ThreadPool;
 
 
 struct Node
 {
-	std::vector<Particle*> particles;
-
 	float x{}; //center of the nodes
 	float y{};
 
 	float half_W{};
 	float half_H{};
 
-	std::array<std::unique_ptr<Node>, 4> children; // ORDER: top left, top right, bottom left, bottom right 
+	// index of the first of four consecutive children, 0 for a leaf (the root is never anyone's child)
+	// ORDER: top left, top right, bottom left, bottom right
+	uint32_t children{};
+
+	// particles of this subtree are indices[first, first + count), for a leaf that's exactly its own particles.
+	// once the tree has been updated incrementally only the leaf ranges are meaningful, count stays exact everywhere
+	uint32_t first{};
+	uint32_t count{};
 
+	float max_radius{}; // largest particle in the subtree, particles can stick out of the node by this much.
+	                    // only an upper bound after incremental updates
 
-	Node(float x, float y, float hw, float hh) : particles{}, x{x}, y{y}, half_W{hw}, half_H{hh}, children{} {};
-			
+	uint32_t parent{};   // no_node for the root
+	uint32_t capacity{}; // slots reserved for a leaf from first on, used by incremental updates
 
+	bool isLeaf() const { return children == 0; }
 };
 
-extern std::unique_ptr<Node> root;
 
-void initialize_root();
+// total mass of a node's subtree and its centre of mass, for long range forces
+struct MassAggregate
+{
+	float mass{};
+	float x{};
+	float y{};
+};
+
+
+// quadtree stored as one contiguous node array plus one shared index buffer.
+// both are reused between builds, so rebuilding a tree of the same size allocates nothing.
+//
+// with a thread pool set, full builds go through buildSorted() instead, which gives the same nodes.
+//
+// update() keeps the tree across frames instead: only particles that left their leaf are taken out and
+// inserted again from the root. leaves own a range of the index buffer with some spare slots and move to
+// the end of the buffer when it runs full, they split above MAX_PARTICLES and merge back below it
+class Quadtree
+{
+private:
+	std::vector<Node> m_nodes;       // m_nodes[0] is the root
+	std::vector<uint32_t> m_indices; // particle indices, grouped by leaf
+	std::vector<uint32_t> m_scratch;
+	std::vector<uint8_t> m_quadrant;
+	std::vector<MassAggregate> m_mass; // by node, filled in by aggregateMass
+
+	// sorted build state
+	ThreadPool* m_pool = nullptr;
+	RadixSorter m_sorter;
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_level_first; // first node of every depth, plus the node count at the end
+
+	// incremental state, only valid while m_incremental is set
+	bool m_incremental = false;
+	std::vector<uint32_t> m_leaf_of;     // leaf of every particle, no_node if it's outside the root
+	std::vector<uint32_t> m_free_blocks; // first node of every unused group of four siblings
+	std::vector<uint32_t> m_moved;
+	uint32_t m_tracked = 0; // particles the tree knows about
+	uint32_t m_last_moved = 0;
+	uint32_t m_garbage = 0; // index slots no leaf owns anymore
+
+	// builds the nodes over the particles already in m_indices
+	void buildNodes(const ParticleStore& store, float x, float y, float half_W, float half_H);
+
+	void subdivide(const ParticleStore& store, uint32_t n);
+
+	// largest radius in the subtree, the children have to be done already
+	void setMaxRadius(const ParticleStore& store, uint32_t n);
+
+	// copies every leaf into its own range with spare slots and records which leaf each particle is in
+	void layoutLeaves(const ParticleStore& store);
+
+	// reserves count slots at the end of the index buffer with room to grow, returns the first
+	uint32_t allocateRange(uint32_t count, uint32_t& capacity);
+
+	void insert(const ParticleStore& store, uint32_t p);
+
+	void remove(uint32_t p);
 
-void insert(Particle* p, Node* n);
+	void split(const ParticleStore& store, uint32_t n);
 
-void queryRange(Particle* p, Node* n, std::vector<Particle*>& nodes);
+	// merges n and its ancestors into leaves while they hold fewer than MAX_PARTICLES
+	void mergeUpwards(uint32_t n);
 
-int getChildIndex(const Particle* p, const Node* n);
+	bool contains(const Node& node, const ParticleStore& store, uint32_t p) const;
 
-void subdivide(Node* n);
+	void selfPairs(const ParticleStore& store, uint32_t n, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
 
-void clear(Node* n);
+	void crossPairs(const ParticleStore& store, uint32_t a, uint32_t b, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
 
-void clearParticles(Node* n);
+	void aggregateMass(const ParticleStore& store, uint32_t n);
 
-Node* query(Particle* p, Node* n);
+public:
+	// rebuilds the whole tree, particles outside the root bounds are skipped
+	void build(const ParticleStore& store, float x, float y, float half_W, float half_H);
 
-void getAllCollisionPairs(Node* n, std::vector<std::pair<Particle*, Particle*>>& pairs);
+	// same, over only the listed particles
+	void build(const ParticleStore& store, const std::vector<uint32_t>& particles, float x, float y, float half_W, float half_H);
+
+	// builds the same nodes as build() without splitting them one by one, only the order inside a leaf differs. every particle's key is the path of
+	// quadrants down to the deepest node that could exist, all computed in parallel. a radix sort on the keys then
+	// leaves every subtree in one range, and each depth's nodes find their children's ranges from the key digits,
+	// in parallel per depth. like every build it stops 31 levels below the root
+	void buildSorted(const ParticleStore& store, float x, float y, float half_W, float half_H, ThreadPool& pool);
+
+	// full builds of the whole store go through buildSorted on this pool, nullptr goes back to splitting node by node
+	void setThreadPool(ThreadPool* pool) { m_pool = pool; }
+
+	// brings the tree up to date by moving only the particles that left their leaf. falls back to a full build
+	// the first time, when particles were removed, or when so many moved that a rebuild is cheaper.
+	// call clear() first if the store was reordered
+	void update(const ParticleStore& store, float x, float y, float half_W, float half_H);
+
+	// particles moved by the last update(), the whole store after a full build
+	uint32_t getMovedCount() const { return m_last_moved; }
+
+	void clear();
+
+	bool empty() const { return m_nodes.empty(); }
+
+	const std::vector<Node>& getNodes() const { return m_nodes; }
+
+	const std::vector<uint32_t>& getIndices() const { return m_indices; }
+
+	const Node& getNode(uint32_t n) const { return m_nodes[n]; }
+
+	// leaf containing the point, nullptr if it's outside the tree
+	const Node* query(float px, float py) const;
+
+	const Node* query(const ParticleStore& store, uint32_t p) const;
+
+	// candidates touching particle p, big neighbours included
+	void queryRange(const ParticleStore& store, uint32_t p, std::vector<uint32_t>& nodes) const;
+
+	// collects the particles of every leaf whose particles may overlap the box of half size reach around (px, py)
+	void queryRange(float px, float py, float reach, std::vector<uint32_t>& nodes) const;
+
+	// appends every pair closer than r1 + r2 + margin exactly once, with first < second.
+	// a self join of the tree: pairs inside each leaf, plus a dual traversal of every two sibling subtrees
+	// that is pruned as soon as their bounds (grown by their largest radius) are too far apart
+	void getAllCollisionPairs(const ParticleStore& store, float margin, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+
+	// every particle in the subtree of node n
+	void getAllParticles(uint32_t n, std::vector<uint32_t>& particles) const;
+
+	// sums up the mass and centre of mass of every node, bottom up. only valid until the tree changes
+	void aggregateMass(const ParticleStore& store);
+
+	const MassAggregate& getMass(uint32_t n) const { return m_mass[n]; }
+};
 
-void getAllParticles(Node* n, std::vector<Particle*>& particles);
+int getChildIndex(float px, float py, const Node* n);
 
 #endif
@@ -0,0 +1,403 @@
+#include "recorder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    constexpr char trajectory_magic[8] = {'P', 'S', 'I', 'M', 'T', 'R', 'A', 'J'};
+    constexpr char footer_magic[8] = {'P', 'S', 'I', 'M', 'T', 'E', 'N', 'D'};
+
+    constexpr std::size_t header_size = 8 + 4 + 4 + 4 + 4;
+    constexpr std::size_t index_entry_size = 8 + 8 + 4;
+    constexpr std::size_t footer_size = 8 + 4 + 8;
+
+    // about +-16 million pixels at the default quantum, anything further out is clamped
+    constexpr float quantized_limit = 1e9f;
+
+    template <typename T>
+    void put(std::vector<uint8_t>& out, T value)
+    {
+        uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    T get(const uint8_t* in)
+    {
+        T value;
+        std::memcpy(&value, in, sizeof(T));
+        return value;
+    }
+
+    void putVarint(std::vector<uint8_t>& out, int32_t delta)
+    {
+        uint32_t zigzag = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+        while (zigzag >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(zigzag));
+    }
+
+    // returns false when the payload ends in the middle of a value
+    bool getVarint(const uint8_t*& in, const uint8_t* end, int32_t& delta)
+    {
+        uint32_t zigzag = 0;
+        for (int shift = 0; shift < 35; shift += 7)
+        {
+            if (in == end) return false;
+            const uint8_t byte = *in++;
+            zigzag |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // what both sides predict for coordinate i from data the decoder already has. with_last particles also
+    // exist in the previous frame and with_before also in the one before. wrapping arithmetic, so extreme
+    // values round trip exactly instead of overflowing
+    uint32_t reference(const std::vector<int32_t>& current, const std::vector<int32_t>& last, const std::vector<int32_t>& before,
+                       uint32_t i, uint32_t with_last, uint32_t with_before)
+    {
+        if (i < with_before) return 2u * static_cast<uint32_t>(last[i]) - static_cast<uint32_t>(before[i]);
+        if (i < with_last) return static_cast<uint32_t>(last[i]);
+        return i > 0 ? static_cast<uint32_t>(current[i - 1]) : 0u;
+    }
+
+    int32_t quantize(float value, float inverse_quantum)
+    {
+        const float q = value * inverse_quantum;
+        if (!(q > -quantized_limit)) return static_cast<int32_t>(-quantized_limit); // also catches nan
+        if (q > quantized_limit) return static_cast<int32_t>(quantized_limit);
+        return static_cast<int32_t>(std::lrint(q));
+    }
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    close();
+}
+
+bool TrajectoryRecorder::open(const std::string& path, std::string& error, float quantum, uint32_t chunk_frames,
+                              uint32_t capacity, bool drop_when_full)
+{
+    close();
+
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+
+    m_quantum = quantum > 0.0f ? quantum : 1.0f / 64.0f;
+    m_chunk_frames = std::max(chunk_frames, 1u);
+    m_capacity = std::max(capacity, 1u);
+    m_drop_when_full = drop_when_full;
+    m_closing = false;
+    m_failed = false;
+    m_dropped = 0;
+    m_frames_in_chunk = 0;
+    m_chunks.clear();
+    m_held_x.clear();
+    m_held_y.clear();
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), trajectory_magic, trajectory_magic + 8);
+    put(header, trajectory_version);
+    put(header, m_quantum);
+    put(header, m_chunk_frames);
+    put(header, uint32_t{0}); // reserved
+    m_file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+
+    m_writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+    return true;
+}
+
+void TrajectoryRecorder::record(const ParticleStore& store, uint64_t frame)
+{
+    if (!isOpen()) return;
+
+    TrajectoryFrame snapshot;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_queue.size() >= m_capacity)
+        {
+            if (m_drop_when_full)
+            {
+                m_dropped++;
+                return;
+            }
+            m_space.wait(lock, [&] { return m_queue.size() < m_capacity; });
+        }
+        if (!m_free.empty())
+        {
+            snapshot = std::move(m_free.back());
+            m_free.pop_back();
+        }
+    }
+
+    // the only per-frame cost on the simulation thread: a few array copies into recycled buffers.
+    // written in id order, so a particle keeps its place in the file when the solver reorders its slots
+    const std::size_t count = store.size();
+    m_held_x.resize(store.idCount(), 0.0f);
+    m_held_y.resize(store.idCount(), 0.0f);
+    for (std::size_t k = 0; k < count; k++)
+    {
+        m_held_x[store.id[k]] = store.x[k];
+        m_held_y[store.id[k]] = store.y[k];
+    }
+    snapshot.frame = frame;
+    snapshot.x.assign(m_held_x.begin(), m_held_x.end());
+    snapshot.y.assign(m_held_y.begin(), m_held_y.end());
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(snapshot));
+    }
+    m_ready.notify_one();
+}
+
+void TrajectoryRecorder::writerLoop()
+{
+    for (;;)
+    {
+        TrajectoryFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready.wait(lock, [&] { return m_closing || !m_queue.empty(); });
+            if (m_queue.empty()) return; // closing and drained
+
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        writeFrame(frame);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(std::move(frame));
+        }
+        m_space.notify_one();
+    }
+}
+
+void TrajectoryRecorder::writeFrame(const TrajectoryFrame& frame)
+{
+    const uint32_t position_in_chunk = m_frames_in_chunk;
+    if (position_in_chunk == 0)
+    {
+        m_chunks.push_back({frame.frame, static_cast<uint64_t>(m_file.tellp()), 0});
+    }
+
+    const uint32_t count = static_cast<uint32_t>(frame.x.size());
+    const uint32_t with_last = position_in_chunk >= 1 ? static_cast<uint32_t>(std::min<std::size_t>(m_last_x.size(), count)) : 0;
+    const uint32_t with_before = position_in_chunk >= 2 ? static_cast<uint32_t>(std::min<std::size_t>(m_before_x.size(), with_last)) : 0;
+    const float inverse_quantum = 1.0f / m_quantum;
+
+    m_q_x.resize(count);
+    m_q_y.resize(count);
+
+    m_payload.clear();
+    put(m_payload, frame.frame);
+    put(m_payload, count);
+    put(m_payload, uint32_t{0}); // payload size, patched below
+    const std::size_t body = m_payload.size();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_q_x[i] = quantize(frame.x[i], inverse_quantum);
+        m_q_y[i] = quantize(frame.y[i], inverse_quantum);
+
+        const uint32_t ref_x = reference(m_q_x, m_last_x, m_before_x, i, with_last, with_before);
+        const uint32_t ref_y = reference(m_q_y, m_last_y, m_before_y, i, with_last, with_before);
+        putVarint(m_payload, static_cast<int32_t>(static_cast<uint32_t>(m_q_x[i]) - ref_x));
+        putVarint(m_payload, static_cast<int32_t>(static_cast<uint32_t>(m_q_y[i]) - ref_y));
+    }
+
+    m_before_x.swap(m_last_x);
+    m_before_y.swap(m_last_y);
+    m_last_x.swap(m_q_x);
+    m_last_y.swap(m_q_y);
+
+    const uint32_t payload_size = static_cast<uint32_t>(m_payload.size() - body);
+    std::memcpy(m_payload.data() + body - sizeof(uint32_t), &payload_size, sizeof(uint32_t));
+    m_file.write(reinterpret_cast<const char*>(m_payload.data()), static_cast<std::streamsize>(m_payload.size()));
+    if (!m_file) m_failed = true;
+
+    m_chunks.back().frame_count++;
+    m_frames_in_chunk = (m_frames_in_chunk + 1) % m_chunk_frames;
+}
+
+void TrajectoryRecorder::finish()
+{
+    std::vector<uint8_t> tail;
+    const uint64_t index_offset = static_cast<uint64_t>(m_file.tellp());
+    for (const ChunkEntry& chunk : m_chunks)
+    {
+        put(tail, chunk.first_frame);
+        put(tail, chunk.offset);
+        put(tail, chunk.frame_count);
+    }
+    put(tail, index_offset);
+    put(tail, static_cast<uint32_t>(m_chunks.size()));
+    tail.insert(tail.end(), footer_magic, footer_magic + 8);
+
+    m_file.write(reinterpret_cast<const char*>(tail.data()), static_cast<std::streamsize>(tail.size()));
+    m_file.close();
+    if (m_file.fail()) m_failed = true;
+}
+
+bool TrajectoryRecorder::close()
+{
+    if (!isOpen()) return !m_failed;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_ready.notify_one();
+    m_writer.join();
+
+    finish();
+    return !m_failed;
+}
+
+
+bool TrajectoryReader::open(const std::string& path, std::string& error)
+{
+    m_file.close();
+    m_file.clear();
+    m_file.open(path, std::ios::binary);
+    m_chunks.clear();
+    m_chunk_start.clear();
+    m_next = UINT32_MAX;
+    if (!m_file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    uint8_t header[header_size];
+    m_file.read(reinterpret_cast<char*>(header), header_size);
+    if (!m_file || std::memcmp(header, trajectory_magic, 8) != 0)
+    {
+        error = path + " is not a trajectory";
+        return false;
+    }
+    if (get<uint32_t>(header + 8) != trajectory_version)
+    {
+        error = path + ": unsupported trajectory version";
+        return false;
+    }
+    m_quantum = get<float>(header + 12);
+
+    uint8_t footer[footer_size];
+    m_file.seekg(0, std::ios::end);
+    const uint64_t file_size = static_cast<uint64_t>(m_file.tellg());
+    m_file.seekg(static_cast<std::streamoff>(file_size - footer_size));
+    m_file.read(reinterpret_cast<char*>(footer), footer_size);
+    if (file_size < header_size + footer_size || !m_file || std::memcmp(footer + 12, footer_magic, 8) != 0)
+    {
+        error = path + " has no index, the recording was not closed";
+        return false;
+    }
+
+    const uint64_t index_offset = get<uint64_t>(footer);
+    const uint32_t chunk_count = get<uint32_t>(footer + 8);
+    if (index_offset + uint64_t{chunk_count} * index_entry_size + footer_size != file_size)
+    {
+        error = path + ": corrupt index";
+        return false;
+    }
+
+    std::vector<uint8_t> index(chunk_count * index_entry_size);
+    m_file.seekg(static_cast<std::streamoff>(index_offset));
+    m_file.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size()));
+
+    m_chunk_start.push_back(0);
+    for (uint32_t c = 0; c < chunk_count; c++)
+    {
+        const uint8_t* entry = index.data() + c * index_entry_size;
+        m_chunks.push_back({get<uint64_t>(entry), get<uint64_t>(entry + 8), get<uint32_t>(entry + 16)});
+        m_chunk_start.push_back(m_chunk_start.back() + m_chunks.back().frame_count);
+    }
+    return static_cast<bool>(m_file);
+}
+
+bool TrajectoryReader::decodeNext(TrajectoryFrame& frame, uint32_t position_in_chunk)
+{
+    uint8_t header[16];
+    m_file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!m_file) return false;
+
+    frame.frame = get<uint64_t>(header);
+    const uint32_t count = get<uint32_t>(header + 8);
+    const uint32_t payload_size = get<uint32_t>(header + 12);
+
+    m_payload.resize(payload_size);
+    m_file.read(reinterpret_cast<char*>(m_payload.data()), payload_size);
+    if (!m_file) return false;
+
+    // same bookkeeping as TrajectoryRecorder::writeFrame
+    const uint32_t with_last = position_in_chunk >= 1 ? static_cast<uint32_t>(std::min<std::size_t>(m_last_x.size(), count)) : 0;
+    const uint32_t with_before = position_in_chunk >= 2 ? static_cast<uint32_t>(std::min<std::size_t>(m_before_x.size(), with_last)) : 0;
+
+    m_x.resize(count);
+    m_y.resize(count);
+    frame.x.resize(count);
+    frame.y.resize(count);
+
+    const uint8_t* in = m_payload.data();
+    const uint8_t* end = in + payload_size;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int32_t dx, dy;
+        if (!getVarint(in, end, dx) || !getVarint(in, end, dy)) return false;
+
+        m_x[i] = static_cast<int32_t>(reference(m_x, m_last_x, m_before_x, i, with_last, with_before) + static_cast<uint32_t>(dx));
+        m_y[i] = static_cast<int32_t>(reference(m_y, m_last_y, m_before_y, i, with_last, with_before) + static_cast<uint32_t>(dy));
+        frame.x[i] = m_x[i] * m_quantum;
+        frame.y[i] = m_y[i] * m_quantum;
+    }
+
+    m_before_x.swap(m_last_x);
+    m_before_y.swap(m_last_y);
+    m_last_x.swap(m_x);
+    m_last_y.swap(m_y);
+    return true;
+}
+
+bool TrajectoryReader::readFrame(uint32_t index, TrajectoryFrame& frame)
+{
+    if (index >= getFrameCount()) return false;
+
+    // chunk holding the frame
+    const uint32_t c = static_cast<uint32_t>(std::upper_bound(m_chunk_start.begin(), m_chunk_start.end(), index) - m_chunk_start.begin()) - 1;
+
+    uint32_t position = m_next;
+    if (position > index || position < m_chunk_start[c])
+    {
+        m_file.clear();
+        m_file.seekg(static_cast<std::streamoff>(m_chunks[c].offset));
+        position = m_chunk_start[c];
+    }
+
+    for (; position <= index; position++)
+    {
+        if (!decodeNext(frame, position - m_chunk_start[c]))
+        {
+            m_next = UINT32_MAX;
+            return false;
+        }
+    }
+    m_next = position;
+    return true;
+}
@@ -0,0 +1,145 @@
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+
+#include "particle.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// trajectory file layout (little endian):
+//   header   "PSIMTRAJ", version, quantum, frames per chunk
+//   chunks   frames, each: frame number, particle count, payload size, payload
+//   index    one entry per chunk: first frame number, file offset, frame count
+//   footer   index offset, chunk count, "PSIMTEND"
+//
+// positions are quantized to multiples of the quantum. the first frame of every chunk stores each
+// coordinate as a delta to the previous particle, the second one as a delta to the same particle
+// in the frame before, and all later ones as the error of a constant velocity prediction from the
+// two frames before. deltas are zigzag + varint coded, so a resting or coasting particle costs two bytes
+constexpr uint32_t trajectory_version = 1;
+
+struct TrajectoryFrame
+{
+    uint64_t frame = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+};
+
+// takes snapshots on the simulation thread and encodes + writes them on a background thread
+class TrajectoryRecorder
+{
+private:
+    std::ofstream m_file;
+    std::thread m_writer;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;   // a snapshot was queued or we're closing
+    std::condition_variable m_space;   // the writer took one off the queue
+    std::deque<TrajectoryFrame> m_queue;
+    std::vector<TrajectoryFrame> m_free; // recycled snapshots, so recording doesn't allocate once warmed up
+    uint32_t m_capacity = 8;
+    bool m_drop_when_full = false;
+    bool m_closing = false;
+    bool m_failed = false;
+
+    uint64_t m_dropped = 0;
+
+    // the last recorded position by id, for the ids of removed particles
+    std::vector<float> m_held_x;
+    std::vector<float> m_held_y;
+
+    // writer thread state
+    float m_quantum = 1.0f / 64.0f;
+    uint32_t m_chunk_frames = 60;
+    uint32_t m_frames_in_chunk = 0;
+    std::vector<int32_t> m_last_x; // quantized previous frame
+    std::vector<int32_t> m_last_y;
+    std::vector<int32_t> m_before_x; // and the one before that
+    std::vector<int32_t> m_before_y;
+    std::vector<int32_t> m_q_x;
+    std::vector<int32_t> m_q_y;
+    std::vector<uint8_t> m_payload;
+    struct ChunkEntry
+    {
+        uint64_t first_frame;
+        uint64_t offset;
+        uint32_t frame_count;
+    };
+    std::vector<ChunkEntry> m_chunks;
+
+    void writerLoop();
+
+    void writeFrame(const TrajectoryFrame& frame);
+
+    void finish();
+
+public:
+    TrajectoryRecorder() = default;
+    ~TrajectoryRecorder();
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // quantum is the position resolution in pixels. chunk_frames is how far a seek may have to decode.
+    // capacity is the number of snapshots that can wait for the writer, when that is exceeded
+    // record() either waits or drops the frame
+    bool open(const std::string& path, std::string& error, float quantum = 1.0f / 64.0f, uint32_t chunk_frames = 60,
+              uint32_t capacity = 8, bool drop_when_full = false);
+
+    bool isOpen() const { return m_writer.joinable(); }
+
+    // copies the positions in particle id order, the expensive part happens on the writer thread. the id of a
+    // removed particle stays where it was removed until a new particle gets it
+    void record(const ParticleStore& store, uint64_t frame);
+
+    // drains the queue and writes the index, returns false if any write failed
+    bool close();
+
+    uint64_t getDroppedFrames() const { return m_dropped; }
+};
+
+// random access to a recorded trajectory
+class TrajectoryReader
+{
+private:
+    std::ifstream m_file;
+    float m_quantum = 1.0f;
+
+    struct ChunkEntry
+    {
+        uint64_t first_frame;
+        uint64_t offset;
+        uint32_t frame_count;
+    };
+    std::vector<ChunkEntry> m_chunks;
+    std::vector<uint32_t> m_chunk_start; // index of the first frame of every chunk, plus the total at the end
+
+    // decoder position, so reading frames in order never re-reads a chunk
+    uint32_t m_next = UINT32_MAX;
+    std::vector<int32_t> m_x;
+    std::vector<int32_t> m_y;
+    std::vector<int32_t> m_last_x;
+    std::vector<int32_t> m_last_y;
+    std::vector<int32_t> m_before_x;
+    std::vector<int32_t> m_before_y;
+    std::vector<uint8_t> m_payload;
+
+    bool decodeNext(TrajectoryFrame& frame, uint32_t position_in_chunk);
+
+public:
+    bool open(const std::string& path, std::string& error);
+
+    uint32_t getFrameCount() const { return m_chunk_start.empty() ? 0 : m_chunk_start.back(); }
+
+    float getQuantum() const { return m_quantum; }
+
+    // the index-th recorded frame, decoding from the start of its chunk unless it directly follows the last read
+    bool readFrame(uint32_t index, TrajectoryFrame& frame);
+};
+
+#endif
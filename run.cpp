@@ -0,0 +1,345 @@
+// headless batch runner: steps a scenario as fast as possible and reports throughput
+//
+//   particlesim_run scenario.txt [--frames N] [--threads N] [--deterministic] [--substeps N] [--adaptive] [--broadphase quadtree|grid|hashgrid|loose|chunked]
+//                                [--trace trace.json] [--load checkpoint] [--save checkpoint] [--record trajectory]
+//                                [--ranks N --rank R [--shm name | --hosts host0,host1,... --port P]]
+//
+// --deterministic keeps the thread pool but runs every loop on the main thread, in order
+//
+// --adaptive picks the substep count of every frame within the scenario's min_substeps and max_substeps, starting
+// from --substeps
+//
+// --load starts from a saved scene instead of an empty one, --save writes the scene after the last frame
+//
+// --ranks splits the world into that many slabs, one process each, see domain.hpp. every rank is started with the
+// same arguments apart from --rank. they talk over shared memory named after --shm (default particlesim), or over
+// tcp with --hosts, one host per rank, where rank r listens on --port + r. --hosts isn't there on windows
+//
+// --trace and the per-phase table need a PARTICLESIM_PROFILE build
+
+#include "checkpoint.hpp"
+#include "domain.hpp"
+#include "profiler.hpp"
+#include "recorder.hpp"
+#include "scenario.hpp"
+#include "shm_transport.hpp"
+#include "simd_kernels.hpp"
+#ifndef _WIN32
+#include "socket_transport.hpp"
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    void printUsage()
+    {
+        std::printf("usage: particlesim_run <scenario> [--frames N] [--threads N] [--deterministic] [--substeps N] [--adaptive] [--broadphase quadtree|grid|hashgrid|loose|chunked] [--trace file]\n"
+                    "                       [--load checkpoint] [--save checkpoint] [--record trajectory]\n"
+                    "                       [--ranks N --rank R [--shm name | --hosts host0,host1,... --port P]]\n");
+    }
+
+#ifndef _WIN32
+    std::vector<std::string> splitHosts(const std::string& list)
+    {
+        std::vector<std::string> hosts;
+        std::size_t start = 0;
+        for (;;)
+        {
+            const std::size_t comma = list.find(',', start);
+            hosts.push_back(list.substr(start, comma - start));
+            if (comma == std::string::npos) return hosts;
+            start = comma + 1;
+        }
+    }
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    Scenario scenario;
+    std::string trace_path;
+    std::string load_path;
+    std::string save_path;
+    std::string record_path;
+    int rank_count = 1;
+    int rank = 0;
+    std::string shm_name = "particlesim";
+    std::string hosts;
+    uint16_t port = 47000;
+    std::string error;
+    if (!loadScenario(argv[1], scenario, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    // command line overrides for sweeps, their values are checked like the scenario's
+    for (int i = 2; i < argc; i++)
+    {
+        const bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (std::strcmp(argv[i], "--frames") == 0 && has_value)        ok = parseValue(argv[++i], scenario.frames);
+        else if (std::strcmp(argv[i], "--threads") == 0 && has_value)  ok = parseValue(argv[++i], scenario.threads);
+        else if (std::strcmp(argv[i], "--deterministic") == 0)          scenario.deterministic = true;
+        else if (std::strcmp(argv[i], "--substeps") == 0 && has_value) ok = parseValue(argv[++i], scenario.substeps);
+        else if (std::strcmp(argv[i], "--adaptive") == 0)               scenario.adaptive.enabled = true;
+        else if (std::strcmp(argv[i], "--trace") == 0 && has_value)    trace_path = argv[++i];
+        else if (std::strcmp(argv[i], "--load") == 0 && has_value)     load_path = argv[++i];
+        else if (std::strcmp(argv[i], "--save") == 0 && has_value)     save_path = argv[++i];
+        else if (std::strcmp(argv[i], "--record") == 0 && has_value)   record_path = argv[++i];
+        else if (std::strcmp(argv[i], "--ranks") == 0 && has_value)    ok = parseValue(argv[++i], rank_count);
+        else if (std::strcmp(argv[i], "--rank") == 0 && has_value)     ok = parseValue(argv[++i], rank);
+        else if (std::strcmp(argv[i], "--shm") == 0 && has_value)      shm_name = argv[++i];
+#ifdef _WIN32
+        else if (std::strcmp(argv[i], "--hosts") == 0)
+        {
+            std::fprintf(stderr, "--hosts needs the tcp transport, which isn't built on windows\n");
+            return 1;
+        }
+#else
+        else if (std::strcmp(argv[i], "--hosts") == 0 && has_value)    hosts = argv[++i];
+#endif
+        else if (std::strcmp(argv[i], "--port") == 0 && has_value)     ok = parseValue(argv[++i], port);
+        else if (std::strcmp(argv[i], "--broadphase") == 0 && has_value)
+        {
+            if (!parseBroadphaseType(argv[++i], scenario.broadphase))
+            {
+                std::fprintf(stderr, "unknown broadphase '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+
+        if (!ok)
+        {
+            std::fprintf(stderr, "bad value '%s' for %s\n", argv[i], argv[i - 1]);
+            printUsage();
+            return 1;
+        }
+    }
+
+    const bool domain_run = rank_count > 1;
+    if (domain_run && (rank < 0 || rank >= rank_count))
+    {
+        std::fprintf(stderr, "--rank has to be between 0 and %d\n", rank_count - 1);
+        return 1;
+    }
+    // each rank only holds its own slab
+    if (domain_run && (!load_path.empty() || !save_path.empty() || !record_path.empty()))
+    {
+        std::fprintf(stderr, "--load, --save and --record don't work with --ranks\n");
+        return 1;
+    }
+    // the ranks exchange particles every substep, so they all have to take the same number of them
+    if (domain_run && scenario.adaptive.enabled)
+    {
+        std::fprintf(stderr, "adaptive substeps don't work with --ranks\n");
+        return 1;
+    }
+
+    profiler::setThreadName("main");
+
+    Solver solver;
+    solver.setPerformanceReport(false);
+    Emitter emitter = scenario.emitter;
+    if (!load_path.empty())
+    {
+        const auto load_start = std::chrono::steady_clock::now();
+        if (!loadCheckpoint(load_path, solver, emitter, error))
+        {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        std::printf("loaded:          %zu particles from %s in %.2f ms\n", solver.getObjects().size(), load_path.c_str(),
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count());
+    }
+
+    // the scenario and command line settings win over the ones stored in the checkpoint
+    applyScenario(scenario, solver);
+
+    // every frame, the writer thread keeps up or the run waits for it
+    TrajectoryRecorder recorder;
+    if (!record_path.empty() && !recorder.open(record_path, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    // connects to the neighbouring ranks before the clock starts
+    std::unique_ptr<Transport> transport;
+    std::unique_ptr<DomainSolver> domain;
+    if (domain_run)
+    {
+        if (hosts.empty())
+        {
+            auto shm = std::make_unique<ShmTransport>();
+            if (!shm->open(shm_name, rank, rank_count, 4 << 20, error))
+            {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+            transport = std::move(shm);
+        }
+#ifndef _WIN32
+        else
+        {
+            const std::vector<std::string> host_list = splitHosts(hosts);
+            if (static_cast<int>(host_list.size()) != rank_count)
+            {
+                std::fprintf(stderr, "--hosts needs one host per rank, %d of them\n", rank_count);
+                return 1;
+            }
+            auto socket = std::make_unique<SocketTransport>();
+            if (!socket->open(host_list, port, rank, error))
+            {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+            transport = std::move(socket);
+        }
+#endif
+        domain = std::make_unique<DomainSolver>(solver, *transport);
+    }
+
+    FrameTimings total;
+    uint64_t total_substeps = 0;
+    float max_overlap = 0.0f;
+    double exchange_ms = 0.0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < scenario.frames; frame++)
+    {
+        emitter.update(solver, Solver::getFrameDt());
+        solver.update();
+        recorder.record(solver.getObjects(), solver.getFrameCount());
+        if (domain)
+        {
+            exchange_ms += domain->takeExchangeMs();
+            if (domain->failed())
+            {
+                std::fprintf(stderr, "%s\n", domain->getError().c_str());
+                return 1;
+            }
+        }
+
+        const FrameTimings& timings = solver.getLastFrameTimings();
+        total.tree_ms += timings.tree_ms;
+        total.collision_ms += timings.collision_ms;
+        total.integrate_ms += timings.integrate_ms;
+        total.rebuilds += timings.rebuilds;
+        total.resorts += timings.resorts;
+        total_substeps += timings.substeps;
+        max_overlap = std::max(max_overlap, timings.overlap);
+        total.asleep = timings.asleep;
+        total.removed += timings.removed;
+    }
+    const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double frames = scenario.frames;
+    const double substeps = static_cast<double>(total_substeps);
+    const double solver_ms = total.total();
+
+    std::printf("scenario:        %s\n", argv[1]);
+    if (domain)
+    {
+        std::printf("rank:            %d of %d, slab x %.1f to %.1f\n", rank, rank_count, domain->getSlabMin(), domain->getSlabMax());
+        std::printf("particles:       %u owned, %zu with ghosts, %llu migrated\n", domain->getOwnedCount(),
+                    solver.getObjects().size(), static_cast<unsigned long long>(domain->getMigratedCount()));
+        std::printf("exchange:        %.3f ms per frame\n", exchange_ms / scenario.frames);
+    }
+    else if (total.removed > 0)
+    {
+        std::printf("particles:       %zu, %u spawned and %u removed\n", solver.getObjects().size(), emitter.spawned,
+                    total.removed);
+    }
+    else
+    {
+        std::printf("particles:       %zu\n", solver.getObjects().size());
+    }
+    if (solver.getAdaptiveSubsteps().enabled)
+    {
+        const AdaptiveSubsteps& adaptive = solver.getAdaptiveSubsteps();
+        std::printf("frames:          %u x %.2f substeps on average, adaptive %d to %d, deepest overlap %.3f r\n",
+                    scenario.frames, substeps / frames, adaptive.min_substeps, adaptive.max_substeps, max_overlap);
+    }
+    else
+    {
+        std::printf("frames:          %u x %d substeps\n", scenario.frames, solver.getSubsteps());
+    }
+    std::printf("broadphase:      %s, %u threads%s, %s\n", broadphaseName(solver.getBroadphaseType()),
+                solver.getThreadCount(), solver.isDeterministic() ? " (deterministic)" : "", simdLevelName(getSimdLevel()));
+    std::printf("wall time:       %.3f s\n", wall_s);
+    std::printf("frames/sec:      %.1f\n", frames / wall_s);
+    std::printf("substeps/sec:    %.1f\n", substeps / wall_s);
+    std::printf("rebuilds:        %u (%.2f per frame), %u morton resorts\n", total.rebuilds, total.rebuilds / frames, total.resorts);
+    if (total.asleep > 0)
+    {
+        std::printf("asleep:          %u particles after the last frame\n", total.asleep);
+    }
+    std::printf("per frame:       tree %.3f ms | collisions %.3f ms | integrate %.3f ms | total %.3f ms\n",
+                total.tree_ms / frames, total.collision_ms / frames, total.integrate_ms / frames, solver_ms / frames);
+    if (solver_ms > 0.0)
+    {
+        std::printf("share:           tree %.1f%% | collisions %.1f%% | integrate %.1f%%\n",
+                    100.0 * total.tree_ms / solver_ms, 100.0 * total.collision_ms / solver_ms, 100.0 * total.integrate_ms / solver_ms);
+    }
+
+    if (recorder.isOpen() && !recorder.close())
+    {
+        std::fprintf(stderr, "error while writing %s\n", record_path.c_str());
+        return 1;
+    }
+
+    if (!save_path.empty())
+    {
+        if (!saveCheckpoint(save_path, solver, emitter, error))
+        {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        std::printf("saved:           %s\n", save_path.c_str());
+    }
+
+    if (profiler::compiled_in)
+    {
+        std::printf("\nspans still in the ring buffers:\n");
+        std::fflush(stdout);
+        profiler::printPhaseStats(std::cout);
+    }
+
+    if (!trace_path.empty())
+    {
+        if (!profiler::compiled_in)
+        {
+            std::fprintf(stderr, "--trace: built without PARTICLESIM_PROFILE, nothing was recorded\n");
+        }
+        else if (!profiler::writeChromeTrace(trace_path))
+        {
+            std::fprintf(stderr, "cannot write %s\n", trace_path.c_str());
+            return 1;
+        }
+        else
+        {
+            std::printf("trace written to %s\n", trace_path.c_str());
+        }
+    }
+
+    return 0;
+}
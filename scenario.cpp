@@ -0,0 +1,141 @@
+#include "scenario.hpp"
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    std::string trim(const std::string& text)
+    {
+        const auto begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) return "";
+        const auto end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    // "x y radius strength", wind also takes a direction and a sink has no strength
+    bool parseForceField(const std::string& text, ForceFieldType type, std::vector<ForceField>& fields)
+    {
+        ForceField field;
+        field.type = type;
+        std::istringstream stream(text);
+        stream >> field.position.x >> field.position.y >> field.radius;
+        if (type != ForceFieldType::Sink) stream >> field.strength;
+        if (type == ForceFieldType::Wind) stream >> field.direction.x >> field.direction.y;
+        if (stream.fail() || !stream.eof()) return false;
+
+        fields.push_back(field);
+        return true;
+    }
+}
+
+bool parseBroadphaseType(const std::string& name, BroadphaseType& type)
+{
+    if (name == "quadtree")                       type = BroadphaseType::Quadtree;
+    else if (name == "grid")                      type = BroadphaseType::Grid;
+    else if (name == "hashgrid" || name == "hash_grid") type = BroadphaseType::HashGrid;
+    else if (name == "loose" || name == "loose_quadtree") type = BroadphaseType::LooseQuadtree;
+    else if (name == "chunked")                   type = BroadphaseType::Chunked;
+    else return false;
+    return true;
+}
+
+bool loadScenario(const std::string& path, Scenario& scenario, std::string& error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        const auto equals = line.find('=');
+        if (equals == std::string::npos)
+        {
+            error = path + ":" + std::to_string(line_number) + ": expected key = value";
+            return false;
+        }
+
+        const std::string key = trim(line.substr(0, equals));
+        const std::string value = trim(line.substr(equals + 1));
+        Emitter& emitter = scenario.emitter;
+
+        bool ok = true;
+        if (key == "frames")              ok = parseValue(value, scenario.frames);
+        else if (key == "substeps")       ok = parseValue(value, scenario.substeps);
+        else if (key == "adaptive_substeps") ok = parseValue(value, scenario.adaptive.enabled);
+        else if (key == "min_substeps")   ok = parseValue(value, scenario.adaptive.min_substeps);
+        else if (key == "max_substeps")   ok = parseValue(value, scenario.adaptive.max_substeps);
+        else if (key == "max_travel")     ok = parseValue(value, scenario.adaptive.max_travel);
+        else if (key == "max_overlap")    ok = parseValue(value, scenario.adaptive.max_overlap);
+        else if (key == "threads")        ok = parseValue(value, scenario.threads);
+        else if (key == "deterministic")  ok = parseValue(value, scenario.deterministic);
+        else if (key == "broadphase")     ok = parseBroadphaseType(value, scenario.broadphase);
+        else if (key == "world_width")    ok = parseValue(value, scenario.world_width);
+        else if (key == "world_height")   ok = parseValue(value, scenario.world_height);
+        else if (key == "border")         ok = parseValue(value, scenario.border);
+        else if (key == "sleep")          ok = parseValue(value, scenario.sleep);
+        else if (key == "gravity_x")      ok = parseValue(value, scenario.gravity.x);
+        else if (key == "gravity_y")      ok = parseValue(value, scenario.gravity.y);
+        else if (key == "nbody")          ok = parseValue(value, scenario.nbody.strength);
+        else if (key == "theta")          ok = parseValue(value, scenario.nbody.theta);
+        else if (key == "softening")      ok = parseValue(value, scenario.nbody.softening);
+        else if (key == "attractor")      ok = parseForceField(value, ForceFieldType::Attractor, scenario.force_fields);
+        else if (key == "repulsor")       ok = parseForceField(value, ForceFieldType::Repulsor, scenario.force_fields);
+        else if (key == "vortex")         ok = parseForceField(value, ForceFieldType::Vortex, scenario.force_fields);
+        else if (key == "wind")           ok = parseForceField(value, ForceFieldType::Wind, scenario.force_fields);
+        else if (key == "sink")           ok = parseForceField(value, ForceFieldType::Sink, scenario.force_fields);
+        else if (key == "count")          ok = parseValue(value, emitter.max_objects);
+        else if (key == "emitter_x")      ok = parseValue(value, emitter.position.x);
+        else if (key == "emitter_y")      ok = parseValue(value, emitter.position.y);
+        else if (key == "radius")         ok = parseValue(value, emitter.radius);
+        else if (key == "spawn_delay")    ok = parseValue(value, emitter.spawn_delay);
+        else if (key == "spawn_velocity") ok = parseValue(value, emitter.spawn_velocity);
+        else if (key == "rows")           ok = parseValue(value, emitter.rows);
+        else if (key == "lifetime")       ok = parseValue(value, emitter.lifetime);
+        else if (key == "max_angle")
+        {
+            float degrees = 0.0f;
+            ok = parseValue(value, degrees);
+            emitter.max_angle = degrees * 3.14159265f / 180.0f;
+        }
+        else
+        {
+            error = path + ":" + std::to_string(line_number) + ": unknown key '" + key + "'";
+            return false;
+        }
+
+        if (!ok)
+        {
+            error = path + ":" + std::to_string(line_number) + ": bad value '" + value + "' for " + key;
+            return false;
+        }
+    }
+    return true;
+}
+
+void applyScenario(const Scenario& scenario, Solver& solver)
+{
+    solver.setSubsteps(scenario.substeps);
+    solver.setAdaptiveSubsteps(scenario.adaptive);
+    solver.setThreadCount(scenario.threads);
+    solver.setDeterministic(scenario.deterministic);
+    solver.setBroadphase(scenario.broadphase);
+    solver.setWorldBounds(Vec2{0.0f, 0.0f}, Vec2{scenario.world_width, scenario.world_height});
+    solver.setWorldBorder(scenario.border);
+    solver.setSleeping(scenario.sleep);
+    solver.setGravity(scenario.gravity);
+    solver.setNBody(scenario.nbody);
+    solver.clearForceFields();
+    for (const ForceField& field : scenario.force_fields)
+    {
+        solver.addForceField(field);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+#include "broadphase.hpp"
+#include "emitter.hpp"
+#include "force_field.hpp"
+#include "nbody.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+// a headless run: one emitter plus the solver settings, read from a "key = value" text file
+struct Scenario
+{
+    Emitter emitter;
+    uint32_t frames = 3600;
+    int substeps = 8;
+    AdaptiveSubsteps adaptive; // adaptive_substeps = 1, then substeps is where it starts
+    unsigned threads = 0; // 0 = hardware concurrency
+    bool deterministic = false; // everything on the calling thread, in order
+    BroadphaseType broadphase = BroadphaseType::Grid;
+
+    // the box particles bounce off, from (0, 0). border = 0 removes it and the world is unbounded
+    float world_width = 800.0f;
+    float world_height = 800.0f;
+    bool border = true;
+
+    bool sleep = true; // resting particles go to sleep
+
+    Vec2 gravity = Vec2(0.0f, 9.81f * 50.0f);
+    NBodySettings nbody; // nbody = strength, theta, softening
+
+    // attractor / repulsor / vortex = x y radius strength, wind = x y radius strength direction_x direction_y.
+    // one line per field
+    std::vector<ForceField> force_fields;
+};
+
+bool parseBroadphaseType(const std::string& name, BroadphaseType& type);
+
+// the whole of text as one value, false on anything else. used for scenario values and command line options alike
+template <typename T>
+bool parseValue(const std::string& text, T& value)
+{
+    std::istringstream stream(text);
+    stream >> value;
+    return !stream.fail() && stream.eof();
+}
+
+// unknown keys and unparsable values are errors, so a typo never silently runs the default
+bool loadScenario(const std::string& path, Scenario& scenario, std::string& error);
+
+void applyScenario(const Scenario& scenario, Solver& solver);
+
+#endif
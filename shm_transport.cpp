@@ -0,0 +1,251 @@
+#include "shm_transport.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the rings need atomics that work across processes");
+
+namespace
+{
+    constexpr uint64_t shm_magic = 0x31534d48'53504350ull; // "PCPSHMS1"
+    constexpr std::size_t header_bytes = 128;
+}
+
+struct ShmTransport::Header
+{
+    uint64_t magic;
+    uint64_t ring_bytes;
+    uint32_t rank_count;
+    std::atomic<uint32_t> ready; // set by rank 0 once the rest is filled in
+};
+
+// single producer single consumer, the bytes follow right behind it. positions only grow, the slot is the
+// position modulo the ring size
+struct ShmTransport::Ring
+{
+    alignas(64) std::atomic<uint64_t> head; // next byte to read, written by the reader
+    alignas(64) std::atomic<uint64_t> tail; // next byte to write, written by the writer
+
+    uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+ShmTransport::~ShmTransport()
+{
+    close();
+}
+
+bool ShmTransport::open(const std::string& name, int rank, int rank_count, std::size_t ring_bytes, std::string& error,
+                        uint32_t timeout_ms)
+{
+    static_assert(sizeof(Header) <= header_bytes, "header outgrew its space");
+
+    close();
+    if (rank_count < 1 || rank < 0 || rank >= rank_count)
+    {
+        error = "shared memory transport: rank " + std::to_string(rank) + " of " + std::to_string(rank_count);
+        return false;
+    }
+
+    std::size_t rounded = 4096;
+    while (rounded < ring_bytes) rounded *= 2;
+
+    m_rank = rank;
+    m_rank_count = rank_count;
+    m_ring_bytes = rounded;
+    // rank r to r + 1 is ring 2r, rank r + 1 to r is ring 2r + 1
+    const std::size_t ring_count = 2 * static_cast<std::size_t>(rank_count - 1);
+    m_mapping_bytes = header_bytes + ring_count * (sizeof(Ring) + m_ring_bytes);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    const bool create = rank == 0;
+
+#ifdef _WIN32
+    m_name = name;
+    const DWORD size_high = static_cast<DWORD>(static_cast<uint64_t>(m_mapping_bytes) >> 32);
+    const DWORD size_low = static_cast<DWORD>(m_mapping_bytes & 0xffffffffu);
+    for (;;)
+    {
+        m_handle = create ? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, size_high, size_low, m_name.c_str())
+                          : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name.c_str());
+        if (m_handle || create || std::chrono::steady_clock::now() > deadline) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!m_handle)
+    {
+        error = "cannot open shared memory " + m_name;
+        return false;
+    }
+    m_mapping = static_cast<uint8_t*>(MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, m_mapping_bytes));
+    if (!m_mapping)
+    {
+        error = "cannot map shared memory " + m_name;
+        close();
+        return false;
+    }
+#else
+    m_name = name.empty() || name[0] != '/' ? "/" + name : name;
+    int fd = -1;
+    if (create)
+    {
+        // whatever an earlier run with this name left behind
+        shm_unlink(m_name.c_str());
+        fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(m_mapping_bytes)) != 0)
+        {
+            ::close(fd);
+            shm_unlink(m_name.c_str());
+            fd = -1;
+        }
+    }
+    else
+    {
+        // until rank 0 has created it and given it its size
+        for (;;)
+        {
+            fd = shm_open(m_name.c_str(), O_RDWR, 0600);
+            struct stat info;
+            if (fd >= 0 && fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) == m_mapping_bytes) break;
+
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+            if (std::chrono::steady_clock::now() > deadline) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    if (fd < 0)
+    {
+        error = "cannot open shared memory " + m_name + " of " + std::to_string(m_mapping_bytes) + " bytes";
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, m_mapping_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the segment alive
+    if (mapping == MAP_FAILED)
+    {
+        error = "cannot map shared memory " + m_name;
+        if (create) shm_unlink(m_name.c_str());
+        return false;
+    }
+    m_mapping = static_cast<uint8_t*>(mapping);
+#endif
+
+    Header* header = reinterpret_cast<Header*>(m_mapping);
+    if (create)
+    {
+        // fresh memory is zero, so the ring positions start at 0 either way
+        header->magic = shm_magic;
+        header->ring_bytes = m_ring_bytes;
+        header->rank_count = static_cast<uint32_t>(rank_count);
+        for (std::size_t r = 0; r < ring_count; r++)
+        {
+            new (m_mapping + header_bytes + r * (sizeof(Ring) + m_ring_bytes)) Ring{};
+        }
+        header->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    while (header->ready.load(std::memory_order_acquire) == 0)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            error = "shared memory " + m_name + " was never set up by rank 0";
+            close();
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (header->magic != shm_magic || header->ring_bytes != m_ring_bytes ||
+        header->rank_count != static_cast<uint32_t>(rank_count))
+    {
+        error = "shared memory " + m_name + " belongs to a run with other settings";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ShmTransport::close()
+{
+    if (!m_mapping) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_mapping);
+    CloseHandle(m_handle);
+    m_handle = nullptr;
+#else
+    munmap(m_mapping, m_mapping_bytes);
+    if (m_rank == 0) shm_unlink(m_name.c_str());
+#endif
+    m_mapping = nullptr;
+}
+
+ShmTransport::Ring* ShmTransport::outgoing(int peer) const
+{
+    int ring;
+    if (peer == m_rank + 1 && peer < m_rank_count) ring = 2 * m_rank;
+    else if (peer == m_rank - 1 && peer >= 0)      ring = 2 * peer + 1;
+    else return nullptr;
+
+    return reinterpret_cast<Ring*>(m_mapping + header_bytes + ring * (sizeof(Ring) + m_ring_bytes));
+}
+
+ShmTransport::Ring* ShmTransport::incoming(int peer) const
+{
+    int ring;
+    if (peer == m_rank + 1 && peer < m_rank_count) ring = 2 * m_rank + 1;
+    else if (peer == m_rank - 1 && peer >= 0)      ring = 2 * peer;
+    else return nullptr;
+
+    return reinterpret_cast<Ring*>(m_mapping + header_bytes + ring * (sizeof(Ring) + m_ring_bytes));
+}
+
+std::size_t ShmTransport::trySend(int peer, const uint8_t* data, std::size_t bytes)
+{
+    Ring* ring = m_mapping ? outgoing(peer) : nullptr;
+    if (!ring) return 0;
+
+    const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    const std::size_t count = std::min<std::size_t>(bytes, m_ring_bytes - static_cast<std::size_t>(tail - head));
+    if (count == 0) return 0;
+
+    // in two pieces when it wraps around the end
+    const std::size_t at = static_cast<std::size_t>(tail & (m_ring_bytes - 1));
+    const std::size_t first = std::min(count, m_ring_bytes - at);
+    std::memcpy(ring->bytes() + at, data, first);
+    std::memcpy(ring->bytes(), data + first, count - first);
+    ring->tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+std::size_t ShmTransport::tryReceive(int peer, uint8_t* data, std::size_t bytes)
+{
+    Ring* ring = m_mapping ? incoming(peer) : nullptr;
+    if (!ring) return 0;
+
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    const uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    const std::size_t count = std::min<std::size_t>(bytes, static_cast<std::size_t>(tail - head));
+    if (count == 0) return 0;
+
+    const std::size_t at = static_cast<std::size_t>(head & (m_ring_bytes - 1));
+    const std::size_t first = std::min(count, m_ring_bytes - at);
+    std::memcpy(data, ring->bytes() + at, first);
+    std::memcpy(data + first, ring->bytes(), count - first);
+    ring->head.store(head + count, std::memory_order_release);
+    return count;
+}
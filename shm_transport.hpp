@@ -0,0 +1,58 @@
+#ifndef SHM_TRANSPORT_HPP
+#define SHM_TRANSPORT_HPP
+
+#include "transport.hpp"
+#include <string>
+
+// ranks on one host, over lock-free ring buffers in a named shared memory segment, one ring per direction between
+// two neighbouring ranks. rank 0 creates the segment, the others wait for it to show up. every rank has to pass
+// the same name, rank count and ring size, and the name has to be unique to the run: a segment left over from a
+// run that crashed is taken for the new one otherwise
+class ShmTransport : public Transport
+{
+private:
+    struct Header;
+    struct Ring;
+
+    int m_rank = 0;
+    int m_rank_count = 1;
+    std::size_t m_ring_bytes = 0;
+
+    std::string m_name;
+    uint8_t* m_mapping = nullptr;
+    std::size_t m_mapping_bytes = 0;
+#ifdef _WIN32
+    void* m_handle = nullptr;
+#endif
+
+    // the ring this rank writes to towards peer, and the one it reads from peer, nullptr if peer isn't a neighbour
+    Ring* outgoing(int peer) const;
+    Ring* incoming(int peer) const;
+
+public:
+    ShmTransport() = default;
+    ~ShmTransport() override;
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    // ring_bytes is per direction and rounded up to a power of two. ranks other than 0 give up after timeout_ms
+    bool open(const std::string& name, int rank, int rank_count, std::size_t ring_bytes, std::string& error,
+              uint32_t timeout_ms = 10000);
+
+    // rank 0 also removes the name, ranks still attached keep their mapping
+    void close();
+
+    int getRank() const override { return m_rank; }
+
+    int getRankCount() const override { return m_rank_count; }
+
+    std::size_t trySend(int peer, const uint8_t* data, std::size_t bytes) override;
+
+    std::size_t tryReceive(int peer, uint8_t* data, std::size_t bytes) override;
+
+    // nothing can break a mapping, a dead peer only shows up as a timeout
+    bool isOk() const override { return m_mapping != nullptr; }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "sim_thread.hpp"
+#include "profiler.hpp"
+#include <chrono>
+
+void FrameSnapshot::capture(const Solver& solver)
+{
+    const ParticleStore& objects = solver.getObjects();
+    frame = solver.getFrameCount();
+    x.assign(objects.x.begin(), objects.x.end());
+    y.assign(objects.y.begin(), objects.y.end());
+    radius.assign(objects.radius.begin(), objects.radius.end());
+    color.assign(objects.color.begin(), objects.color.end());
+    timings = solver.getLastFrameTimings();
+}
+
+
+SimulationThread::SimulationThread(Solver& solver, Command before_update, Command after_update)
+    : m_solver{solver}, m_before{std::move(before_update)}, m_after{std::move(after_update)}
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::start()
+{
+    if (m_running.load()) return;
+
+    m_running.store(true);
+    m_thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+    if (!m_thread.joinable()) return;
+
+    m_running.store(false);
+    m_thread.join();
+
+    Command dropped;
+    while (m_commands.pop(dropped)) {}
+}
+
+bool SimulationThread::post(Command command)
+{
+    return m_commands.push(std::move(command));
+}
+
+const FrameSnapshot& SimulationThread::acquire()
+{
+    m_snapshots.update();
+    return m_snapshots.front();
+}
+
+void SimulationThread::run()
+{
+    using clock = std::chrono::steady_clock;
+    profiler::setThreadName("simulation");
+
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(m_frame_rate > 0.0f ? 1.0 / m_frame_rate : 0.0));
+    auto next_frame = clock::now();
+
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        const auto start = clock::now();
+
+        Command command;
+        while (m_commands.pop(command))
+        {
+            command(m_solver);
+        }
+        if (m_before) m_before(m_solver);
+        m_solver.update();
+        if (m_after) m_after(m_solver);
+
+        FrameSnapshot& snapshot = m_snapshots.back();
+        snapshot.capture(m_solver);
+        snapshot.frame_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+        m_snapshots.publish();
+
+        // fixed steps of simulated time at the frame rate. a frame that took too long is not caught up on, the
+        // simulation just runs slower than real time then
+        if (period.count() == 0) continue;
+
+        next_frame += period;
+        const auto now = clock::now();
+        if (next_frame < now) next_frame = now;
+        else                  std::this_thread::sleep_until(next_frame);
+    }
+}
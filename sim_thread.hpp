@@ -0,0 +1,152 @@
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+
+#include "solver.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// what the render thread needs of one finished frame, copied out of the solver so it can be drawn while the
+// next frame is being simulated
+struct FrameSnapshot
+{
+    uint64_t frame = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> radius;
+    std::vector<Color> color;
+
+    FrameTimings timings;
+    float frame_ms = 0.0f; // wall time of the whole frame on the simulation thread, commands and callbacks included
+
+    std::size_t size() const { return x.size(); }
+
+    // reuses the arrays, so once they have grown to the particle count nothing is allocated
+    void capture(const Solver& solver);
+};
+
+
+// hands the latest value from one writer thread to one reader thread without locks. the writer fills back() and
+// publishes it, the reader picks up the newest published value with update() and reads front() until its next
+// update. neither ever waits for the other, the third slot is the one in between
+template <typename T>
+class TripleBuffer
+{
+private:
+    static constexpr uint8_t index_mask = 3;
+    static constexpr uint8_t fresh = 4; // the middle slot holds a value the reader hasn't taken yet
+
+    std::array<T, 3> m_slots;
+    std::atomic<uint8_t> m_middle{1};
+    uint8_t m_back = 0;  // writer
+    uint8_t m_front = 2; // reader
+
+public:
+    T& back() { return m_slots[m_back]; }
+
+    void publish() { m_back = m_middle.exchange(m_back | fresh, std::memory_order_acq_rel) & index_mask; }
+
+    // true if there was a newer value than front()
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & fresh)) return false;
+
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    const T& front() const { return m_slots[m_front]; }
+};
+
+
+// bounded single producer single consumer queue on a ring buffer, lock free
+template <typename T, std::size_t Capacity>
+class SpscQueue
+{
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity has to be a power of two");
+
+    std::array<T, Capacity> m_items;
+
+    // on their own cache lines, each is written by one side only
+    alignas(64) std::atomic<std::size_t> m_head{0}; // next to pop
+    alignas(64) std::atomic<std::size_t> m_tail{0}; // next to push
+
+public:
+    // false if the queue is full, the item is left as it was then
+    bool push(T&& item)
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity) return false;
+
+        m_items[tail & (Capacity - 1)] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return false;
+
+        item = std::move(m_items[head & (Capacity - 1)]);
+        m_items[head & (Capacity - 1)] = T(); // don't keep what the item holds on to alive
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+
+// runs a solver on a thread of its own, so a frame is simulated while the previous one is drawn and the frame time
+// is the slower of the two rather than their sum.
+// every frame the thread runs the posted commands, the before callback (emitters), solver.update() and the after
+// callback (recording), then publishes a snapshot. from start() to stop() the solver and whatever the callbacks
+// and commands touch belong to the simulation thread, everything else has to go through post()
+class SimulationThread
+{
+public:
+    using Command = std::function<void(Solver&)>;
+
+private:
+    Solver& m_solver;
+    Command m_before;
+    Command m_after;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+    float m_frame_rate = 60.0f;
+
+    SpscQueue<Command, 256> m_commands;
+    TripleBuffer<FrameSnapshot> m_snapshots;
+
+    void run();
+
+public:
+    SimulationThread(Solver& solver, Command before_update, Command after_update);
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // frames per second of simulated time, 0 runs them back to back. only while stopped
+    void setFrameRate(float frame_rate) { m_frame_rate = frame_rate; }
+
+    void start();
+
+    // finishes the current frame and joins the thread, commands still queued are dropped
+    void stop();
+
+    bool isRunning() const { return m_running.load(std::memory_order_relaxed); }
+
+    // runs the command on the simulation thread before the next frame. from one thread only, false if the queue is full
+    bool post(Command command);
+
+    // the newest finished frame. stays the same until the next call, while the simulation moves on
+    const FrameSnapshot& acquire();
+};
+
+#endif
@@ -0,0 +1,430 @@
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PARTICLESIM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// gcc and clang only emit avx instructions inside functions marked for them,
+// msvc accepts the intrinsics anywhere
+#if defined(PARTICLESIM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+
+namespace
+{
+    struct Arrays
+    {
+        float* x;
+        float* y;
+        float* last_x;
+        float* last_y;
+        float* ax;
+        float* ay;
+        const float* radius;
+    };
+
+    Arrays arraysOf(ParticleStore& store)
+    {
+        return {store.x.data(), store.y.data(), store.last_x.data(), store.last_y.data(),
+                store.ax.data(), store.ay.data(), store.radius.data()};
+    }
+
+    // reference implementation, also handles the tails of the vector kernels
+    void integrateScalar(const Arrays& a, uint32_t begin, uint32_t end, const IntegrateParams& p)
+    {
+        const float dt2 = p.dt * p.dt;
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const float x = a.x[i];
+            const float y = a.y[i];
+            float nx = x + (x - a.last_x[i]) + (a.ax[i] + p.gravity_x) * dt2;
+            float ny = y + (y - a.last_y[i]) + (a.ay[i] + p.gravity_y) * dt2;
+            a.ax[i] = 0.0f; //reset acceleration
+            a.ay[i] = 0.0f;
+
+            float vx = nx - x;
+            float vy = ny - y;
+
+            if (p.border)
+            {
+                const float r = a.radius[i];
+                const bool hit_x = nx < p.min_x + r || nx > p.max_x - r;
+                const bool hit_y = ny < p.min_y + r || ny > p.max_y - r;
+
+                if (hit_x) // reflect off left/right
+                {
+                    nx = std::min(std::max(nx, p.min_x + r), p.max_x - r);
+                }
+                if (hit_y) //reflect off top and bottom
+                {
+                    ny = std::min(std::max(ny, p.min_y + r), p.max_y - r);
+                    vy = -vy;
+                }
+                // in a corner the top/bottom reflection wins: vx is damped, not flipped
+                if (hit_y) vx = vx * p.dampening;
+                else if (hit_x) vx = -vx * p.dampening;
+            }
+
+            a.x[i] = nx;
+            a.y[i] = ny;
+            a.last_x[i] = nx - vx;
+            a.last_y[i] = ny - vy;
+        }
+    }
+
+#ifdef PARTICLESIM_X86
+    // sse2 is part of x86-64, so this is the baseline vector path
+    uint32_t integrateSSE2(const Arrays& a, uint32_t begin, uint32_t end, const IntegrateParams& p)
+    {
+        const __m128 dt2 = _mm_set1_ps(p.dt * p.dt);
+        const __m128 gx = _mm_set1_ps(p.gravity_x);
+        const __m128 gy = _mm_set1_ps(p.gravity_y);
+        const __m128 min_x = _mm_set1_ps(p.min_x);
+        const __m128 min_y = _mm_set1_ps(p.min_y);
+        const __m128 max_x = _mm_set1_ps(p.max_x);
+        const __m128 max_y = _mm_set1_ps(p.max_y);
+        const __m128 damp = _mm_set1_ps(p.dampening);
+        const __m128 neg_damp = _mm_set1_ps(-p.dampening);
+        const __m128 zero = _mm_setzero_ps();
+
+        auto select = [](__m128 mask, __m128 a_value, __m128 b_value)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a_value), _mm_andnot_ps(mask, b_value));
+        };
+
+        uint32_t i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(a.x + i);
+            const __m128 y = _mm_loadu_ps(a.y + i);
+            __m128 nx = _mm_add_ps(_mm_add_ps(x, _mm_sub_ps(x, _mm_loadu_ps(a.last_x + i))),
+                                   _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a.ax + i), gx), dt2));
+            __m128 ny = _mm_add_ps(_mm_add_ps(y, _mm_sub_ps(y, _mm_loadu_ps(a.last_y + i))),
+                                   _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a.ay + i), gy), dt2));
+            _mm_storeu_ps(a.ax + i, zero);
+            _mm_storeu_ps(a.ay + i, zero);
+
+            __m128 vx = _mm_sub_ps(nx, x);
+            __m128 vy = _mm_sub_ps(ny, y);
+
+            if (p.border)
+            {
+                const __m128 r = _mm_loadu_ps(a.radius + i);
+                const __m128 lo_x = _mm_add_ps(min_x, r);
+                const __m128 hi_x = _mm_sub_ps(max_x, r);
+                const __m128 lo_y = _mm_add_ps(min_y, r);
+                const __m128 hi_y = _mm_sub_ps(max_y, r);
+                const __m128 hit_x = _mm_or_ps(_mm_cmplt_ps(nx, lo_x), _mm_cmpgt_ps(nx, hi_x));
+                const __m128 hit_y = _mm_or_ps(_mm_cmplt_ps(ny, lo_y), _mm_cmpgt_ps(ny, hi_y));
+
+                nx = select(hit_x, _mm_min_ps(_mm_max_ps(nx, lo_x), hi_x), nx);
+                ny = select(hit_y, _mm_min_ps(_mm_max_ps(ny, lo_y), hi_y), ny);
+                vx = select(hit_y, _mm_mul_ps(vx, damp), select(hit_x, _mm_mul_ps(vx, neg_damp), vx));
+                vy = select(hit_y, _mm_sub_ps(zero, vy), vy);
+            }
+
+            _mm_storeu_ps(a.x + i, nx);
+            _mm_storeu_ps(a.y + i, ny);
+            _mm_storeu_ps(a.last_x + i, _mm_sub_ps(nx, vx));
+            _mm_storeu_ps(a.last_y + i, _mm_sub_ps(ny, vy));
+        }
+        return i;
+    }
+
+    TARGET_AVX2 uint32_t integrateAVX2(const Arrays& a, uint32_t begin, uint32_t end, const IntegrateParams& p)
+    {
+        const __m256 dt2 = _mm256_set1_ps(p.dt * p.dt);
+        const __m256 gx = _mm256_set1_ps(p.gravity_x);
+        const __m256 gy = _mm256_set1_ps(p.gravity_y);
+        const __m256 min_x = _mm256_set1_ps(p.min_x);
+        const __m256 min_y = _mm256_set1_ps(p.min_y);
+        const __m256 max_x = _mm256_set1_ps(p.max_x);
+        const __m256 max_y = _mm256_set1_ps(p.max_y);
+        const __m256 damp = _mm256_set1_ps(p.dampening);
+        const __m256 neg_damp = _mm256_set1_ps(-p.dampening);
+        const __m256 zero = _mm256_setzero_ps();
+
+        uint32_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(a.x + i);
+            const __m256 y = _mm256_loadu_ps(a.y + i);
+            __m256 nx = _mm256_add_ps(_mm256_add_ps(x, _mm256_sub_ps(x, _mm256_loadu_ps(a.last_x + i))),
+                                      _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(a.ax + i), gx), dt2));
+            __m256 ny = _mm256_add_ps(_mm256_add_ps(y, _mm256_sub_ps(y, _mm256_loadu_ps(a.last_y + i))),
+                                      _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(a.ay + i), gy), dt2));
+            _mm256_storeu_ps(a.ax + i, zero);
+            _mm256_storeu_ps(a.ay + i, zero);
+
+            __m256 vx = _mm256_sub_ps(nx, x);
+            __m256 vy = _mm256_sub_ps(ny, y);
+
+            if (p.border)
+            {
+                const __m256 r = _mm256_loadu_ps(a.radius + i);
+                const __m256 lo_x = _mm256_add_ps(min_x, r);
+                const __m256 hi_x = _mm256_sub_ps(max_x, r);
+                const __m256 lo_y = _mm256_add_ps(min_y, r);
+                const __m256 hi_y = _mm256_sub_ps(max_y, r);
+                const __m256 hit_x = _mm256_or_ps(_mm256_cmp_ps(nx, lo_x, _CMP_LT_OQ), _mm256_cmp_ps(nx, hi_x, _CMP_GT_OQ));
+                const __m256 hit_y = _mm256_or_ps(_mm256_cmp_ps(ny, lo_y, _CMP_LT_OQ), _mm256_cmp_ps(ny, hi_y, _CMP_GT_OQ));
+
+                // blendv picks the second operand where the mask is set
+                nx = _mm256_blendv_ps(nx, _mm256_min_ps(_mm256_max_ps(nx, lo_x), hi_x), hit_x);
+                ny = _mm256_blendv_ps(ny, _mm256_min_ps(_mm256_max_ps(ny, lo_y), hi_y), hit_y);
+                vx = _mm256_blendv_ps(_mm256_blendv_ps(vx, _mm256_mul_ps(vx, neg_damp), hit_x), _mm256_mul_ps(vx, damp), hit_y);
+                vy = _mm256_blendv_ps(vy, _mm256_sub_ps(zero, vy), hit_y);
+            }
+
+            _mm256_storeu_ps(a.x + i, nx);
+            _mm256_storeu_ps(a.y + i, ny);
+            _mm256_storeu_ps(a.last_x + i, _mm256_sub_ps(nx, vx));
+            _mm256_storeu_ps(a.last_y + i, _mm256_sub_ps(ny, vy));
+        }
+        return i;
+    }
+
+    TARGET_AVX512 uint32_t integrateAVX512(const Arrays& a, uint32_t begin, uint32_t end, const IntegrateParams& p)
+    {
+        const __m512 dt2 = _mm512_set1_ps(p.dt * p.dt);
+        const __m512 gx = _mm512_set1_ps(p.gravity_x);
+        const __m512 gy = _mm512_set1_ps(p.gravity_y);
+        const __m512 min_x = _mm512_set1_ps(p.min_x);
+        const __m512 min_y = _mm512_set1_ps(p.min_y);
+        const __m512 max_x = _mm512_set1_ps(p.max_x);
+        const __m512 max_y = _mm512_set1_ps(p.max_y);
+        const __m512 damp = _mm512_set1_ps(p.dampening);
+        const __m512 neg_damp = _mm512_set1_ps(-p.dampening);
+        const __m512 zero = _mm512_setzero_ps();
+
+        uint32_t i = begin;
+        for (; i + 16 <= end; i += 16)
+        {
+            const __m512 x = _mm512_loadu_ps(a.x + i);
+            const __m512 y = _mm512_loadu_ps(a.y + i);
+            __m512 nx = _mm512_add_ps(_mm512_add_ps(x, _mm512_sub_ps(x, _mm512_loadu_ps(a.last_x + i))),
+                                      _mm512_mul_ps(_mm512_add_ps(_mm512_loadu_ps(a.ax + i), gx), dt2));
+            __m512 ny = _mm512_add_ps(_mm512_add_ps(y, _mm512_sub_ps(y, _mm512_loadu_ps(a.last_y + i))),
+                                      _mm512_mul_ps(_mm512_add_ps(_mm512_loadu_ps(a.ay + i), gy), dt2));
+            _mm512_storeu_ps(a.ax + i, zero);
+            _mm512_storeu_ps(a.ay + i, zero);
+
+            __m512 vx = _mm512_sub_ps(nx, x);
+            __m512 vy = _mm512_sub_ps(ny, y);
+
+            if (p.border)
+            {
+                const __m512 r = _mm512_loadu_ps(a.radius + i);
+                const __m512 lo_x = _mm512_add_ps(min_x, r);
+                const __m512 hi_x = _mm512_sub_ps(max_x, r);
+                const __m512 lo_y = _mm512_add_ps(min_y, r);
+                const __m512 hi_y = _mm512_sub_ps(max_y, r);
+                const __mmask16 hit_x = _mm512_cmp_ps_mask(nx, lo_x, _CMP_LT_OQ) | _mm512_cmp_ps_mask(nx, hi_x, _CMP_GT_OQ);
+                const __mmask16 hit_y = _mm512_cmp_ps_mask(ny, lo_y, _CMP_LT_OQ) | _mm512_cmp_ps_mask(ny, hi_y, _CMP_GT_OQ);
+
+                // masked min/max only clamp the lanes that hit
+                nx = _mm512_mask_min_ps(nx, hit_x, _mm512_mask_max_ps(nx, hit_x, nx, lo_x), hi_x);
+                ny = _mm512_mask_min_ps(ny, hit_y, _mm512_mask_max_ps(ny, hit_y, ny, lo_y), hi_y);
+                vx = _mm512_mask_blend_ps(hit_y, _mm512_mask_blend_ps(hit_x, vx, _mm512_mul_ps(vx, neg_damp)), _mm512_mul_ps(vx, damp));
+                vy = _mm512_mask_blend_ps(hit_y, vy, _mm512_sub_ps(zero, vy));
+            }
+
+            _mm512_storeu_ps(a.x + i, nx);
+            _mm512_storeu_ps(a.y + i, ny);
+            _mm512_storeu_ps(a.last_x + i, _mm512_sub_ps(nx, vx));
+            _mm512_storeu_ps(a.last_y + i, _mm512_sub_ps(ny, vy));
+        }
+        return i;
+    }
+
+    uint32_t sumPointMassesSSE2(const PointMasses& m, uint32_t count, float px, float py, float softening2,
+                                float& sum_x, float& sum_y)
+    {
+        const __m128 x = _mm_set1_ps(px);
+        const __m128 y = _mm_set1_ps(py);
+        const __m128 eps = _mm_set1_ps(softening2);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 acc_x = _mm_setzero_ps();
+        __m128 acc_y = _mm_setzero_ps();
+
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(m.x + i), x);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(m.y + i), y);
+            const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), eps);
+            const __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(d2));
+            const __m128 scale = _mm_and_ps(_mm_cmpneq_ps(d2, zero),
+                                            _mm_mul_ps(_mm_loadu_ps(m.mass + i), _mm_mul_ps(inverse, _mm_mul_ps(inverse, inverse))));
+            acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, scale));
+            acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, scale));
+        }
+
+        alignas(16) float lanes_x[4];
+        alignas(16) float lanes_y[4];
+        _mm_store_ps(lanes_x, acc_x);
+        _mm_store_ps(lanes_y, acc_y);
+        sum_x = (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        sum_y = (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+        return i;
+    }
+
+    TARGET_AVX2 uint32_t sumPointMassesAVX2(const PointMasses& m, uint32_t count, float px, float py, float softening2,
+                                            float& sum_x, float& sum_y)
+    {
+        const __m256 x = _mm256_set1_ps(px);
+        const __m256 y = _mm256_set1_ps(py);
+        const __m256 eps = _mm256_set1_ps(softening2);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 acc_x = _mm256_setzero_ps();
+        __m256 acc_y = _mm256_setzero_ps();
+
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(m.x + i), x);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(m.y + i), y);
+            const __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), eps);
+            const __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(d2));
+            const __m256 scale = _mm256_and_ps(_mm256_cmp_ps(d2, zero, _CMP_NEQ_OQ),
+                                               _mm256_mul_ps(_mm256_loadu_ps(m.mass + i),
+                                                             _mm256_mul_ps(inverse, _mm256_mul_ps(inverse, inverse))));
+            acc_x = _mm256_add_ps(acc_x, _mm256_mul_ps(dx, scale));
+            acc_y = _mm256_add_ps(acc_y, _mm256_mul_ps(dy, scale));
+        }
+
+        alignas(32) float lanes_x[8];
+        alignas(32) float lanes_y[8];
+        _mm256_store_ps(lanes_x, acc_x);
+        _mm256_store_ps(lanes_y, acc_y);
+        sum_x = 0.0f;
+        sum_y = 0.0f;
+        for (int lane = 0; lane < 8; lane++)
+        {
+            sum_x += lanes_x[lane];
+            sum_y += lanes_y[lane];
+        }
+        return i;
+    }
+
+    SimdLevel detectSimdLevel()
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        return SimdLevel::SSE2;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        const bool os_saves_ymm = (info[2] & (1 << 27)) && ((_xgetbv(0) & 0x6) == 0x6);
+        if (!os_saves_ymm || max_leaf < 7) return SimdLevel::SSE2;
+
+        __cpuidex(info, 7, 0);
+        const bool os_saves_zmm = (_xgetbv(0) & 0xE6) == 0xE6;
+        if ((info[1] & (1 << 16)) && os_saves_zmm) return SimdLevel::AVX512;
+        if (info[1] & (1 << 5)) return SimdLevel::AVX2;
+        return SimdLevel::SSE2;
+#else
+        return SimdLevel::SSE2;
+#endif
+    }
+#else
+    SimdLevel detectSimdLevel()
+    {
+        return SimdLevel::Scalar;
+    }
+#endif
+
+    const SimdLevel detected_level = detectSimdLevel();
+    SimdLevel active_level = detected_level;
+}
+
+
+SimdLevel getSimdLevel()
+{
+    return active_level;
+}
+
+void setSimdLevel(SimdLevel level)
+{
+    active_level = std::min(level, detected_level);
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::Scalar: return "scalar";
+        case SimdLevel::SSE2:   return "SSE2";
+        case SimdLevel::AVX2:   return "AVX2";
+        case SimdLevel::AVX512: return "AVX-512";
+    }
+    return "unknown";
+}
+
+void integrateParticles(ParticleStore& store, uint32_t begin, uint32_t end, const IntegrateParams& params)
+{
+    const Arrays arrays = arraysOf(store);
+    uint32_t i = begin;
+
+#ifdef PARTICLESIM_X86
+    switch (active_level)
+    {
+        case SimdLevel::AVX512: i = integrateAVX512(arrays, i, end, params); break;
+        case SimdLevel::AVX2:   i = integrateAVX2(arrays, i, end, params); break;
+        case SimdLevel::SSE2:   i = integrateSSE2(arrays, i, end, params); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+
+    integrateScalar(arrays, i, end, params);
+}
+
+Vec2 sumPointMasses(const PointMasses& masses, uint32_t count, float x, float y, float softening2)
+{
+    float sum_x = 0.0f;
+    float sum_y = 0.0f;
+    uint32_t i = 0;
+
+#ifdef PARTICLESIM_X86
+    // the pass is bound by sqrt and division, avx-512 doesn't add enough over avx2 to be worth a third kernel
+    switch (active_level)
+    {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2:   i = sumPointMassesAVX2(masses, count, x, y, softening2, sum_x, sum_y); break;
+        case SimdLevel::SSE2:   i = sumPointMassesSSE2(masses, count, x, y, softening2, sum_x, sum_y); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const float dx = masses.x[i] - x;
+        const float dy = masses.y[i] - y;
+        const float d2 = dx * dx + dy * dy + softening2;
+        if (d2 == 0.0f) continue;
+        const float inverse = 1.0f / std::sqrt(d2);
+        const float scale = masses.mass[i] * inverse * inverse * inverse;
+        sum_x += dx * scale;
+        sum_y += dy * scale;
+    }
+    return {sum_x, sum_y};
+}
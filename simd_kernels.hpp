@@ -0,0 +1,55 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include "particle.hpp"
+#include <cstdint>
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+// everything one substep does to a particle outside of collisions
+struct IntegrateParams
+{
+    float dt = 0.0f;
+    float gravity_x = 0.0f;
+    float gravity_y = 0.0f;
+
+    // rectangular border, particles bounce off its inside
+    bool border = true;
+    float min_x = 0.0f;
+    float min_y = 0.0f;
+    float max_x = 0.0f;
+    float max_y = 0.0f;
+    float dampening = 0.75f; // applied to the tangential (x) velocity on every bounce
+};
+
+// fused gravity + verlet integration + border clamp over particles [begin, end),
+// one streaming pass using the widest instruction set the cpu supports
+void integrateParticles(ParticleStore& store, uint32_t begin, uint32_t end, const IntegrateParams& params);
+
+// point masses as parallel arrays
+struct PointMasses
+{
+    const float* mass = nullptr;
+    const float* x = nullptr;
+    const float* y = nullptr;
+};
+
+// pull of count point masses on (x, y): the sum of mass * d / (|d|^2 + softening2)^1.5, d pointing from (x, y) to
+// the mass. a mass sitting on (x, y) adds nothing, also with softening2 = 0 where its term would be 0 / 0
+Vec2 sumPointMasses(const PointMasses& masses, uint32_t count, float x, float y, float softening2);
+
+// detected once at startup
+SimdLevel getSimdLevel();
+
+// force a lower level, e.g. to compare against the scalar path. clamped to what the cpu supports
+void setSimdLevel(SimdLevel level);
+
+const char* simdLevelName(SimdLevel level);
+
+#endif
@@ -0,0 +1,147 @@
+#include "sleep.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+uint32_t SleepTracker::findRoot(uint32_t n)
+{
+    while (m_parent[n] != n)
+    {
+        m_parent[n] = m_parent[m_parent[n]];
+        n = m_parent[n];
+    }
+    return n;
+}
+
+void SleepTracker::unite(uint32_t a, uint32_t b)
+{
+    a = findRoot(a);
+    b = findRoot(b);
+    if (a != b) m_parent[b] = a;
+}
+
+void SleepTracker::reset()
+{
+    m_frame_x.clear();
+    m_frame_y.clear();
+    m_quiet_frames.clear();
+    m_island_of.clear();
+    m_generation.clear();
+    m_sleeping_islands = 0;
+}
+
+bool SleepTracker::update(ParticleStore& store, const std::vector<std::pair<uint32_t, uint32_t>>& pairs)
+{
+    const uint32_t count = static_cast<uint32_t>(store.size());
+    bool changed = false;
+
+    // particles added since the last update start out where they are, also the ones that got the id of a removed one
+    const std::size_t ids = store.idCount();
+    if (ids < m_frame_x.size()) reset();
+    m_frame_x.resize(ids);
+    m_frame_y.resize(ids);
+    m_quiet_frames.resize(ids, 0);
+    m_island_of.resize(ids, no_island);
+    m_generation.resize(ids, unknown_generation);
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const uint32_t id = store.id[p];
+        if (m_generation[id] == store.generation[id]) continue;
+
+        m_generation[id] = store.generation[id];
+        m_frame_x[id] = store.x[p];
+        m_frame_y[id] = store.y[p];
+        m_quiet_frames[id] = 0;
+        m_island_of[id] = no_island;
+    }
+
+    m_parent.resize(count + m_sleeping_islands);
+    std::iota(m_parent.begin(), m_parent.end(), 0u);
+
+    // sleeping particles hang off their island's node, they don't have pairs among each other
+    for (uint32_t p = 0; p < count; p++)
+    {
+        if (!store.asleep[p]) continue;
+
+        const uint32_t island = m_island_of[store.id[p]];
+        if (island == no_island)
+        {
+            store.asleep[p] = 0; // flagged by someone else
+            changed = true;
+            continue;
+        }
+        unite(count + island, p);
+    }
+
+    for (const auto& pair : pairs)
+    {
+        const uint32_t a = pair.first;
+        const uint32_t b = pair.second;
+        if (store.asleep[a] && store.asleep[b]) continue;
+
+        const float dx = store.x[a] - store.x[b];
+        const float dy = store.y[a] - store.y[b];
+        const float reach = sleep_contact * (store.radius[a] + store.radius[b]);
+        if (dx * dx + dy * dy < reach * reach)
+        {
+            unite(a, b);
+        }
+    }
+
+    m_islands.assign(m_parent.size(), Island{});
+    for (uint32_t p = 0; p < count; p++)
+    {
+        Island& island = m_islands[findRoot(p)];
+        if (store.asleep[p])
+        {
+            island.any_asleep = true;
+            continue;
+        }
+
+        const uint32_t id = store.id[p];
+        const float moved = std::max(std::abs(store.x[p] - m_frame_x[id]), std::abs(store.y[p] - m_frame_y[id]));
+        m_frame_x[id] = store.x[p];
+        m_frame_y[id] = store.y[p];
+
+        island.awake++;
+        island.total_motion += moved;
+        island.max_motion = std::max(island.max_motion, moved);
+        island.quiet_frames = std::min(island.quiet_frames, m_quiet_frames[id]);
+    }
+
+    uint32_t labels = 0;
+    for (uint32_t n = 0; n < m_parent.size(); n++)
+    {
+        if (m_parent[n] != n) continue;
+
+        Island& island = m_islands[n];
+        bool sleeps = island.awake == 0 && island.any_asleep; // not an island whose particles were all woken
+        if (island.awake > 0 && island.any_asleep)
+        {
+            island.quiet_frames = 0; // woken up
+        }
+        else if (island.awake > 0)
+        {
+            const bool quiet = island.total_motion < sleep_motion * island.awake && island.max_motion < sleep_max_motion;
+            island.quiet_frames = quiet ? island.quiet_frames + 1 : 0;
+            sleeps = island.quiet_frames >= sleep_frames;
+        }
+        if (sleeps) island.label = labels++;
+    }
+
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const Island& island = m_islands[findRoot(p)];
+        const uint32_t id = store.id[p];
+        const uint8_t asleep = island.label != no_island ? 1 : 0;
+        if (store.asleep[p] != asleep)
+        {
+            store.asleep[p] = asleep;
+            changed = true;
+        }
+        m_island_of[id] = island.label;
+        m_quiet_frames[id] = asleep ? 0 : island.quiet_frames;
+    }
+    m_sleeping_islands = labels;
+    return changed;
+}
@@ -0,0 +1,68 @@
+#ifndef SLEEP_HPP
+#define SLEEP_HPP
+
+#include "particle.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// a group of particles is quiet while they move less than sleep_motion per frame on average and none of them moves
+// sleep_max_motion, and it falls asleep after sleep_frames quiet frames in a row. averaged since a settled pile never
+// stops jittering by a tenth of a pixel here and there, and measured frame to frame rather than from the verlet
+// velocity, which the border clamp leaves pointing off the wall for particles resting against it
+constexpr float sleep_motion = 0.05f;
+constexpr float sleep_max_motion = 0.5f;
+constexpr uint32_t sleep_frames = 60;
+
+// particles closer than this times r1 + r2 are touching and belong to the same island
+constexpr float sleep_contact = 1.05f;
+
+
+// puts resting particles to sleep, for the broadphases that don't do it themselves.
+// touching particles form islands that sleep and wake as a whole: a sleeping particle doesn't push on the awake
+// ones under it, so a pile that is half asleep loses the weight on its awake half, which springs back and wakes the
+// rest again. an island with both sleeping and awake particles wakes up, so whatever lands on a sleeping pile or
+// gets woken in it wakes the pile.
+// the state is kept by particle id, so it survives the solver reordering the slots and removing particles
+class SleepTracker
+{
+private:
+    static constexpr uint32_t no_island = UINT32_MAX;
+    static constexpr uint32_t unknown_generation = UINT32_MAX;
+
+    struct Island
+    {
+        uint32_t awake = 0;
+        float total_motion = 0.0f;
+        float max_motion = 0.0f;
+        uint32_t quiet_frames = UINT32_MAX; // the fewest of all its awake particles
+        bool any_asleep = false;
+        uint32_t label = no_island;
+    };
+
+    // by id
+    std::vector<float> m_frame_x; // position at the previous update
+    std::vector<float> m_frame_y;
+    std::vector<uint32_t> m_quiet_frames;
+    std::vector<uint32_t> m_island_of; // island of every sleeping particle
+    std::vector<uint32_t> m_generation; // of the particle the rest was set up for
+    uint32_t m_sleeping_islands = 0;
+
+    // union find over the slots, followed by one node per sleeping island
+    std::vector<uint32_t> m_parent;
+    std::vector<Island> m_islands;
+
+    uint32_t findRoot(uint32_t n);
+
+    void unite(uint32_t a, uint32_t b);
+
+public:
+    // measures how far every awake particle moved since the last call and puts islands to sleep or wakes them,
+    // false if no particle changed state. pairs are the neighbour pairs, the touching ones make up the islands
+    bool update(ParticleStore& store, const std::vector<std::pair<uint32_t, uint32_t>>& pairs);
+
+    // forgets every island, e.g. after the particles were replaced. the sleep flags have to be cleared along with it
+    void reset();
+};
+
+#endif
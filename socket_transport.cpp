@@ -0,0 +1,232 @@
+#include "socket_transport.hpp"
+#include <chrono>
+#include <thread>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SocketTransport::~SocketTransport()
+{
+    close();
+}
+
+namespace
+{
+    // sent by the connecting side, so a stray connection isn't taken for the neighbour
+    struct Hello
+    {
+        uint32_t magic = 0x50435053; // "SPCP"
+        int32_t rank = 0;
+    };
+
+    void configure(int fd)
+    {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    int listenOn(uint16_t port, std::string& error)
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            error = "cannot create a socket";
+            return -1;
+        }
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 4) != 0)
+        {
+            error = "cannot listen on port " + std::to_string(port);
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // retries until the other rank is listening
+    int connectTo(const std::string& host, uint16_t port, std::chrono::steady_clock::time_point deadline, std::string& error)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found)
+        {
+            error = "cannot resolve " + host;
+            return -1;
+        }
+
+        int fd = -1;
+        while (fd < 0)
+        {
+            for (addrinfo* a = found; a && fd < 0; a = a->ai_next)
+            {
+                fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+                {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            if (fd >= 0 || std::chrono::steady_clock::now() > deadline) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        freeaddrinfo(found);
+
+        if (fd < 0) error = "cannot connect to " + host + ":" + std::to_string(port);
+        return fd;
+    }
+
+    // the accepted socket still blocks, so every read waits for data no longer than the deadline allows
+    bool receiveHello(int fd, Hello& hello, std::chrono::steady_clock::time_point deadline)
+    {
+        uint8_t* data = reinterpret_cast<uint8_t*>(&hello);
+        std::size_t received = 0;
+        while (received < sizeof(hello))
+        {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd waiting{fd, POLLIN, 0};
+            if (left.count() <= 0 || poll(&waiting, 1, static_cast<int>(left.count())) <= 0) return false;
+
+            const ssize_t got = recv(fd, data + received, sizeof(hello) - received, 0);
+            if (got <= 0) return false;
+            received += static_cast<std::size_t>(got);
+        }
+        return true;
+    }
+
+    int acceptFrom(int listener, int rank, std::chrono::steady_clock::time_point deadline, std::string& error)
+    {
+        for (;;)
+        {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd waiting{listener, POLLIN, 0};
+            if (left.count() <= 0 || poll(&waiting, 1, static_cast<int>(left.count())) <= 0)
+            {
+                error = "rank " + std::to_string(rank) + " never connected";
+                return -1;
+            }
+
+            const int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+
+            Hello hello;
+            Hello expected;
+            expected.rank = rank;
+            if (receiveHello(fd, hello, deadline) && hello.magic == expected.magic && hello.rank == expected.rank)
+            {
+                return fd;
+            }
+            ::close(fd);
+        }
+    }
+}
+
+bool SocketTransport::open(const std::vector<std::string>& hosts, uint16_t port, int rank, std::string& error,
+                           uint32_t timeout_ms)
+{
+    close();
+    const int rank_count = static_cast<int>(hosts.size());
+    if (rank < 0 || rank >= rank_count)
+    {
+        error = "socket transport: rank " + std::to_string(rank) + " of " + std::to_string(rank_count);
+        return false;
+    }
+    m_rank = rank;
+    m_rank_count = rank_count;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    // listening first, so the right neighbour can connect while this rank is still connecting to the left
+    int listener = -1;
+    if (rank + 1 < rank_count)
+    {
+        listener = listenOn(static_cast<uint16_t>(port + rank), error);
+        if (listener < 0) return false;
+    }
+
+    if (rank > 0)
+    {
+        m_left = connectTo(hosts[rank - 1], static_cast<uint16_t>(port + rank - 1), deadline, error);
+        Hello hello;
+        hello.rank = rank;
+        if (m_left < 0 || send(m_left, &hello, sizeof(hello), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello)))
+        {
+            if (listener >= 0) ::close(listener);
+            close();
+            return false;
+        }
+    }
+
+    if (listener >= 0)
+    {
+        m_right = acceptFrom(listener, rank + 1, deadline, error);
+        ::close(listener);
+        if (m_right < 0)
+        {
+            close();
+            return false;
+        }
+    }
+
+    if (m_left >= 0) configure(m_left);
+    if (m_right >= 0) configure(m_right);
+    m_ok = true;
+    return true;
+}
+
+void SocketTransport::close()
+{
+    if (m_left >= 0) ::close(m_left);
+    if (m_right >= 0) ::close(m_right);
+    m_left = -1;
+    m_right = -1;
+    m_ok = false;
+}
+
+int SocketTransport::socketFor(int peer) const
+{
+    if (peer == m_rank - 1) return m_left;
+    if (peer == m_rank + 1) return m_right;
+    return -1;
+}
+
+std::size_t SocketTransport::trySend(int peer, const uint8_t* data, std::size_t bytes)
+{
+    const int fd = socketFor(peer);
+    if (fd < 0 || !m_ok || bytes == 0) return 0;
+
+    const ssize_t sent = send(fd, data, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent > 0) return static_cast<std::size_t>(sent);
+
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    m_ok = false;
+    return 0;
+}
+
+std::size_t SocketTransport::tryReceive(int peer, uint8_t* data, std::size_t bytes)
+{
+    const int fd = socketFor(peer);
+    if (fd < 0 || !m_ok || bytes == 0) return 0;
+
+    const ssize_t received = recv(fd, data, bytes, MSG_DONTWAIT);
+    if (received > 0) return static_cast<std::size_t>(received);
+
+    // 0 is the peer closing the connection
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    m_ok = false;
+    return 0;
+}
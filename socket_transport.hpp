@@ -0,0 +1,45 @@
+#ifndef SOCKET_TRANSPORT_HPP
+#define SOCKET_TRANSPORT_HPP
+
+#include "transport.hpp"
+#include <string>
+
+// ranks on several hosts, over a tcp connection to each neighbouring rank. rank r listens on port + r and
+// connects to rank r - 1 at hosts[r - 1], so the ranks can be started in any order. posix only, it isn't built on windows
+class SocketTransport : public Transport
+{
+private:
+    int m_rank = 0;
+    int m_rank_count = 1;
+    int m_left = -1;  // connection to rank - 1
+    int m_right = -1; // connection to rank + 1
+    bool m_ok = false;
+
+    int socketFor(int peer) const;
+
+public:
+    SocketTransport() = default;
+    ~SocketTransport() override;
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    // hosts[r] is where rank r runs, one entry per rank. gives up after timeout_ms without both neighbours
+    bool open(const std::vector<std::string>& hosts, uint16_t port, int rank, std::string& error,
+              uint32_t timeout_ms = 30000);
+
+    void close();
+
+    int getRank() const override { return m_rank; }
+
+    int getRankCount() const override { return m_rank_count; }
+
+    std::size_t trySend(int peer, const uint8_t* data, std::size_t bytes) override;
+
+    std::size_t tryReceive(int peer, uint8_t* data, std::size_t bytes) override;
+
+    // a closed or reset connection turns this off
+    bool isOk() const override { return m_ok; }
+};
+
+#endif
@@ -1,107 +1,314 @@
 #include "solver.hpp"
-#include <chrono>
+#include "simd_kernels.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <numeric>
 
 
-Particle& Solver::addObject(const Vec2& p_position, float radius)
+ParticleHandle Solver::addObject(const Vec2& p_position, float radius)
 {
-    return objects.emplace_back(Particle(p_position, radius));
+    const uint32_t slot = objects.add(p_position, radius);
+    return ParticleHandle(&objects, objects.id[slot]);
 }
 
 void Solver::update()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-    
-    float substep_dt = dt / substeps;
-    
-    double gravity_time = 0, tree_time = 0, collision_time = 0, border_time = 0, update_time = 0;
-
-    // Build quadtree - TIME THIS
-    auto t_tree_start = std::chrono::high_resolution_clock::now();
-    updateTree();
-    auto t_tree_end = std::chrono::high_resolution_clock::now();
-    tree_time = std::chrono::duration<double, std::milli>(t_tree_end - t_tree_start).count();
-
-    std::vector<Particle*> nearby_particles;
-    nearby_particles.reserve(100);
-
-    std::vector<std::pair<Particle*, Particle*>> collision_pairs;
+    PROFILE_SCOPE("Solver::update");
 
-    int num_objects = objects.size();
-    
-    // Loop through all current particles in simulation
-    for (int i = 0; i < num_objects; i++) 
+    // a push from outside, like the mouse, wakes particles up in the middle of the frame, too late for the count to
+    // follow. it gets the usual count right away
+    if (adaptive.enabled && !pending_fields.empty() && substeps < settle_substeps)
     {
-        Particle* p_1 = &objects[i];
-
-        // Query in tree
-        nearby_particles.clear();
-        queryRange(p_1, root.get(), nearby_particles);
+        rescaleVelocities(substeps, settle_substeps);
+        substeps = settle_substeps;
+        calm_frames = 0;
+    }
 
-        // Loop through quadtree particles
-        for (auto& p_2 : nearby_particles)
-        { 
-            if (p_1 == p_2) continue;
-            if (p_2 < p_1) continue;
+    float substep_dt = dt / substeps;
     
-            collision_pairs.push_back({p_1, p_2});
-        }
+    uint64_t tree_time = 0, collision_time = 0, integrate_time = 0;
+
+    // the particles hardly move within a frame, so the long range forces are only evaluated once
+    if (nbody.enabled())
+    {
+        const uint64_t t0 = profiler::now();
+        barnes_hut.compute(objects, nbody, pool);
+        integrate_time += profiler::now() - t0;
     }
 
     // Physics substeps WITH collisions
     for (int i = 0; i < substeps; i++)
     {    
-        auto t1 = std::chrono::high_resolution_clock::now();
-        applyGravity();
-        auto t2 = std::chrono::high_resolution_clock::now();
-        
-        checkCollisions(collision_pairs);
-        auto t3 = std::chrono::high_resolution_clock::now();
+        PROFILE_SCOPE("substep");
+
+        if (substep_hook) substep_hook(*this, i);
+
+        // the neighbour list is only rebuilt once something moved more than half the skin
+        const uint64_t t0 = profiler::now();
+        if (neighbours.needsRebuild(objects))
+        {
+            rebuildNeighbours();
+        }
+        const uint64_t t1 = profiler::now();
+
+        // right after the check, while the broadphase is close enough to where the particles are. pairs between the
+        // sleepers a field woke up are missing from the list, which has to be made again then
+        if (applyForceFields(i == 0))
+        {
+            rebuildNeighbours();
+        }
+        const uint64_t t2 = profiler::now();
         
-        applyBorder(); 
-        auto t4 = std::chrono::high_resolution_clock::now();
+        checkCollisions();
+        const uint64_t t3 = profiler::now();
         
-        updateObjects(substep_dt);
-        auto t5 = std::chrono::high_resolution_clock::now();
+        // gravity, verlet step and border in one pass
+        integrate(substep_dt);
+        const uint64_t t4 = profiler::now();
         
-        gravity_time += std::chrono::duration<double, std::milli>(t2-t1).count();
-        collision_time += std::chrono::duration<double, std::milli>(t3-t2).count();
-        border_time += std::chrono::duration<double, std::milli>(t4-t3).count();
-        update_time += std::chrono::duration<double, std::milli>(t5-t4).count();
+        tree_time += t1 - t0;
+        collision_time += t3 - t2;
+        integrate_time += (t2 - t1) + (t4 - t3);
+    }
+
+    last_timings.substeps = substeps;
+    if (adaptive.enabled)
+    {
+        adaptSubsteps();
+    }
+
+    last_timings.tree_ms = tree_time * 1e-6;
+    last_timings.collision_ms = collision_time * 1e-6;
+    last_timings.integrate_ms = integrate_time * 1e-6;
+    last_timings.rebuilds = neighbours.takeRebuildCount();
+    last_timings.resorts = resorts;
+    resorts = 0;
+
+    // islands that stopped moving go to sleep, and the ones something moved into wake up
+    bool sleep_changed = false;
+    if (sleeping)
+    {
+        sleep_changed = broadphase->tracksSleep() ? broadphase->updateSleep(objects)
+                                                  : sleep_tracker.update(objects, neighbours.getPairs());
+    }
+    if (sleep_changed)
+    {
+        updateAwakeRuns();
+        neighbours.invalidate();
+    }
+
+    removeExpired();
+    if (awake_runs_size != objects.size())
+    {
+        updateAwakeRuns();
     }
+    last_timings.asleep = asleep_count;
+    rebuilds_since_report += last_timings.rebuilds;
+    substeps_since_report += last_timings.substeps;
     
-    static int frame_count = 0;
-    if (++frame_count % 60 == 0) {
-        std::cout << "\n=== PERFORMANCE (" << objects.size() << " particles, " << substeps << " substeps) ===\n";
-        std::cout << "  UpdateTree:  " << tree_time << " ms (1x per frame)\n";
-        std::cout << "  Gravity:     " << gravity_time << " ms\n";
-        std::cout << "  Collisions:  " << collision_time << " ms\n";
-        std::cout << "  Border:      " << border_time << " ms\n";
-        std::cout << "  UpdateObjs:  " << update_time << " ms\n";
-        std::cout << "  TOTAL:       " << (gravity_time + tree_time + collision_time + border_time + update_time) << " ms\n\n";
+    if (++frame_count % 60 == 0)
+    {
+        if (performance_report)
+        {
+            std::cout << "\n=== PERFORMANCE (" << objects.size() << " particles, ";
+            if (adaptive.enabled) std::cout << substeps_since_report / 60.0 << " substeps adaptive, ";
+            else                  std::cout << substeps << " substeps, ";
+            std::cout << broadphaseName(broadphase->type()) << ", " << pool.getThreadCount() << " threads) ===\n";
+            std::cout << "  UpdateTree:  " << last_timings.tree_ms << " ms (" << rebuilds_since_report << " rebuilds in 60 frames, "
+                      << neighbours.getPairs().size() << " pairs, index spread " << pair_spread << ")\n";
+            std::cout << "  Collisions:  " << last_timings.collision_ms << " ms (" << contacts.getBatchCount() << " batches)\n";
+            std::cout << "  Integrate:   " << last_timings.integrate_ms << " ms (" << simdLevelName(getSimdLevel()) << ")\n";
+            std::cout << "  TOTAL:       " << last_timings.total() << " ms\n";
+
+            // spread over the last frames instead of only the latest one
+            if (profiler::compiled_in)
+            {
+                profiler::printPhaseStats(std::cout);
+                profiler::reset();
+            }
+            std::cout << "\n";
+        }
+        rebuilds_since_report = 0;
+        substeps_since_report = 0;
+    }
+}
+
+void Solver::integrate(float dt)
+{
+    IntegrateParams params;
+    params.dt = dt;
+    params.gravity_x = gravity.x;
+    params.gravity_y = gravity.y;
+    params.border = world_border;
+    params.min_x = world_min.x;
+    params.min_y = world_min.y;
+    params.max_x = world_max.x;
+    params.max_y = world_max.y;
+
+    PROFILE_SCOPE("integrate");
+    if (awake_runs_size != objects.size())
+    {
+        updateAwakeRuns();
+    }
+    const float* nx = nullptr;
+    const float* ny = nullptr;
+    if (nbody.enabled() && !barnes_hut.getAccelerationX().empty())
+    {
+        // particles that arrived in the middle of the frame feel nothing until the next one
+        barnes_hut.resize(objects.size());
+    }
+    if (nbody.enabled() && barnes_hut.getAccelerationX().size() == objects.size())
+    {
+        nx = barnes_hut.getAccelerationX().data();
+        ny = barnes_hut.getAccelerationY().data();
+    }
+
+    pool.parallelFor(awake_before.back(), integrate_grain, [&](uint32_t begin, uint32_t end)
+    {
+        // the run the chunk starts in, then every run it reaches into
+        std::size_t r = std::upper_bound(awake_before.begin(), awake_before.end() - 1, begin) - awake_before.begin() - 1;
+        for (; r < awake_runs.size() && awake_before[r] < end; r++)
+        {
+            const uint32_t first = awake_runs[r].first + (std::max(begin, awake_before[r]) - awake_before[r]);
+            const uint32_t last = awake_runs[r].first + (std::min(end, awake_before[r + 1]) - awake_before[r]);
+            if (nx)
+            {
+                for (uint32_t i = first; i < last; i++)
+                {
+                    objects.ax[i] += nx[i];
+                    objects.ay[i] += ny[i];
+                }
+            }
+            integrateParticles(objects, first, last, params);
+        }
+    });
+}
+
+void Solver::updateAwakeRuns()
+{
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    awake_runs.clear();
+    asleep_count = 0;
+
+    uint32_t begin = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!objects.asleep[i]) continue;
+
+        if (begin < i) awake_runs.push_back({begin, i});
+        begin = i + 1;
+        asleep_count++;
     }
+    if (begin < count) awake_runs.push_back({begin, count});
+    awake_runs_size = count;
+
+    awake_before.clear();
+    awake_before.push_back(0);
+    for (const auto& run : awake_runs)
+    {
+        awake_before.push_back(awake_before.back() + (run.second - run.first));
+    }
+}
+
+void Solver::wakeAll()
+{
+    std::fill(objects.asleep.begin(), objects.asleep.end(), 0);
+    awake_runs_size = SIZE_MAX;
 }
 
-void Solver::applyGravity()
+void Solver::wakeParticle(uint32_t i)
 {
-    for (auto &particle : objects)
-        particle.accelerate(gravity);
+    if (!objects.asleep[i]) return;
+
+    objects.asleep[i] = 0;
+    broadphase->wake(objects, i);
+    awake_runs_size = SIZE_MAX;
+    neighbours.invalidate(); // its pairs with other sleepers are missing
 }
 
-void Solver::updateObjects(float dt)
+void Solver::setSleeping(bool enabled)
 {
-    for (auto &particle : objects)
-        particle.update(dt);
+    if (sleeping == enabled) return;
+
+    sleeping = enabled;
+    wakeAll();
+    broadphase->reset();
+    sleep_tracker.reset();
+    neighbours.invalidate();
 }
 
-void Solver::updateTree()
+void Solver::rebuildNeighbours()
 {
-    clear(root.get());
-    initialize_root();
-    for (auto& particle : objects)
+    if (resortDue())
+    {
+        resort();
+    }
+
+    updateTree();
+
+    pair_spread = pairIndexSpread(neighbours.getPairs());
+    if (sorted_spread == 0.0f)
+    {
+        sorted_spread = pair_spread;
+    }
+}
+
+bool Solver::resortDue() const
+{
+    if (!morton_resort || objects.size() < resort_min_particles) return false;
+    if (sorted_spread < 0.0f) return true;
+    if (frame_count < last_resort_frame + resort_min_frames) return false;
+
+    return pair_spread > resort_decay * sorted_spread;
+}
+
+void Solver::resort()
+{
+    PROFILE_SCOPE("Solver::resort");
+
+    objects.reorder(sorter.sort(objects, pool));
+    broadphase->reset();
+    if (nbody.enabled())
     {
-        insert(&particle, root.get());
+        barnes_hut.compute(objects, nbody, pool); // the accelerations are by slot
     }
+    awake_runs_size = SIZE_MAX; // the sleep flags moved along with the particles
+    neighbours.invalidate();
+
+    sorted_spread = 0.0f; // measured on the next neighbour list
+    last_resort_frame = frame_count;
+    resorts++;
+}
+
+void Solver::updateTree()
+{
+    PROFILE_SCOPE("Solver::updateTree");
+    neighbours.rebuild(objects, *broadphase);
+    contacts.colour(objects.size(), neighbours.getPairs());
+}
+
+void Solver::setBroadphase(BroadphaseType type)
+{
+    if (broadphase->type() == type) return;
+
+    broadphase = makeBroadphase(type, &pool);
+    wakeAll();
+    neighbours.invalidate();
+}
+
+BroadphaseType Solver::getBroadphaseType() const
+{
+    return broadphase->type();
+}
+
+const Quadtree* Solver::getQuadtree() const
+{
+    if (broadphase->type() != BroadphaseType::Quadtree) return nullptr;
+
+    return &static_cast<const QuadtreeBroadphase*>(broadphase.get())->getTree();
 }
 
 // void Solver::updateTree()
@@ -121,62 +328,180 @@ void Solver::updateTree()
 //     }
 // }
 
-const std::deque<Particle>& Solver::getObjects() const
+const ParticleStore& Solver::getObjects() const
 {
     return objects;
 }
 
-//for circle boundary
-void Solver::applyBoundary()
+void Solver::setObjects(ParticleStore p_objects)
 {
-    for (auto &particle : objects)
+    objects = std::move(p_objects);
+    if (!objects.rebuildSlots())
     {
-        const Vec2 r = boundary_center - particle.m_position; 
-        const float dist = sqrt(r.x * r.x + r.y * r.y); 
+        objects.resetIds();
+    }
+    objects.asleep.assign(objects.size(), 0);
+    objects.expires.resize(objects.size(), std::numeric_limits<float>::infinity());
+    lifetimes = std::any_of(objects.expires.begin(), objects.expires.end(), [](float t) { return std::isfinite(t); });
+    removed_spots.clear();
+    broadphase->reset();
+    sleep_tracker.reset();
+    awake_runs_size = SIZE_MAX;
+    neighbours.invalidate();
+    sorted_spread = -1.0f;
+}
 
+bool Solver::removeObjects(const std::vector<uint8_t>& remove)
+{
+    if (remove.size() != objects.size()) return false;
 
-        if (dist > boundary_radius - particle.m_radius)
-        {
-            const Vec2 normal_v = r / dist;
-            const Vec2 perp = {-normal_v.y, normal_v.x};
-            const Vec2 velocity = particle.getVelocity();
-            particle.m_position = boundary_center - normal_v * (boundary_radius - particle.m_radius);
-            particle.setVelocity(calculateBounceBack(velocity, perp), 1.0f);
-            
-        }
+    for (uint32_t i = 0; i < objects.size(); i++)
+    {
+        if (remove[i]) noteRemoved(i);
     }
+    barnes_hut.removeFlagged(remove);
+    objects.removeFlagged(remove);
+    forgetSlots();
+    return true;
 }
 
-//for circle boundary
-void Solver::applyBorder()
+bool Solver::removeObject(ParticleHandle particle)
 {
-    for (auto &particle : objects)
-    {
-        const float dampening = 0.75f;
-        const Vec2 pos = particle.m_position;
+    if (!particle.valid()) return false;
+
+    const uint32_t slot = particle.index();
+    noteRemoved(slot);
+    barnes_hut.removeSwap(slot, objects.size());
+    objects.removeSwap(slot);
+    forgetSlots();
+    return true;
+}
 
-        Vec2 npos = particle.m_position;
-        Vec2 vel = particle.getVelocity();
-        Vec2 dy = {vel.x * dampening, -vel.y};
-        Vec2 dx = {-vel.x * dampening, vel.y};
+void Solver::noteRemoved(uint32_t i)
+{
+    // nothing to wake up otherwise
+    if (sleeping) removed_spots.push_back({objects.getPosition(i), objects.radius[i]});
+}
+
+void Solver::forgetSlots()
+{
+    broadphase->reset();
+    awake_runs_size = SIZE_MAX;
+    neighbours.invalidate();
+}
+
+bool Solver::setObjectLifetime(ParticleHandle particle, float seconds)
+{
+    if (!particle.valid()) return false;
 
-        if (pos.x < particle.m_radius || pos.x + particle.m_radius > window_size) // reflect off left/right
+    objects.expires[particle.index()] = getTime() + seconds;
+    lifetimes = true;
+    return true;
+}
+
+void Solver::removeExpired()
+{
+    last_timings.removed = 0;
+    const bool sinks = std::any_of(force_fields.begin(), force_fields.end(),
+                                   [](const auto& entry) { return entry.second.type == ForceFieldType::Sink; });
+    if (!lifetimes && !sinks) return;
+
+    PROFILE_SCOPE("Solver::removeExpired");
+
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    expired.assign(count, 0);
+    uint32_t removed = 0;
+    if (lifetimes)
+    {
+        // the time at the end of this frame
+        const float now = getTime() + dt;
+        for (uint32_t i = 0; i < count; i++)
         {
-            if (pos.x < particle.m_radius) npos.x = particle.m_radius;
-            if (pos.x + particle.m_radius > window_size) npos.x = window_size - particle.m_radius;
-            particle.m_position = npos;
-            particle.setVelocity(dx, 1.0);
+            expired[i] = objects.expires[i] <= now ? 1 : 0;
+            removed += expired[i];
         }
-        if (pos.y < particle.m_radius || pos.y + particle.m_radius > window_size) //reflect off top and bottom
+    }
+
+    // the broadphase is from the last rebuild, a particle that only just got inside may be left for the next frame
+    for (const auto& entry : force_fields)
+    {
+        const ForceField& field = entry.second;
+        if (field.type != ForceFieldType::Sink) continue;
+
+        field_hits.clear();
+        broadphase->queryRadius(objects, field.position.x, field.position.y, field.radius, field_hits);
+        for (uint32_t i : field_hits)
         {
-            if (pos.y < particle.m_radius) npos.y = particle.m_radius;
-            if (pos.y + particle.m_radius > window_size) npos.y = window_size - particle.m_radius;
-            particle.m_position = npos;
-            particle.setVelocity(dy, 1.0);
+            removed += expired[i] ? 0 : 1;
+            expired[i] = 1;
         }
-        
+    }
 
+    if (removed > 0)
+    {
+        removeObjects(expired);
+    }
+    last_timings.removed = removed;
+}
+
+bool Solver::wakeRemovedSpots()
+{
+    if (removed_spots.empty()) return false;
+
+    bool woke = false;
+    if (asleep_count > 0)
+    {
+        // anything resting on a removed particle may be bigger than it
+        const float largest = objects.radius.empty() ? 0.0f : *std::max_element(objects.radius.begin(), objects.radius.end());
+        for (const auto& spot : removed_spots)
+        {
+            field_hits.clear();
+            broadphase->queryRadius(objects, spot.first.x, spot.first.y, sleep_contact * (spot.second + largest), field_hits);
+            for (uint32_t i : field_hits)
+            {
+                woke = woke || objects.asleep[i];
+                wakeParticle(i);
+            }
+        }
     }
+    removed_spots.clear();
+    return woke;
+}
+
+//for circle boundary
+void Solver::applyBoundary()
+{
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    pool.parallelFor(count, integrate_grain, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            if (objects.asleep[i]) continue;
+
+            const float radius = objects.radius[i];
+            const Vec2 r = boundary_center - objects.getPosition(i);
+            const float dist = std::sqrt(r.x * r.x + r.y * r.y);
+            if (dist > boundary_radius - radius)
+            {
+                const Vec2 normal_v = r / dist;
+                const Vec2 perp = {-normal_v.y, normal_v.x};
+                const Vec2 velocity = objects.getVelocity(i);
+                objects.setPosition(i, boundary_center - normal_v * (boundary_radius - radius));
+                objects.setVelocity(i, calculateBounceBack(velocity, perp), 1.0f);
+            }
+        }
+    });
+}
+
+void Solver::setWorldBounds(const Vec2& min, const Vec2& max)
+{
+    world_min = min;
+    world_max = max;
+}
+
+void Solver::setWorldBorder(bool enabled)
+{
+    world_border = enabled;
 }
 
 Vec2 Solver::calculateBounceBack(const Vec2& p_velocity, const Vec2& p_normal_col)
@@ -201,59 +526,261 @@ void Solver::setBoundary(const Vec2& position, float radius)
 
 void Solver::mousePull(const Vec2& position)
 {
-    for (auto &particle : objects)
+    ForceField field;
+    field.type = ForceFieldType::Attractor;
+    field.position = position;
+    applyForceFieldOnce(field);
+}
+
+void Solver::mousePush(const Vec2& position)
+{
+    ForceField field;
+    field.type = ForceFieldType::Repulsor;
+    field.position = position;
+    applyForceFieldOnce(field);
+}
+
+void Solver::applyForceFieldOnce(const ForceField& field)
+{
+    pending_fields.push_back(field);
+}
+
+uint32_t Solver::addForceField(const ForceField& field)
+{
+    force_fields.push_back({next_force_field, field});
+    return next_force_field++;
+}
+
+bool Solver::setForceField(uint32_t id, const ForceField& field)
+{
+    for (auto& entry : force_fields)
     {
-        Vec2 dir = position - particle.m_position;
-        float distance = sqrt(dir.x * dir.x + dir.y * dir.y);
-        particle.accelerate(dir * std::max(0.0f, 10 * (120 - distance)));
+        if (entry.first != id) continue;
 
+        entry.second = field;
+        return true;
     }
+    return false;
 }
 
-void Solver::mousePush(const Vec2& position)
+void Solver::removeForceField(uint32_t id)
+{
+    force_fields.erase(std::remove_if(force_fields.begin(), force_fields.end(),
+                                      [&](const auto& entry) { return entry.first == id; }),
+                       force_fields.end());
+}
+
+void Solver::clearForceFields()
+{
+    force_fields.clear();
+    pending_fields.clear();
+}
+
+bool Solver::applyForceField(const ForceField& field)
 {
-    for (auto &particle : objects)
+    field_hits.clear();
+    broadphase->queryRadius(objects, field.position.x, field.position.y, field.radius, field_hits);
+
+    bool woke = false;
+    for (uint32_t i : field_hits)
     {
-        Vec2 dir = position - particle.m_position;
-        float distance = sqrt(dir.x * dir.x + dir.y * dir.y);
-        particle.accelerate(dir * std::min(0.0f, -10 * (120 - distance)));
+        woke = woke || objects.asleep[i];
+        wakeParticle(i);
+        objects.accelerate(i, forceFieldAcceleration(field, objects.getPosition(i)));
     }
+    return woke;
+}
+
+bool Solver::applyForceFields(bool first_substep)
+{
+    bool woke = false;
+    for (const auto& entry : force_fields)
+    {
+        if (entry.second.type == ForceFieldType::Sink) continue;
+        woke = applyForceField(entry.second) || woke;
+    }
+    if (first_substep)
+    {
+        for (const ForceField& field : pending_fields)
+        {
+            if (field.type == ForceFieldType::Sink) continue;
+            woke = applyForceField(field) || woke;
+        }
+        pending_fields.clear();
+        woke = wakeRemovedSpots() || woke;
+    }
+    return woke;
 }
 
 
-void Solver::setObjectVelocity(Particle& particle, Vec2 v)
-{   
+bool Solver::setObjectVelocity(ParticleHandle particle, Vec2 v)
+{
+    if (!particle.valid()) return false;
+
+    wakeParticle(particle.index());
     particle.setVelocity(v, 1.0f);
+    return true;
+}
+
+void Solver::checkCollisions()
+{
+    PROFILE_SCOPE("Solver::checkCollisions");
+    contacts.solve(objects, pool);
+}
+
+void Solver::setThreadCount(unsigned thread_count)
+{
+    pool.setThreadCount(thread_count);
+}
+
+unsigned Solver::getThreadCount() const
+{
+    return pool.getThreadCount();
 }
 
-void Solver::checkCollisions(std::vector<std::pair<Particle*, Particle*>>& collision_pairs)
+void Solver::setSubsteps(int count)
 {
-    for (auto& pair : collision_pairs)
-    { 
-        Particle* p_1 = pair.first;
-        Particle* p_2 = pair.second;
+    substeps = std::max(count, 1);
+    settle_substeps = substeps;
+}
+
+void Solver::setAdaptiveSubsteps(const AdaptiveSubsteps& settings)
+{
+    adaptive = settings;
+    adaptive.min_substeps = std::max(adaptive.min_substeps, 1);
+    adaptive.max_substeps = std::max(adaptive.max_substeps, adaptive.min_substeps);
+    raised_overlap = -1.0f;
+    if (adaptive.enabled)
+    {
+        substeps = std::min(std::max(substeps, adaptive.min_substeps), adaptive.max_substeps);
+    }
+}
 
-        // Compare pointers, not indices!
-        if (p_1 == p_2) continue;
+void Solver::adaptSubsteps()
+{
+    PROFILE_SCOPE("Solver::adaptSubsteps");
 
-        if (p_2 < p_1) continue; // avoid double checking pairs
+    // maxima by block, so the pool can split them up and the result doesn't depend on how it did. particles and pairs
+    // go in one loop, the work is far too little to wake the pool twice
+    constexpr uint32_t block_size = 16384;
 
-        Vec2 v = p_1->m_position - p_2->m_position;
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    const uint32_t particle_blocks = count == 0 ? 0 : (count - 1) / block_size + 1;
+    block_travel.assign(particle_blocks, 0.0f);
 
-        float distance = sqrt(v.x * v.x + v.y * v.y);
-        float min_distance = p_1->m_radius + p_2->m_radius;
+    // pairs of two sleepers aren't in the list, and they don't move anyway
+    const auto& pairs = neighbours.getPairs();
+    const uint32_t pair_count = static_cast<uint32_t>(pairs.size());
+    const uint32_t pair_blocks = pair_count == 0 ? 0 : (pair_count - 1) / block_size + 1;
+    block_overlap.assign(pair_blocks, 0.0f);
 
-        if (distance < min_distance)
+    pool.parallelFor(particle_blocks + pair_blocks, 1, [&](uint32_t first_block, uint32_t last_block)
+    {
+        for (uint32_t b = first_block; b < last_block; b++)
         {
-            Vec2 n = v / distance;
-            float total_mass = p_1->m_radius * p_1->m_radius + p_2->m_radius * p_2->m_radius;
-            float mass_ratio = (p_1->m_radius *  p_2->m_radius) / total_mass;
-            float delta = 0.5f * (min_distance - distance);
+            float most = 0.0f;
+            if (b < particle_blocks)
+            {
+                // squared, relative to the squared radius
+                const uint32_t end = std::min(count, (b + 1) * block_size);
+                for (uint32_t i = b * block_size; i < end; i++)
+                {
+                    if (objects.asleep[i]) continue;
+
+                    const float vx = objects.x[i] - objects.last_x[i];
+                    const float vy = objects.y[i] - objects.last_y[i];
+                    const float r = objects.radius[i];
+                    most = std::max(most, (vx * vx + vy * vy) / (r * r));
+                }
+                block_travel[b] = most;
+                continue;
+            }
+
+            const uint32_t pair_block = b - particle_blocks;
+            const uint32_t end = std::min(pair_count, (pair_block + 1) * block_size);
+            for (uint32_t k = pair_block * block_size; k < end; k++)
+            {
+                const uint32_t i = pairs[k].first;
+                const uint32_t j = pairs[k].second;
+                const float dx = objects.x[i] - objects.x[j];
+                const float dy = objects.y[i] - objects.y[j];
+                const float reach = objects.radius[i] + objects.radius[j];
+                const float dist2 = dx * dx + dy * dy;
+                if (dist2 >= reach * reach) continue;
+
+                most = std::max(most, (reach - std::sqrt(dist2)) / std::min(objects.radius[i], objects.radius[j]));
+            }
+            block_overlap[pair_block] = most;
+        }
+    });
+
+    const float travel = std::sqrt(std::accumulate(block_travel.begin(), block_travel.end(), 0.0f,
+                                                   [](float a, float b) { return std::max(a, b); }));
+    const float overlap = std::accumulate(block_overlap.begin(), block_overlap.end(), 0.0f,
+                                          [](float a, float b) { return std::max(a, b); });
+    last_timings.travel = travel;
+    last_timings.overlap = overlap;
+
+    // what the frame moved, spread over as many substeps as keep every step short enough. a fast particle could
+    // tunnel in the next frame already, so this one applies right away. it stops at the count set with setSubsteps:
+    // particles flung around by force fields want more for as long as they fly, and the fixed count lets them be
+    const int moved = static_cast<int>(std::ceil(travel * static_cast<float>(substeps) / adaptive.max_travel));
+    const int wanted = std::min(moved, settle_substeps);
+
+    // the overlap a pile rests at hardly depends on the count, and a particle landing on it makes a spike every few
+    // frames whatever the count. chasing either would pin the count at the maximum. so after one step up, the next
+    // needs the overlap a tenth below the one of the last, which fades a little every frame. an overlap that doesn't
+    // get better soon stops the climb, until nothing awake touches any more
+    constexpr float overlap_fade = 0.98f;
+    const bool touching = overlap > 0.0f;
+    raised_overlap = touching ? raised_overlap * overlap_fade : -1.0f;
+    int next = std::max(wanted, substeps);
+    if (overlap > adaptive.max_overlap && (raised_overlap < 0.0f || overlap < 0.9f * raised_overlap))
+    {
+        next = std::max(next, substeps + 1);
+        raised_overlap = overlap;
+    }
 
-            p_1->m_position += n * (1 - mass_ratio) * delta;
-            p_2->m_position -= n * mass_ratio * delta;
+    // what was added on top of the count set with setSubsteps goes again once the overlap is back under the limit.
+    // below that count it has to stay under half of it. and a pile with fewer substeps than the usual count jitters
+    // and never falls asleep, so while awake particles touch, every step below it waits settle_frames, long enough
+    // for a quiet pile to sleep. one that stays awake, like an n-body clump, still comes down after that
+    const bool above = substeps > settle_substeps;
+    const float calm_overlap = above ? adaptive.max_overlap : 0.5f * adaptive.max_overlap;
+    const uint32_t needed_calm = sleeping && touching && !above ? adaptive.settle_frames : adaptive.calm_frames;
+    if (next > substeps || wanted >= substeps || overlap > calm_overlap)
+    {
+        calm_frames = 0;
+    }
+    else if (++calm_frames >= needed_calm)
+    {
+        next = substeps - 1;
+        calm_frames = 0;
+    }
 
+    // an overlap over half the limit below the usual count goes straight back to the count set with setSubsteps
+    if (overlap > 0.5f * adaptive.max_overlap)
+    {
+        next = std::max(next, settle_substeps);
+    }
+    next = std::min(std::max(next, adaptive.min_substeps), adaptive.max_substeps);
+    if (next != substeps)
+    {
+        rescaleVelocities(substeps, next);
+        substeps = next;
+    }
+}
 
+void Solver::rescaleVelocities(int old_substeps, int new_substeps)
+{
+    const float scale = static_cast<float>(old_substeps) / static_cast<float>(new_substeps);
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    pool.parallelFor(count, integrate_grain, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            objects.last_x[i] = objects.x[i] - (objects.x[i] - objects.last_x[i]) * scale;
+            objects.last_y[i] = objects.y[i] - (objects.y[i] - objects.last_y[i]) * scale;
         }
-    }
-}
\ No newline at end of file
+    });
+}
@@ -2,33 +2,207 @@
 #define SOLVER_HPP
 
 #include <iostream>
+#include <functional>
 #include <vector>
 #include <array>
-#include <deque>
 #include "particle.hpp"
 #include "quadtree.hpp"
+#include "broadphase.hpp"
+#include "neighbour_list.hpp"
+#include "contact_solver.hpp"
+#include "thread_pool.hpp"
+#include "morton.hpp"
+#include "sleep.hpp"
+#include "nbody.hpp"
+#include "force_field.hpp"
+
+// wall clock time spent in each phase of one Solver::update
+struct FrameTimings
+{
+    double tree_ms = 0.0;
+    double collision_ms = 0.0;
+    double integrate_ms = 0.0;
+    uint32_t rebuilds = 0; // neighbour list rebuilds during the frame
+    uint32_t resorts = 0;  // morton reorders of the particle storage during the frame
+    uint32_t asleep = 0;   // particles left out of integration at the end of the frame
+    uint32_t removed = 0;  // past their lifetime or inside a sink, at the end of the frame
+    int substeps = 0;      // the frame ran with
+
+    // measured for adaptive substeps only: the furthest an awake particle moved in one substep, relative to its radius,
+    // and the deepest overlap left at the end of the frame, relative to the smaller radius
+    float travel = 0.0f;
+    float overlap = 0.0f;
+
+    double total() const { return tree_ms + collision_ms + integrate_ms; }
+};
+
+// picks the substep count of every frame from the frame before, between min_substeps and max_substeps. enough
+// that no particle would travel more than max_travel of its radius in one substep, so fast ones don't tunnel, but
+// never more than the fixed count for that alone, and one more for a deepest overlap at the end of a frame above
+// max_overlap, as long as each step up took it a tenth lower than the last. the count goes down by one after
+// calm_frames frames in a row that would have done with fewer and stayed below the overlap, or below half of it
+// under the fixed count. an overlap above half goes straight back to the fixed count, and while awake particles
+// touch, each step under it waits settle_frames, long enough for a pile to fall asleep first: with fewer substeps it
+// jitters and never does.
+// the defaults are about what a fixed 8 substeps give in the example scenarios: particles landing on a pile travel
+// up to about one radius per substep and overlap by about as much
+struct AdaptiveSubsteps
+{
+    bool enabled = false;
+    int min_substeps = 2;
+    int max_substeps = 16;
+    float max_travel = 1.0f;
+    float max_overlap = 1.0f;
+    uint32_t calm_frames = 20; // in a row before the count goes down by one
+    uint32_t settle_frames = 240; // the same for the first step under the fixed count while awake particles touch
+};
 
 class Solver
 {
+public:
+    // runs at the start of every substep with its index, before the neighbour list is checked
+    using SubstepHook = std::function<void(Solver&, int)>;
+
 private:
-    std::deque<Particle> objects;
+    // extra reach on top of r1 + r2 when gathering neighbours
+    static constexpr float neighbour_skin = 4.0f;
+
+    ParticleStore objects;
+
+    // before the broadphase, which may build on it
+    ThreadPool pool;
+
+    std::unique_ptr<Broadphase> broadphase = makeBroadphase(BroadphaseType::Quadtree, &pool);
+
+    // pairs within r1 + r2 + skin, reused across substeps and frames until particles moved too far
+    NeighbourList neighbours{neighbour_skin};
+
+    // neighbour pairs split into batches that can be solved in parallel
+    ContactSolver contacts;
+
+    // particles per chunk of the integrate pass, a few microseconds of work, well above the cost of handing it out
+    static constexpr uint32_t integrate_grain = 8192;
+
+    // storage is reordered along a Z-order curve once neighbour pairs have drifted this much further
+    // apart in memory than right after the last sort, but not more often than every resort_min_frames.
+    // small scenes fit in cache anyway
+    static constexpr float resort_decay = 2.0f;
+    static constexpr uint64_t resort_min_frames = 30;
+    static constexpr std::size_t resort_min_particles = 4096;
+
+    MortonSorter sorter;
+    bool morton_resort = true;
+    float pair_spread = 0.0f;    // of the current neighbour list
+    float sorted_spread = -1.0f; // right after the last sort, 0 until measured, -1 while never sorted
+    uint64_t last_resort_frame = 0;
+    uint32_t resorts = 0;
+
+    uint32_t rebuilds_since_report = 0;
+    uint32_t substeps_since_report = 0;
+
+    FrameTimings last_timings;
+
+    uint64_t frame_count = 0;
+
+    // print the PERFORMANCE block every 60 frames
+    bool performance_report = true;
+
+    SubstepHook substep_hook;
    
 
     static constexpr float dt = 1.0f / 60;
-    static constexpr Vec2 gravity = Vec2(0.0f, 9.81f * 50.0f);
+    Vec2 gravity = Vec2(0.0f, 9.81f * 50.0f);
+
+    // forces between all particles, evaluated once per frame and applied in every substep
+    NBodySettings nbody;
+    BarnesHut barnes_hut;
+
+    // fields that act in every substep, with the ids handed out by addForceField
+    std::vector<std::pair<uint32_t, ForceField>> force_fields;
+    uint32_t next_force_field = 0;
+    std::vector<ForceField> pending_fields; // act in the first substep of the next update only
+    std::vector<uint32_t> field_hits;
+
+    // where particles were removed, with their radius. whatever touched them is woken up in the first substep of the
+    // next update, once the broadphase is rebuilt without them
+    std::vector<std::pair<Vec2, float>> removed_spots;
+
+    // set once a particle got a lifetime, nothing is checked before
+    bool lifetimes = false;
+    std::vector<uint8_t> expired;
 
-    static constexpr int substeps = 8; 
+    int substeps = 8; 
+
+    AdaptiveSubsteps adaptive;
+    int settle_substeps = 8; // the count from setSubsteps
+    uint32_t calm_frames = 0; // in a row that could have done with fewer substeps
+    float raised_overlap = -1.0f; // overlap when the count last went up for it, fading, negative while nothing touches
+    std::vector<float> block_travel; // per block of particles, then of pairs
+    std::vector<float> block_overlap;
+
+    // the rectangle particles bounce off the inside of, without the border the world has no bounds
+    Vec2 world_min = Vec2{0.0f, 0.0f};
+    Vec2 world_max = Vec2{800.0f, 800.0f};
+    bool world_border = true;
+
+    // slot ranges of the particles that are awake, recomputed when sleep flags change or particles are added
+    std::vector<std::pair<uint32_t, uint32_t>> awake_runs;
+    std::vector<uint32_t> awake_before; // awake particles in the runs before each one, plus the total at the end
+    std::size_t awake_runs_size = SIZE_MAX; // store size the runs were computed for
+    uint32_t asleep_count = 0;
+
+    // puts resting particles to sleep unless the broadphase does it itself
+    SleepTracker sleep_tracker;
+    bool sleeping = true;
 
-    static constexpr float window_size = 800.0f;
 
     Vec2 boundary_center = Vec2{420.0f, 420.0f};
     float boundary_radius = 100.0f;
 
     float boundary_attributes[3] = {0.0f, 0.0f, 0.0f}; // x, y, radius
 
-    void applyGravity();
+    // gravity, verlet integration and the world border, fused into one pass over every awake particle.
+    // the n-body forces are added first. split over the pool by awake particle, so a long run doesn't stay on
+    // one thread
+    void integrate(float dt);
+
+    void updateAwakeRuns();
+
+    // clears every sleep flag, after the slots were reordered or the broadphase that set them is gone
+    void wakeAll();
+
+    // for anything acting on a particle from outside, the rest of its island wakes up at the end of the frame
+    void wakeParticle(uint32_t i);
+
+    // updateTree, preceded by a morton resort when the ordering has decayed
+    void rebuildNeighbours();
+
+    // the particles inside come from the broadphase, which has to be up to date with the neighbour list.
+    // they are woken up, like anything else acting on them from outside. true if any of them was asleep
+    bool applyForceField(const ForceField& field);
+
+    // every added field but the sinks, plus the one-frame ones and the wake ups around removed particles in the first
+    // substep
+    bool applyForceFields(bool first_substep);
+
+    // wakes everything touching a removed particle, true if anything was asleep
+    bool wakeRemovedSpots();
+
+    // at the end of a frame, the particles past their lifetime and the ones inside a sink
+    void removeExpired();
+
+    void noteRemoved(uint32_t i);
+
+    // everything that holds slots has to start over after particles were removed
+    void forgetSlots();
+
+    bool resortDue() const;
 
-    void updateObjects(float dt);
+    // measures the frame that just ended and sets the substep count of the next one
+    void adaptSubsteps();
+
+    // keeps the velocity of every particle when the substep length changes, verlet stores it as a distance per step
+    void rescaleVelocities(int old_substeps, int new_substeps);
 
     Vec2 calculateBounceBack(const Vec2& p_velocity, const Vec2& p_normal_col);
 
@@ -36,31 +210,137 @@ private:
 public:
     Solver() = default;
 
-    Particle& addObject(const Vec2& p_position, float radius);
+    ParticleHandle addObject(const Vec2& p_position, float radius);
 
     void update();
 
-    const std::deque<Particle>& getObjects() const;
+    const ParticleStore& getObjects() const;
+
+    // swaps in a whole particle set, e.g. from a checkpoint. existing handles now refer to the new particles
+    void setObjects(ParticleStore p_objects);
+
+    // drops every particle whose flag is set, by slot. the others keep their order and their handles stay valid.
+    // false, and nothing removed, unless there is one flag per particle
+    bool removeObjects(const std::vector<uint8_t>& remove);
+
+    // drops one particle right away, the last one takes its slot. false if it was removed before
+    bool removeObject(ParticleHandle particle);
+
+    // removed at the end of the first frame that ends seconds from now. false if it was removed already
+    bool setObjectLifetime(ParticleHandle particle, float seconds);
+
+    // one hook at a time, an empty one removes it
+    void setSubstepHook(SubstepHook hook) { substep_hook = std::move(hook); }
 
-    // for a circle
+    // keeps the awake particles inside the circle of setBoundary, spread over the pool like the other passes
     void applyBoundary();
 
-    //this is for the borders of the window
-    void applyBorder();
+    // the border is clamped by the integrate kernel, see integrateParticles
+    void setWorldBounds(const Vec2& min, const Vec2& max);
 
+    // without a border particles are free to go anywhere, pick a broadphase that isn't limited to some area then
+    void setWorldBorder(bool enabled);
+
+    Vec2 getWorldMin() const { return world_min; }
+
+    Vec2 getWorldMax() const { return world_max; }
+
+    bool hasWorldBorder() const { return world_border; }
+
+    // rebuilds the broadphase and the neighbour list
     void updateTree();
 
+    void setBroadphase(BroadphaseType type);
+
+    BroadphaseType getBroadphaseType() const;
+
+    // the tree of the quadtree broadphase, nullptr while another broadphase is active
+    const Quadtree* getQuadtree() const;
+
     std::array<float, 3> getBoundary() const;
 
     void setBoundary(const Vec2& position, float radius);
 
+    // the default attractor and repulsor, for one frame
     void mousePull(const Vec2& position);
 
     void mousePush(const Vec2& position);
 
-    void setObjectVelocity(Particle& particle, Vec2 v);
+    // acts during the next update only, like a mouse button held for one frame. not for sinks
+    void applyForceFieldOnce(const ForceField& field);
+
+    // acts in every update until removed, returns its id. each field only visits the particles within its radius
+    uint32_t addForceField(const ForceField& field);
+
+    // false if there is no field with that id
+    bool setForceField(uint32_t id, const ForceField& field);
+
+    void removeForceField(uint32_t id);
+
+    void clearForceFields();
+
+    std::size_t getForceFieldCount() const { return force_fields.size(); }
+
+    // false if the particle was removed
+    bool setObjectVelocity(ParticleHandle particle, Vec2 v);
+
+    void checkCollisions();
+
+    // worker threads used by the solver, including the calling thread. 0 = hardware concurrency
+    void setThreadCount(unsigned thread_count);
+
+    unsigned getThreadCount() const;
+
+    // everything runs on the calling thread, see ThreadPool::setDeterministic
+    void setDeterministic(bool deterministic) { pool.setDeterministic(deterministic); }
+
+    bool isDeterministic() const { return pool.isDeterministic(); }
+
+    // the fixed count. adaptive substeps start from it, go above it only for overlaps and below it once the
+    // particles are calm, see AdaptiveSubsteps
+    void setSubsteps(int count);
+
+    void setAdaptiveSubsteps(const AdaptiveSubsteps& settings);
+
+    const AdaptiveSubsteps& getAdaptiveSubsteps() const { return adaptive; }
+
+    void setGravity(const Vec2& p_gravity) { gravity = p_gravity; }
+
+    Vec2 getGravity() const { return gravity; }
+
+    void setNBody(const NBodySettings& settings) { nbody = settings; }
+
+    const NBodySettings& getNBody() const { return nbody; }
+
+    // the count the next frame runs with
+    int getSubsteps() const { return substeps; }
+
+    // the count set with setSubsteps, the same as getSubsteps() unless adaptive substeps are on
+    int getFixedSubsteps() const { return settle_substeps; }
+
+    // simulated time advanced by one update()
+    static constexpr float getFrameDt() { return dt; }
+
+    // simulated seconds since frame 0
+    float getTime() const { return static_cast<float>(static_cast<double>(frame_count) * dt); }
+
+    uint64_t getFrameCount() const { return frame_count; }
+
+    void setFrameCount(uint64_t count) { frame_count = count; }
+
+    const FrameTimings& getLastFrameTimings() const { return last_timings; }
+
+    void setPerformanceReport(bool enabled) { performance_report = enabled; }
+
+    // reorders the particle storage along a Z-order curve right away, handles stay valid
+    void resort();
+
+    void setMortonResort(bool enabled) { morton_resort = enabled; }
+
+    // resting particles are left out of integration and collisions until something disturbs them, on by default
+    void setSleeping(bool enabled);
 
-    void checkCollisions(std::vector<std::pair<Particle*, Particle*>>& collision_pairs);
+    bool isSleeping() const { return sleeping; }
     
 
 
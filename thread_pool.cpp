@@ -0,0 +1,231 @@
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define PARTICLESIM_POOL_PAUSE() _mm_pause()
+#else
+#define PARTICLESIM_POOL_PAUSE() ((void)0)
+#endif
+
+namespace
+{
+    // how long a worker spins on the generation before it blocks. covers the gap between the loops of a substep but
+    // not the one between frames. a round count would depend on the cost of pause, anywhere from 10 to 140 cycles
+    constexpr uint64_t spin_ns = 50000;
+
+    uint64_t packRange(uint32_t begin, uint32_t end)
+    {
+        return static_cast<uint64_t>(end) << 32 | begin;
+    }
+
+    uint32_t rangeBegin(uint64_t bounds) { return static_cast<uint32_t>(bounds); }
+
+    uint32_t rangeEnd(uint64_t bounds) { return static_cast<uint32_t>(bounds >> 32); }
+
+    void cpuRelax(unsigned round)
+    {
+        // yield now and then, so a pool with more threads than cores doesn't starve the thread it waits on
+        if ((round & 63) == 63) std::this_thread::yield();
+        else PARTICLESIM_POOL_PAUSE();
+    }
+}
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+    setThreadCount(thread_count);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+void ThreadPool::setThreadCount(unsigned thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (thread_count == getThreadCount() && m_ranges) return;
+
+    stop();
+    start(thread_count - 1);
+}
+
+void ThreadPool::start(unsigned worker_count)
+{
+    m_stop.store(false);
+    m_thread_count = worker_count + 1;
+    m_ranges.reset(new ChunkRange[worker_count + 1]);
+    m_workers.reserve(worker_count);
+
+    const uint64_t generation = m_generation.load(std::memory_order_relaxed);
+    for (unsigned i = 0; i < worker_count; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i + 1, generation);
+    }
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop.store(true);
+    }
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+    m_workers.clear();
+}
+
+bool ThreadPool::takeChunk(unsigned index, uint32_t& chunk)
+{
+    auto& bounds = m_ranges[index].bounds;
+    uint64_t current = bounds.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        const uint32_t begin = rangeBegin(current);
+        const uint32_t end = rangeEnd(current);
+        if (begin >= end) return false;
+
+        if (bounds.compare_exchange_weak(current, packRange(begin + 1, end), std::memory_order_relaxed))
+        {
+            chunk = begin;
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::stealChunks(unsigned index)
+{
+    const unsigned thread_count = m_thread_count;
+    for (unsigned i = 1; i < thread_count; i++)
+    {
+        auto& victim = m_ranges[(index + i) % thread_count].bounds;
+        uint64_t current = victim.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const uint32_t begin = rangeBegin(current);
+            const uint32_t end = rangeEnd(current);
+            if (begin >= end) break;
+
+            // the back half, rounded up so a single chunk left can be stolen too
+            const uint32_t split = end - (end - begin + 1) / 2;
+            if (victim.compare_exchange_weak(current, packRange(begin, split), std::memory_order_relaxed))
+            {
+                // only the owner writes its range while it is empty, a thief seeing the old empty value gives up
+                m_ranges[index].bounds.store(packRange(split, end), std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runChunks(unsigned index)
+{
+    const auto& job = *m_job;
+    const uint32_t count = m_count;
+    const uint32_t grain = m_grain;
+
+    uint32_t chunk;
+    do
+    {
+        while (takeChunk(index, chunk))
+        {
+            const uint32_t begin = chunk * grain;
+            job(begin, std::min(begin + grain, count));
+        }
+    } while (stealChunks(index));
+}
+
+void ThreadPool::workerLoop(unsigned index, uint64_t seen)
+{
+    if (profiler::compiled_in)
+    {
+        profiler::setThreadName("worker " + std::to_string(index));
+    }
+
+    for (;;)
+    {
+        uint64_t generation = m_generation.load(std::memory_order_acquire);
+        const uint64_t spin_start = profiler::now();
+        for (unsigned round = 0; generation == seen; round++)
+        {
+            if (m_stop.load(std::memory_order_relaxed)) return;
+            // the clock is only read as often as cpuRelax yields
+            if ((round & 63) == 63 && profiler::now() - spin_start >= spin_ns) break;
+            cpuRelax(round);
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        if (generation == seen)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] {
+                return m_stop.load(std::memory_order_relaxed) || m_generation.load(std::memory_order_acquire) != seen;
+            });
+            if (m_stop.load(std::memory_order_relaxed)) return;
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        seen = generation;
+
+        {
+            // time from the wake up to the last chunk, gaps between these show imbalance
+            PROFILE_SCOPE("pool worker");
+            runChunks(index);
+        }
+
+        m_busy.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn)
+{
+    if (count == 0) return;
+    grain = std::max(grain, 1u);
+
+    // not worth waking anyone up
+    if (m_workers.empty() || m_deterministic || count <= grain)
+    {
+        fn(0, count);
+        return;
+    }
+
+    PROFILE_SCOPE("parallelFor");
+    const unsigned thread_count = m_thread_count;
+    const uint32_t chunks = (count - 1) / grain + 1;
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        const uint32_t begin = static_cast<uint32_t>(uint64_t(chunks) * i / thread_count);
+        const uint32_t end = static_cast<uint32_t>(uint64_t(chunks) * (i + 1) / thread_count);
+        m_ranges[i].bounds.store(packRange(begin, end), std::memory_order_relaxed);
+    }
+    m_job = &fn;
+    m_count = count;
+    m_grain = grain;
+    m_busy.store(static_cast<unsigned>(m_workers.size()), std::memory_order_relaxed);
+    m_generation.fetch_add(1, std::memory_order_release);
+
+    // a worker that already blocked checked the generation under the mutex, so taking it once orders this wake up
+    // after its wait. one that is still spinning sees the new generation by itself
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_wake.notify_all();
+
+    // the calling thread helps out
+    runChunks(0);
+
+    // every worker takes part in every job, even if there is nothing left by the time it wakes, so no one is still
+    // reading the ranges when the next job writes them
+    for (unsigned round = 0; m_busy.load(std::memory_order_acquire) != 0; round++)
+    {
+        cpuRelax(round);
+    }
+    m_job = nullptr;
+}
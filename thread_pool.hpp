@@ -0,0 +1,84 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent worker threads, so a parallel loop costs a wake up instead of a thread spawn.
+// every thread starts a loop on its own contiguous share of the chunks, so the same particles land on the same
+// thread from one substep to the next, and a thread that runs out steals half of what another has left.
+// between jobs the workers spin for up to 50 microseconds before they block, so the back to back loops of a frame
+// don't pay for a kernel wake up each
+class ThreadPool
+{
+private:
+    // the chunks [begin, end) a thread still has to run, packed into one word so the owner taking from the front
+    // and thieves taking from the back can both compare and swap it. one per cache line
+    struct alignas(64) ChunkRange
+    {
+        std::atomic<uint64_t> bounds{0};
+    };
+
+    std::vector<std::thread> m_workers;
+    unsigned m_thread_count = 0; // workers + 1, set before they start so they don't read m_workers
+    std::unique_ptr<ChunkRange[]> m_ranges; // [0] is the calling thread, [i] worker i
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+
+    // current job, chunk c covers [c * m_grain, (c + 1) * m_grain) of [0, m_count)
+    const std::function<void(uint32_t, uint32_t)>* m_job = nullptr;
+    uint32_t m_count = 0;
+    uint32_t m_grain = 1;
+
+    std::atomic<uint64_t> m_generation{0};
+    std::atomic<unsigned> m_busy{0}; // workers that haven't finished the current job
+    std::atomic<bool> m_stop{false};
+
+    bool m_deterministic = false;
+
+    // seen is the generation of the last job before the worker started, it must not run that one
+    void workerLoop(unsigned index, uint64_t seen);
+
+    // runs the thread's own chunks, then steals until no one has any left
+    void runChunks(unsigned index);
+
+    bool takeChunk(unsigned index, uint32_t& chunk);
+
+    bool stealChunks(unsigned index);
+
+    void start(unsigned worker_count);
+
+    void stop();
+
+public:
+    // thread_count includes the calling thread, 0 picks the hardware concurrency
+    explicit ThreadPool(unsigned thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned getThreadCount() const { return m_thread_count; }
+
+    void setThreadCount(unsigned thread_count);
+
+    // runs every loop on the calling thread, front to back, and leaves the workers parked. the chunks then run in
+    // the same order every time, for debugging and for single thread timings. the thread count is kept for when
+    // it is turned off
+    void setDeterministic(bool deterministic) { m_deterministic = deterministic; }
+
+    bool isDeterministic() const { return m_deterministic; }
+
+    // calls fn(begin, end) on chunks of about grain items covering [0, count), returns when all are done.
+    // from one thread at a time
+    void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "transport.hpp"
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    // every message goes out as its size followed by the bytes
+    using MessageSize = uint64_t;
+
+    struct Progress
+    {
+        std::size_t sent = 0;     // of header and body
+        std::size_t received = 0; // same
+        uint8_t header[sizeof(MessageSize)];
+    };
+}
+
+bool exchangeMessages(Transport& transport, const std::vector<int>& peers, const std::vector<std::vector<uint8_t>>& out,
+                      std::vector<std::vector<uint8_t>>& in, uint32_t timeout_ms)
+{
+    const std::size_t count = peers.size();
+    in.resize(count);
+
+    std::vector<Progress> progress(count);
+    std::vector<uint8_t> out_headers(count * sizeof(MessageSize));
+    for (std::size_t k = 0; k < count; k++)
+    {
+        const MessageSize size = out[k].size();
+        std::memcpy(out_headers.data() + k * sizeof(MessageSize), &size, sizeof(size));
+    }
+
+    auto last_progress = std::chrono::steady_clock::now();
+    for (unsigned round = 0;; round++)
+    {
+        bool done = true;
+        bool moved = false;
+        for (std::size_t k = 0; k < count; k++)
+        {
+            Progress& p = progress[k];
+            const int peer = peers[k];
+
+            // the header, then the body
+            const std::size_t out_total = sizeof(MessageSize) + out[k].size();
+            while (p.sent < out_total)
+            {
+                const std::size_t n = p.sent < sizeof(MessageSize)
+                    ? transport.trySend(peer, out_headers.data() + k * sizeof(MessageSize) + p.sent, sizeof(MessageSize) - p.sent)
+                    : transport.trySend(peer, out[k].data() + (p.sent - sizeof(MessageSize)), out_total - p.sent);
+                if (n == 0) break;
+                p.sent += n;
+                moved = true;
+            }
+
+            for (;;)
+            {
+                std::size_t n = 0;
+                if (p.received < sizeof(MessageSize))
+                {
+                    n = transport.tryReceive(peer, p.header + p.received, sizeof(MessageSize) - p.received);
+                    p.received += n;
+                    if (p.received == sizeof(MessageSize))
+                    {
+                        MessageSize size;
+                        std::memcpy(&size, p.header, sizeof(size));
+                        in[k].resize(static_cast<std::size_t>(size));
+                    }
+                }
+                else
+                {
+                    const std::size_t in_total = sizeof(MessageSize) + in[k].size();
+                    if (p.received == in_total) break;
+                    n = transport.tryReceive(peer, in[k].data() + (p.received - sizeof(MessageSize)), in_total - p.received);
+                    p.received += n;
+                }
+                if (n == 0) break;
+                moved = true;
+            }
+
+            done &= p.sent == out_total && p.received >= sizeof(MessageSize) &&
+                    p.received == sizeof(MessageSize) + in[k].size();
+        }
+
+        if (done) return true;
+        if (!transport.isOk()) return false;
+
+        if (moved)
+        {
+            last_progress = std::chrono::steady_clock::now();
+        }
+        else if ((round & 1023) == 1023)
+        {
+            const auto waited = std::chrono::steady_clock::now() - last_progress;
+            if (waited > std::chrono::milliseconds(timeout_ms)) return false;
+        }
+
+        // the other side is most likely still busy with its substep, let it have the core
+        if (!moved) std::this_thread::yield();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// byte streams between the ranks of a domain run. the slabs form a row, so a rank only ever talks to rank - 1
+// and rank + 1. neither call waits: each moves what it can right now and says how much that was
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    virtual int getRank() const = 0;
+
+    virtual int getRankCount() const = 0;
+
+    // appends up to bytes of data to the stream towards peer, returns how many were taken
+    virtual std::size_t trySend(int peer, const uint8_t* data, std::size_t bytes) = 0;
+
+    // takes up to bytes from the stream coming from peer, returns how many there were
+    virtual std::size_t tryReceive(int peer, uint8_t* data, std::size_t bytes) = 0;
+
+    // false once a link broke, nothing that went over it after that can be trusted
+    virtual bool isOk() const = 0;
+};
+
+// sends out[k] to peers[k] and receives one message from each of them into in[k]. all of them move at once, so
+// two ranks sending each other more than a link buffers never wait on each other. false if a link broke or
+// nothing arrived or left for timeout_ms, a peer that died looks like that
+bool exchangeMessages(Transport& transport, const std::vector<int>& peers, const std::vector<std::vector<uint8_t>>& out,
+                      std::vector<std::vector<uint8_t>>& in, uint32_t timeout_ms = 30000);
+
+#endif